@@ -1,3 +1,4 @@
+import json
 import re
 import sys
 
@@ -143,3 +144,16 @@ def extract_epoch_time(f):
                 times.append(float(res.group(1)))
         times = times
         return np.array(times), np.array(epochs)
+
+
+def extract_metrics(f, type="epoch"):
+    """Records of a --metrics file, e.g. the "epoch" records of every run"""
+    with open(f, "r") as file:
+        records = []
+        for line in file:
+            l = line.strip()
+            if l.startswith("{"):
+                rec = json.loads(l)
+                if type is None or rec["type"] == type:
+                    records.append(rec)
+        return records
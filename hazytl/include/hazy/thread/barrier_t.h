@@ -19,14 +19,86 @@
 #define HAZY_CONCUR_BARRIER_T_H
 
 #include <pthread.h>
+#include <sched.h>
+#include "hazy/util/nsec_time.h"
+#ifndef __APPLE__
+#include <climits>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 /* The prupose of this file is to allow the threading tools to be ported to
  * MacOSX which does not support pthread barriers. This is a naive barrier
- * implemtnation for the port which defaults to use pthreads when possible.
+ * implemtnation for the port. On Linux the barrier and the events spin for a
+ * while before sleeping on a futex, because the thread pool waits on them for
+ * every Execute()/Wait() and the wakeup latency of pthread primitives adds up
+ * with many threads and short tasks.
  */
 
 namespace hazy {
 namespace thread {
+//! Default time a thread spins in barrier_wait() before it sleeps
+const unsigned long long kBarrierSpinNSec = 50000;
+
+/* An event is a counter that threads wait on to change: a waiter reads seq,
+ * checks its condition, and only then calls event_wait() with the value it
+ * read, so a signal in between is never lost. On Linux the waiter spins for
+ * a while and then sleeps on the counter with a futex.
+ */
+struct event_t {
+  volatile int seq; //!< bumped by event_signal()
+  volatile int sleepers; //!< threads sleeping on the futex
+};
+
+void event_init(event_t *e) {
+  e->seq = 0;
+  e->sleepers = 0;
+}
+
+/*! \brief Blocks until e->seq differs from seen
+ * \param spin_nsec how long to spin before sleeping
+ */
+void event_wait(event_t *e, int seen, unsigned long long spin_nsec) {
+  unsigned long long deadline = 0;
+  for (unsigned spins = 1; e->seq == seen; ++spins) {
+    if ((spins & 63) == 0) {
+      // reading the clock is slower than the spin, do it every 64 rounds
+      unsigned long long now = util::CurrentNSec();
+      if (deadline == 0) {
+        deadline = now + spin_nsec;
+      } else if (now >= deadline) {
+        break;
+      }
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  }
+  while (e->seq == seen) {
+#ifdef __APPLE__
+    sched_yield();
+#else
+    __sync_fetch_and_add(&e->sleepers, 1);
+    // returns at once if seq already moved on
+    syscall(SYS_futex, &e->seq, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+    __sync_fetch_and_sub(&e->sleepers, 1);
+#endif
+  }
+}
+
+//! \brief Bumps e->seq and wakes all the waiters
+void event_signal(event_t *e) {
+  // full barrier: either a sleeper sees the new seq in FUTEX_WAIT, or we see
+  // it in sleepers
+  __sync_fetch_and_add(&e->seq, 1);
+#ifndef __APPLE__
+  if (e->sleepers > 0) {
+    syscall(SYS_futex, &e->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+  }
+#endif
+}
+
 #ifdef __APPLE__
 // we have to use our own barrier and timer
 struct barrier_t {
@@ -36,12 +108,24 @@ struct barrier_t {
   int current;
 };
 #else
-typedef pthread_barrier_t barrier_t;
+/* Centralized barrier. The last thread to arrive signals the release event;
+ * the others wait on it. The arrival counter and the event live on separate
+ * cache lines, so arrivals do not invalidate the line the waiting threads
+ * spin on, and the event counter replaces the per-thread sense of a
+ * sense-reversing barrier.
+ */
+struct barrier_t {
+  int total; //!< number of threads crossing the barrier
+  unsigned long long spin_nsec; //!< see barrier_set_spin()
+  volatile int count __attribute__((aligned(64))); //!< threads yet to arrive
+  event_t release __attribute__((aligned(64))); //!< signaled by the last one
+  char pad[64 - sizeof(event_t)];
+};
 #endif
 
 
 
-int barrier_init(barrier_t *b, void* attr, int count) {
+int barrier_init(barrier_t *b, void* /* attr */, int count) {
 #ifdef __APPLE__
   pthread_mutex_init(&b->mux, NULL);
   pthread_cond_init(&b->cond, NULL);
@@ -49,7 +133,11 @@ int barrier_init(barrier_t *b, void* attr, int count) {
   b->current = count;
   return 0;
 #else
-  return pthread_barrier_init(b, (pthread_barrierattr_t*)attr, count);
+  b->total = count;
+  b->spin_nsec = kBarrierSpinNSec;
+  b->count = count;
+  event_init(&b->release);
+  return 0;
 #endif
 }
 
@@ -71,17 +159,36 @@ int barrier_wait(barrier_t *b) {
   pthread_mutex_unlock(&b->mux);
   return 0;
 #else
-  return pthread_barrier_wait(b);
+  // read the event before arriving, the last thread may signal it at once
+  int seen = b->release.seq;
+  if (__sync_sub_and_fetch(&b->count, 1) == 0) {
+    b->count = b->total;
+    event_signal(&b->release);
+    return PTHREAD_BARRIER_SERIAL_THREAD;
+  }
+  event_wait(&b->release, seen, b->spin_nsec);
+  return 0;
 #endif
 }
 
 
-int barrier_destroy(barrier_t *b) {
+int barrier_destroy(barrier_t * /* b */) {
 #ifdef __APPLE__
   // XXX FIXME TODO
   return -1;
 #else
-  return pthread_barrier_destroy(b);
+  return 0;
+#endif
+}
+
+/*! \brief Sets how long barrier_wait() spins before it sleeps.
+ * Spinning returns faster when the other threads arrive soon, but takes a
+ * CPU away from them when the machine is oversubscribed.
+ * \param nsec spin time in nanoseconds, 0 to sleep at once
+ */
+void barrier_set_spin(barrier_t *b, unsigned long long nsec) {
+#ifndef __APPLE__
+  b->spin_nsec = nsec;
 #endif
 }
 
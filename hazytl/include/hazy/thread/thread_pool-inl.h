@@ -19,8 +19,14 @@
 #define HAZY_THREAD_THREAD_POOL_INL_H
 
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
 #include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <cstdio>
+#include <cstdlib>
 #include <string>
 #include <sstream>
 #include <fstream>
@@ -35,6 +41,15 @@ namespace hazy {
 namespace thread {
 
 namespace __threadpool {
+//! The worker running the calling thread, NULL outside of the pools
+static __thread ThreadMeta *current_worker = NULL;
+
+//! The process-wide pool, see ThreadPool::Shared()
+ThreadPool *& SharedPool() {
+  static ThreadPool *pool = NULL;
+  return pool;
+}
+
 // Hook which pthread_create will call for us
 // This simply calls back into the thread pool
 void* RunThread(void* thread_meta) {
@@ -45,55 +60,126 @@ void* RunThread(void* thread_meta) {
 }
 
 // A way to keep the types for the caller, this will be the call back
-// in the thread pool (callback_)
+// in the job (Job::invoke)
 template <class T>
-void Invoke(ThreadPool &tp, unsigned thread_id) {
-  tp.ThreadCallback<T>(thread_id);
+void Invoke(Job &job, unsigned thread_id) {
+  void (*hook)(T&, unsigned, unsigned) = reinterpret_cast<
+      void (*)(T&, unsigned, unsigned)>(job.hook);
+  hook(*static_cast<T*>(job.arg), thread_id, job.total);
 }
 } // namespace __threadpool
 
+ThreadPool::ThreadPool(ThreadPool &parent, unsigned first,
+                       unsigned n_threads) {
+  std::vector<unsigned> threads(n_threads);
+  for (unsigned i = 0; i < n_threads; ++i) {
+    threads[i] = (first + i) % parent.n_threads_;
+  }
+  InitView(parent, threads);
+}
+
+ThreadPool::ThreadPool(ThreadPool &parent,
+                       std::vector<unsigned> const &threads) {
+  InitView(parent, threads);
+}
+
+void ThreadPool::InitView(ThreadPool &parent,
+                          std::vector<unsigned> const &threads) {
+  n_threads_ = threads.size();
+  root_ = parent.root_;
+  workers_ = new unsigned[n_threads_];
+  metas_ = NULL;
+  threads_ = NULL;
+  cpuids_ = NULL;
+  thread_core_mapping_ = NULL;
+  thread_node_mapping_ = NULL;
+  thread_phycore_mapping_ = NULL;
+  thread_cache_mapping_ = NULL;
+  node_only_ = -1;
+  affinity_ = kAffinitySMTLast;
+  nice_ = 0;
+  barrier_spin_set_ = false;
+  unshared_ = true;
+  last_used_node_ = 0;
+  for (unsigned i = 0; i < n_threads_; ++i) {
+    workers_[i] = parent.workers_[threads[i] % parent.n_threads_];
+    int node = root_->thread_node_mapping_[workers_[i]];
+    last_used_node_ = std::max(last_used_node_, (unsigned) node + 1);
+  }
+  event_init(&done_);
+  ready_flag_ = true;
+}
+
 ThreadPool::~ThreadPool() {
+  if (root_ != this) {
+    delete [] workers_;
+    return;
+  }
   if (threads_ == NULL) {
     return;
   }
+  if (__threadpool::SharedPool() == this) {
+    __threadpool::SharedPool() = NULL;
+  }
   /* safely exit all threads */
   Join();
   /* cleanup */
+  for (unsigned i = 0; i < n_threads_; i++) {
+    pthread_mutex_destroy(&metas_[i].lock);
+  }
   delete [] threads_;
   delete [] metas_;
+  delete [] workers_;
   delete [] thread_core_mapping_;
   delete [] thread_node_mapping_;
   delete [] thread_phycore_mapping_;
+  delete [] thread_cache_mapping_;
   delete [] cpuids_;
-  barrier_destroy(&ready_);
-  barrier_destroy(&finished_);
 }
 
-void ThreadPool::Init() {
-  hook_ = NULL;
-  callback_ = NULL;
-  arg_ = NULL;
+ThreadPool & ThreadPool::Shared(unsigned n_threads) {
+  ThreadPool *&pool = __threadpool::SharedPool();
+  if (pool == NULL) {
+    // Init() registers the pool
+    (new ThreadPool(n_threads))->Init();
+  }
+  return *pool;
+}
 
-  // +1 because 'main' thread will join the barriers
-  barrier_init(&ready_, NULL, n_threads_+1);
-  barrier_init(&finished_, NULL, n_threads_+1);
+ThreadPool * ThreadPool::SharedIfAny() {
+  return __threadpool::SharedPool();
+}
+
+void ThreadPool::Init() {
+  if (root_ != this) {
+    return;
+  }
+  event_init(&done_);
 
   metas_ = new ThreadMeta[n_threads_];
+  workers_ = new unsigned[n_threads_];
 
   SetExitFlags(false);
   for (unsigned i = 0; i < n_threads_; i++) {
     metas_[i].thread_id = i;
-    metas_[i].ready = &ready_;
-    metas_[i].finished = &finished_;
     metas_[i].tpool = this;
     metas_[i].binded = false;
+    pthread_mutex_init(&metas_[i].lock, NULL);
+    event_init(&metas_[i].wake);
+    workers_[i] = i;
   }
 
   if(numa_available() < 0) {
     printf("System does not support NUMA API!\n");
     exit(0);
   }
+  // the CPUs of our cpuset, which may be sparse
   ncpus_ = numa_num_task_cpus();
+  max_cpus_ = numa_num_possible_cpus();
+  // a spinning thread would hold the CPU of a thread it waits for
+  if (!barrier_spin_set_ && n_threads_ + 1 > ncpus_) {
+    barrier_spin_nsec_ = 0;
+  }
   nnodes_ = numa_max_node() + 1;
   nphycpus_ = 0;
   printf("We are running on %d nodes and %d CPUs\n", nnodes_, ncpus_);
@@ -112,6 +198,12 @@ void ThreadPool::Init() {
     nphycpus_ += cpuids_[i].size();
   }
   printf("%d physical cores total.\n", nphycpus_);
+  GetCacheDomains();
+  printf("%d last level cache domains:", ncaches_);
+  for (unsigned d = 0; d < ncaches_; ++d) {
+    printf(" %d", cache_phycpus_[d]);
+  }
+  printf(" cores\n");
   ConfigThreadAffinity(); 
   threads_ = new pthread_t[n_threads_];
   for (unsigned i = 0; i < n_threads_; i++) {
@@ -119,80 +211,282 @@ void ThreadPool::Init() {
                    static_cast<void*>(&metas_[i]));
   }
   ready_flag_ = true;
+  if (__threadpool::SharedPool() == NULL && !unshared_) {
+    __threadpool::SharedPool() = this;
+  }
 }
 
+void ThreadPool::SetBarrierSpin(unsigned long long nsec) {
+  root_->barrier_spin_nsec_ = nsec;
+  root_->barrier_spin_set_ = true;
+}
+
+std::vector<int> ThreadPool::ParseCPUList(std::string const &list) {
+  std::vector<int> cpus;
+  std::istringstream ss(list);
+  std::string range;
+  long const ncpus = numa_num_possible_cpus();
+  while (std::getline(ss, range, ',')) {
+    char const *p = range.c_str();
+    char *end;
+    errno = 0;
+    // strtol also takes blanks and signs, only digits are valid here
+    bool ok = isdigit(*p);
+    long first = strtol(p, &end, 10);
+    long last = first;
+    if (ok && *end == '-') {
+      p = end + 1;
+      ok = isdigit(*p);
+      last = strtol(p, &end, 10);
+    }
+    if (!ok || errno != 0 || *end != '\0' || last < first) {
+      printf("malformed CPU range \"%s\", expected N or N-M with N <= M\n",
+             range.c_str());
+      return std::vector<int>();
+    }
+    if (last >= ncpus) {
+      printf("CPU %ld is past the last possible CPU %ld\n", last, ncpus - 1);
+      return std::vector<int>();
+    }
+    for (long cpu = first; cpu <= last; ++cpu)
+      cpus.push_back((int) cpu);
+  }
+  return cpus;
+}
+
+int ThreadPool::ParseAffinity(std::string const &name) {
+  if (name == "smt_last")
+    return kAffinitySMTLast;
+  if (name == "compact")
+    return kAffinityCompact;
+  if (name == "scatter")
+    return kAffinityScatter;
+  return -1;
+}
+
+std::vector<int> ThreadPool::ReadCPUList(std::string const &path) {
+  std::ifstream f(path.c_str());
+  std::string list;
+  std::getline(f, list);
+  return ParseCPUList(list);
+}
+
+int ThreadPool::LastLevelCache(int cpu) {
+  int best_level = 0;
+  int domain = -1;
+  for (int index = 0; ; ++index) {
+    std::stringstream path;
+    path << "/sys/devices/system/cpu/cpu" << cpu << "/cache/index" << index << "/";
+    std::ifstream level_file((path.str() + "level").c_str());
+    std::ifstream type_file((path.str() + "type").c_str());
+    if (!level_file || !type_file)
+      break;
+    int level;
+    std::string type;
+    level_file >> level;
+    type_file >> type;
+    if (type == "Instruction" || level <= best_level)
+      continue;
+    std::vector<int> shared = ReadCPUList(path.str() + "shared_cpu_list");
+    if (shared.empty())
+      continue;
+    best_level = level;
+    domain = *std::min_element(shared.begin(), shared.end());
+  }
+  return domain;
+}
+
+namespace __threadpool {
+// Orders physical cores by the domain of their first logical core
+struct CacheDomainLess {
+  std::vector<int> const &domain_of;
+  explicit CacheDomainLess(std::vector<int> const &d) : domain_of(d) { }
+  bool operator()(std::vector<int> const &a, std::vector<int> const &b) const {
+    return domain_of[a[0]] < domain_of[b[0]];
+  }
+};
+} // namespace __threadpool
+
 void ThreadPool::GetTopology() {
-  std::vector<int> known_siblings;
-  for (unsigned cpu = 0; cpu < ncpus_; ++cpu) {
-    // skip a core if it is a hyper-threaded logical core
-    if (std::find(known_siblings.begin(), known_siblings.end(), cpu) != known_siblings.end())
+  // the CPUs of our cpuset (offline CPUs are not in it either)
+  struct bitmask *allowed = numa_all_cpus_ptr;
+  // the lowest CPU of the domain for now, numbered by GetCacheDomains()
+  cpu_cache_domain_.assign(max_cpus_, -1);
+  cpu_phycore_.assign(max_cpus_, -1);
+  for (unsigned cpu = 0; cpu < max_cpus_; ++cpu) {
+    // skip a core if it is not ours or a hyper-threaded logical core
+    if (!numa_bitmask_isbitset(allowed, cpu) || cpu_phycore_[cpu] >= 0)
       continue;
     // if this core is not known as a sibling, add it to the core vector of its node
     int node = numa_node_of_cpu(cpu);
-    std::vector<int> phy_core;
-    // find out the siblings of this core
     std::stringstream path;
     path << "/sys/devices/system/cpu/cpu" << cpu << "/topology/thread_siblings_list";
-    std::ifstream f(path.str().c_str());
-    if (f) {
-      std::string siblings((std::istreambuf_iterator<char>(f)),
-		     std::istreambuf_iterator<char>());
-      f.close();
-      // std::cout << "CPU " << cpu << " siblings:" << siblings << std::endl;
-      std::istringstream ss(siblings);
-      std::string coreid;
-      while(std::getline(ss, coreid, ',')) {
-	known_siblings.push_back(atoi(coreid.c_str()));
-        phy_core.push_back(atoi(coreid.c_str()));
-      }
-      /*
-      printf("Known siblings when processing core %d\n", cpu); 
-      for (std::vector<int>::const_iterator t = known_siblings.begin(); t != known_siblings.end(); ++t)
-	printf("%d ", *t);
-      putchar('\n');
-      */
+    std::vector<int> siblings = ReadCPUList(path.str());
+    // siblings outside the cpuset are not used
+    std::vector<int> phy_core(1, cpu);
+    for (std::vector<int>::const_iterator t = siblings.begin(); t != siblings.end(); ++t) {
+      if (*t > (int) cpu && *t < (int) max_cpus_ && numa_bitmask_isbitset(allowed, *t))
+        phy_core.push_back(*t);
     }
-    else {
-      phy_core.push_back(cpu);
+    // without cache information, the node is a single domain
+    int domain = LastLevelCache(cpu);
+    if (domain < 0)
+      domain = max_cpus_ + node;
+    for (std::vector<int>::const_iterator t = phy_core.begin(); t != phy_core.end(); ++t) {
+      cpu_phycore_[*t] = cpu;
+      cpu_cache_domain_[*t] = domain;
     }
     cpuids_[node].push_back(phy_core);
   }
+  // consecutive threads fill a cache domain before the next one
+  for (unsigned n = 0; n < nnodes_; ++n) {
+    std::stable_sort(cpuids_[n].begin(), cpuids_[n].end(),
+                     __threadpool::CacheDomainLess(cpu_cache_domain_));
+  }
+  if (node_only_ >= 0) {
+    // keep the cores of the requested node only
+    std::vector<unsigned> cpu_nodes;
+    for (unsigned n = 0; n < nnodes_; ++n) {
+      if (!cpuids_[n].empty())
+        cpu_nodes.push_back(n);
+    }
+    unsigned keep = cpu_nodes[node_only_ % cpu_nodes.size()];
+    for (unsigned n = 0; n < nnodes_; ++n) {
+      if (n != keep)
+        cpuids_[n].clear();
+    }
+  }
+}
+
+void ThreadPool::GetCacheDomains() {
+  std::vector<int> domain_cpu; // lowest CPU of each domain, by index
+  std::vector<int> index(max_cpus_, -1);
+  cache_phycpus_.clear();
+  for (unsigned n = 0; n < nnodes_; ++n) {
+    for (std::vector<std::vector<int> >::const_iterator core = cpuids_[n].begin();
+         core != cpuids_[n].end(); ++core) {
+      int cpu = cpu_cache_domain_[(*core)[0]];
+      unsigned d = std::find(domain_cpu.begin(), domain_cpu.end(), cpu) - domain_cpu.begin();
+      if (d == domain_cpu.size()) {
+        domain_cpu.push_back(cpu);
+        cache_phycpus_.push_back(0);
+      }
+      cache_phycpus_[d]++;
+      for (std::vector<int>::const_iterator t = core->begin(); t != core->end(); ++t) {
+        index[*t] = d;
+      }
+    }
+  }
+  // CPUs of the nodes left out by RestrictToNode() stay at -1
+  cpu_cache_domain_.swap(index);
+  ncaches_ = domain_cpu.size();
 }
 
 void ThreadPool::ConfigThreadAffinity() {
   thread_core_mapping_ = new int[n_threads_];
   thread_node_mapping_ = new int[n_threads_];
   thread_phycore_mapping_ = new int[n_threads_];
-  int node_id, core_id, phycore_id;
+  thread_cache_mapping_ = new int[n_threads_];
+  std::vector<int> order = PlacementOrder();
   last_used_node_ = 0;
   for (unsigned i = 0; i < n_threads_; ++i) {
-    AssignThreadAffinity(i, &node_id, &core_id, &phycore_id);
-    thread_core_mapping_[i] = core_id;
+    int cpu = order[i % order.size()];
+    int node_id = numa_node_of_cpu(cpu);
+    thread_core_mapping_[i] = cpu;
     thread_node_mapping_[i] = node_id;
     last_used_node_ = std::max(last_used_node_, (unsigned)node_id);
-    thread_phycore_mapping_[i] = phycore_id;
-//    printf("Thread %d mapped to core %d (phycore %d) on node %d\n", i, core_id, phycore_id, node_id);
+    thread_phycore_mapping_[i] = cpu_phycore_[cpu];
+    thread_cache_mapping_[i] = cpu_cache_domain_[cpu];
+//    printf("Thread %d mapped to core %d (phycore %d) on node %d\n", i, cpu, cpu_phycore_[cpu], node_id);
   }  
   last_used_node_ += 1;
 }
 
+std::vector<int> ThreadPool::UnusedCPUs() {
+  ThreadPool &root = *root_;
+  std::vector<int> order = root.PlacementOrder();
+  std::vector<int> unused;
+  for (std::vector<int>::const_iterator cpu = order.begin(); cpu != order.end(); ++cpu) {
+    if (std::find(root.thread_core_mapping_, root.thread_core_mapping_ + root.n_threads_, *cpu)
+        == root.thread_core_mapping_ + root.n_threads_) {
+      unused.push_back(*cpu);
+    }
+  }
+  return unused;
+}
+
+std::vector<int> ThreadPool::PlacementOrder() {
+  std::vector<int> order;
+  if (affinity_ == kAffinityList) {
+    for (std::vector<int>::const_iterator cpu = cpu_list_.begin(); cpu != cpu_list_.end(); ++cpu) {
+      if (*cpu < 0 || *cpu >= (int) max_cpus_ || cpu_phycore_[*cpu] < 0) {
+        printf("CPU %d is not available to this process\n", *cpu);
+        exit(-1);
+      }
+    }
+    return cpu_list_;
+  }
+  size_t max_smt = 0, max_cores = 0;
+  for (unsigned n = 0; n < nnodes_; ++n) {
+    max_cores = std::max(max_cores, cpuids_[n].size());
+    for (size_t c = 0; c < cpuids_[n].size(); ++c)
+      max_smt = std::max(max_smt, cpuids_[n][c].size());
+  }
+  if (affinity_ == kAffinityCompact) {
+    for (unsigned n = 0; n < nnodes_; ++n)
+      for (size_t c = 0; c < cpuids_[n].size(); ++c)
+        order.insert(order.end(), cpuids_[n][c].begin(), cpuids_[n][c].end());
+    return order;
+  }
+  for (size_t ht = 0; ht < max_smt; ++ht) {
+    if (affinity_ == kAffinityScatter) {
+      // core c of every node before core c + 1
+      for (size_t c = 0; c < max_cores; ++c)
+        for (unsigned n = 0; n < nnodes_; ++n)
+          if (c < cpuids_[n].size() && ht < cpuids_[n][c].size())
+            order.push_back(cpuids_[n][c][ht]);
+    }
+    else {
+      for (unsigned n = 0; n < nnodes_; ++n)
+        for (size_t c = 0; c < cpuids_[n].size(); ++c)
+          if (ht < cpuids_[n][c].size())
+            order.push_back(cpuids_[n][c][ht]);
+    }
+  }
+  return order;
+}
+
 int ThreadPool::GetThreadCoreAffinity(unsigned thread_id) const {
-  if (thread_core_mapping_ != NULL && thread_id < n_threads_)
-    return thread_core_mapping_[thread_id];
+  if (root_->thread_core_mapping_ != NULL && thread_id < n_threads_)
+    return root_->thread_core_mapping_[workers_[thread_id]];
   else
     return -1;
 }
 
 int ThreadPool::GetThreadPhyCoreAffinity(unsigned thread_id) const {
-  if (thread_phycore_mapping_ != NULL && thread_id < n_threads_)
-    return thread_phycore_mapping_[thread_id];
+  if (root_->thread_phycore_mapping_ != NULL && thread_id < n_threads_)
+    return root_->thread_phycore_mapping_[workers_[thread_id]];
   else
     return -1;
 }
 
+int ThreadPool::GetThreadCacheDomain(unsigned thread_id) const {
+  if (root_->thread_cache_mapping_ != NULL && thread_id < n_threads_)
+    return root_->thread_cache_mapping_[workers_[thread_id]];
+  else
+    return -1;
+}
+
+unsigned ThreadPool::CacheDomainPhyCPUCount(unsigned domain) const {
+  if (domain < root_->cache_phycpus_.size())
+    return root_->cache_phycpus_[domain];
+  else
+    return 0;
+}
+
 int ThreadPool::GetThreadNodeAffinity(unsigned thread_id) const {
-  if (thread_node_mapping_ != NULL && thread_id < n_threads_)
-    return thread_node_mapping_[thread_id];
+  if (root_->thread_node_mapping_ != NULL && thread_id < n_threads_)
+    return root_->thread_node_mapping_[workers_[thread_id]];
   else
     return -1;
 }
@@ -207,73 +501,132 @@ void ThreadPool::BindToCPU(ThreadMeta &meta) {
   numa_free_cpumask(cpu_mask);
 }
 
-void ThreadPool::AssignThreadAffinity(unsigned thread_id, int * node_id, int * core_id, int * phycore_id) {
-  int node = -1;
-  int ht_id = thread_id / nphycpus_;
-  int coreid = thread_id % nphycpus_; 
-  int i;
-  for (i = 0; i <= coreid; i += cpuids_[++node].size());
-  i = coreid - i + cpuids_[node].size();
-  // printf("i = %d, node = %d, ht_id = %d, coreid = %d\n", i, node, ht_id, coreid);
-  int core = cpuids_[node][i][ht_id % cpuids_[node][i].size()];
-  int phycore = cpuids_[node][i][0];
-  *node_id = node;
-  *core_id = core;
-  *phycore_id = phycore;
-}
-
 void ThreadPool::ThreadLoop(ThreadMeta &meta) {
+  __threadpool::current_worker = &meta;
+  // we want to bind our thread to a specified CPU
+  BindToCPU(meta);
+  if (nice_ != 0) {
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), nice_);
+  }
+  meta.binded = true;
   while (true) {
-    barrier_wait(meta.ready);
-    // we want to bind our thread to a specified CPU
-    if (!meta.binded) {
-      BindToCPU(meta);
-      meta.binded = true;
+    // read before looking at the queue, see event_wait()
+    int seen = meta.wake.seq;
+    if (RunQueued(meta)) {
+      continue;
     }
     if (meta.exit_flag) {
       break;
     }
-    callback_(*this, meta.thread_id);
-    barrier_wait(meta.finished);
+    event_wait(&meta.wake, seen, barrier_spin_nsec_);
   }
 }
 
-template <class Task>
-void ThreadPool::ThreadCallback(unsigned thread_id) {
-  Task *t = static_cast<Task*>(arg_);
-  void (*hook)(Task&, unsigned, unsigned) = reinterpret_cast<
-      void (*)(Task&, unsigned, unsigned)>(hook_);
-  // int cpu;
-  // cpu = sched_getcpu();
-  // printf("This is thread %u, running on CPU %d\n", thread_id, cpu);
-  hook(*t, thread_id, n_threads_);
-  // cpu = sched_getcpu();
-  // printf("Thread %u exiting hook, running on CPU %d\n", thread_id, cpu);
+void ThreadPool::Post(unsigned worker, JobShare const &share) {
+  ThreadMeta &meta = metas_[worker];
+  pthread_mutex_lock(&meta.lock);
+  meta.jobs.push_back(share);
+  pthread_mutex_unlock(&meta.lock);
+  event_signal(&meta.wake);
+}
+
+bool ThreadPool::RunQueued(ThreadMeta &meta) {
+  pthread_mutex_lock(&meta.lock);
+  if (meta.jobs.empty()) {
+    pthread_mutex_unlock(&meta.lock);
+    return false;
+  }
+  JobShare share = meta.jobs.front();
+  meta.jobs.pop_front();
+  pthread_mutex_unlock(&meta.lock);
+  RunShare(share);
+  return true;
+}
+
+void ThreadPool::RunShare(JobShare const &share) {
+  Job &job = *share.job;
+  job.invoke(job, share.tid);
+  // the waiter may reuse the job once pending is zero, read it before
+  event_t *waiter = job.waiter;
+  if (__sync_sub_and_fetch(&job.pending, 1) == 0) {
+    event_signal(waiter);
+    job.complete = 1;
+  }
+}
+
+ThreadMeta * ThreadPool::CurrentWorker() {
+  ThreadMeta *meta = __threadpool::current_worker;
+  if (meta != NULL && meta->tpool == root_) {
+    return meta;
+  }
+  return NULL;
 }
 
 template <class Task>
 void ThreadPool::Execute(Task &task, void (*hook)(Task&, unsigned, 
                          unsigned)) {
   assert(ready_flag_);
-  // assign each 
-  arg_ = &task; 
-  hook_ = reinterpret_cast<void*>(hook);
-  callback_ = &__threadpool::Invoke<Task>;
+  ThreadMeta *self = CurrentWorker();
+  job_.invoke = &__threadpool::Invoke<Task>;
+  job_.arg = &task; 
+  job_.hook = reinterpret_cast<void*>(hook);
+  job_.total = n_threads_;
+  job_.pending = n_threads_;
+  job_.complete = 0;
+  // a worker waits on its own event, so that it also wakes up for shares
+  // queued to it while it waits
+  job_.waiter = self != NULL ? &self->wake : &done_;
   ready_flag_ = false;
-  barrier_wait(&ready_);
+  inline_.clear();
+  // assign each 
+  for (unsigned i = 0; i < n_threads_; i++) {
+    JobShare share = { &job_, i };
+    if (self != NULL && workers_[i] == self->thread_id) {
+      // our own share, run by Wait()
+      inline_.push_back(i);
+    } else {
+      root_->Post(workers_[i], share);
+    }
+  }
 }
 
 void ThreadPool::Wait() {
   assert(!ready_flag_);
-  barrier_wait(&finished_);
+  ThreadMeta *self = CurrentWorker();
+  for (size_t i = 0; i < inline_.size(); ++i) {
+    JobShare share = { &job_, inline_[i] };
+    RunShare(share);
+  }
+  while (true) {
+    int seen = job_.waiter->seq;
+    if (job_.pending == 0) {
+      break;
+    }
+    // help with the shares of other jobs queued to us, they may be what the
+    // job is waiting for
+    if (self != NULL && root_->RunQueued(*self)) {
+      continue;
+    }
+    event_wait(job_.waiter, seen, root_->barrier_spin_nsec_);
+  }
+  // the last share is still signaling the waiter
+  while (!job_.complete) {
+    sched_yield();
+  }
   ready_flag_ = true;
 }
 
 void ThreadPool::Join() {
   assert(ready_flag_);
+  if (root_ != this || (n_threads_ > 0 && metas_[0].exit_flag)) {
+    // a view, or already joined
+    return;
+  }
 
   SetExitFlags(true);
-  barrier_wait(&ready_);
+  for (unsigned i = 0; i < n_threads_; i++) {
+    event_signal(&metas_[i].wake);
+  }
   for (unsigned i = 0; i < n_threads_; i++) {
     pthread_join(threads_[i], NULL);
   }
@@ -282,4 +635,3 @@ void ThreadPool::Join() {
 } // namespace thread
 } // namespace hazy
 #endif
-
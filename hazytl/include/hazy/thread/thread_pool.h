@@ -20,6 +20,8 @@
 
 #include <pthread.h>
 #include <numa.h>
+#include <deque>
+#include <string>
 #include <vector>
 
 #include "hazy/thread/barrier_t.h"
@@ -27,18 +29,57 @@
 namespace hazy {
 namespace thread {
 
+/*! \brief One call to Execute(), shared by the threads that run it.
+ */
+struct Job {
+  void (*invoke)(Job&, unsigned); //!< calls hook on arg for a thread id
+  void *arg; //!< the Task& argument from Execute, cast to void*
+  void *hook; //!< the hook* from Execute, cast to void*
+  unsigned total; //!< number of threads of the job
+  volatile int pending; //!< shares not finished yet
+  volatile int complete; //!< set after the last share signaled the waiter
+  event_t *waiter; //!< signaled when pending drops to zero
+};
+
+/*! \brief The part of a job run by one thread */
+struct JobShare {
+  Job *job;
+  unsigned tid; //!< thread id within the job
+};
+
 /*! \brief A structure to allow threads to sychornize themselves with the pool.
  */
-struct ThreadMeta {
+struct __attribute__((aligned(64))) ThreadMeta {
   unsigned thread_id; //!< [0, 1, ..., N]
-  bool exit_flag; //!< set to true to have thread exit safely
+  volatile bool exit_flag; //!< set to true to have thread exit safely
   bool binded; //!< set to true after the thread has been binded to a CPU
-  barrier_t *ready; //!< wait for a task to work on
-  barrier_t *finished; //!< wait after the task is done
   void *tpool; //!< callback into the threadpool that created it
+  pthread_mutex_t lock; //!< guards jobs
+  std::deque<JobShare> jobs; //!< shares queued for this thread
+  event_t wake; //!< signaled when a share is queued or an awaited job ends
 };
 
-/*! \brief A simple homogenous worker thread pool
+//! Placement of the threads of a pool on its CPUs, see ThreadPool::SetAffinity()
+enum AffinityPolicy {
+  kAffinitySMTLast, //!< one thread per physical core node after node, then the SMT siblings
+  kAffinityCompact, //!< all the SMT siblings of a core before the next core
+  kAffinityScatter, //!< round robin over the nodes, then the SMT siblings
+  kAffinityList //!< the CPUs given to SetCPUList(), in order
+};
+
+/*! \brief A homogenous pool of pinned worker threads.
+ *
+ * A pool created with a thread count (a root pool) owns its threads, detects
+ * the CPU topology and pins the threads. A pool created from another pool (a
+ * view) owns no threads: its thread i is a worker of the root pool, so
+ * several jobs (e.g. the balls of BestBall, or a loader next to the
+ * training) can run at once on disjoint or shared workers without creating
+ * more OS threads.
+ *
+ * Each worker runs the shares queued to it in order. A thread that waits for
+ * a job runs its own share itself and, if it is a worker, also runs the
+ * shares queued to it in the meantime, so a job may Execute() nested jobs on
+ * any view of its root without deadlocking.
  */
 class ThreadPool {
  public:
@@ -46,15 +87,109 @@ class ThreadPool {
    * \param n_threads Number of threads
    */
   explicit ThreadPool(unsigned n_threads) : n_threads_(n_threads), 
-      threads_(NULL), cpuids_(NULL), 
+      root_(this), workers_(NULL), metas_(NULL),
+      threads_(NULL), ready_flag_(false), cpuids_(NULL), 
       thread_core_mapping_(NULL), thread_node_mapping_(NULL),
-      thread_phycore_mapping_(NULL) { }
+      thread_phycore_mapping_(NULL), thread_cache_mapping_(NULL),
+      node_only_(-1), affinity_(kAffinitySMTLast), nice_(0),
+      barrier_spin_nsec_(kBarrierSpinNSec), barrier_spin_set_(false),
+      unshared_(false) { }
+
+  /*! \brief Creates a view on threads of another pool, ready to use.
+   * The threads are first, first+1, ... of parent, wrapping around when
+   * n_threads is larger than parent.
+   * \param parent a pool or a view, after its Init()
+   * \param first the first thread of parent in the view
+   * \param n_threads number of threads of the view
+   */
+  ThreadPool(ThreadPool &parent, unsigned first, unsigned n_threads);
+
+  /*! \brief Creates a view on the given threads of another pool
+   * \param parent a pool or a view, after its Init()
+   * \param threads thread ids in parent, thread i of the view is threads[i]
+   */
+  ThreadPool(ThreadPool &parent, std::vector<unsigned> const &threads);
 
   virtual ~ThreadPool();
 
-  /*! \brief create the treads for this pool, call exaclty once before use */
+  /*! \brief The process-wide pool: the first root pool that was initialized.
+   * If there is none yet, a pool of n_threads threads is created for the
+   * lifetime of the process. Take views of it instead of creating pools.
+   */
+  static ThreadPool & Shared(unsigned n_threads);
+
+  //! The process-wide pool, NULL if no root pool was initialized yet
+  static ThreadPool * SharedIfAny();
+
+  /*! \brief create the treads for this pool, call exaclty once before use.
+   * Does nothing for a view.
+   */
   void Init();
 
+  /*! \brief Only use the cores of a single node, call before Init()
+   * Nodes without CPUs are skipped, so any index can be given: the n-th node
+   * with CPUs (modulo their number) is used.
+   * \param node index of the node
+   */
+  void RestrictToNode(int node) { node_only_ = node; }
+
+  /*! \brief How the threads are placed on the CPUs, call before Init()
+   * Only the CPUs the process is allowed to run on (its cpuset) are used.
+   * Thread i goes to the i-th CPU of the placement order, wrapping around
+   * when there are more threads than CPUs. The default kAffinitySMTLast puts
+   * the first PhyCPUCount() threads on distinct physical cores, which the
+   * HogWild++ clusters assume.
+   * \param policy one of AffinityPolicy, kAffinityList is set by SetCPUList()
+   */
+  void SetAffinity(int policy) { affinity_ = policy; }
+
+  /*! \brief Places thread i on cpus[i % cpus.size()], call before Init()
+   * Exits if a CPU is not allowed for the process.
+   */
+  void SetCPUList(std::vector<int> const &cpus) {
+    affinity_ = kAffinityList;
+    cpu_list_ = cpus;
+  }
+
+  /*! \brief Scheduling priority of the threads, call before Init()
+   * A pool that runs next to another one on the same CPUs (e.g. an
+   * evaluation next to the training) can be niced to only take the time
+   * left over by the other pool.
+   * \param nice the nice value of the threads, see setpriority(2)
+   */
+  void SetNice(int nice) { nice_ = nice; }
+
+  /*! \brief Never becomes the Shared() pool, call before Init()
+   * For the helper threads of a component, e.g. the loader of a FileScan,
+   * which may be initialized before the pool of the application.
+   */
+  void SetUnshared() { unshared_ = true; }
+
+  /*! \brief The allowed CPUs that no thread of this pool is pinned to,
+   * in placement order. Can be given to SetCPUList() of another pool.
+   */
+  std::vector<int> UnusedCPUs();
+
+  /*! \brief Parses a sysfs style CPU list such as "0-3,8-11"
+   * Prints why and returns an empty list on a malformed range (trailing
+   * characters, a reversed range) or a CPU past the possible ones.
+   * \return the CPUs in the order of the list, empty if malformed
+   */
+  static std::vector<int> ParseCPUList(std::string const &list);
+
+  /*! \brief Parses the name of an affinity policy
+   * \return the AffinityPolicy: smt_last, compact or scatter, -1 if unknown
+   */
+  static int ParseAffinity(std::string const &name);
+
+  /*! \brief Time a waiting thread spins in Execute()/Wait() and in the
+   * worker loop before it sleeps, see event_wait(). By default it
+   * spins for kBarrierSpinNSec, or not at all when the pool has more threads
+   * than CPUs. Applies to the root pool of a view.
+   * \param nsec spin time in nanoseconds
+   */
+  void SetBarrierSpin(unsigned long long nsec);
+
   /*! \brief Invoke the function on the task in each thread
    * The thread id and total number of threads are passed to the function.
    * Call Wait() to wait for ALL threads to finish before calling Execute again.
@@ -71,6 +206,7 @@ class ThreadPool {
   void Wait();
 
   /*! Call to tear down the threads and join them, only call once before d'tor.
+   * Does nothing for a view.
    * \note do not call if threads are execting. 
    */
   void Join();
@@ -80,36 +216,40 @@ class ThreadPool {
    */
   inline void ThreadLoop(ThreadMeta &meta);
 
-  /*! \brief for private use
-   * Allows the threads to call back into this class
-   */
-  template <class Task>
-  void ThreadCallback(unsigned thread_id);
-
   /*! \brief Returns the number of threads in this pool.
    * \return number of threads in this pool
    */
   unsigned ThreadCount() { return n_threads_; }
 
-  unsigned CPUCount() const { return ncpus_;}
-  unsigned NodeCount() const { return nnodes_;}
-  unsigned PhyCPUCount() const { return nphycpus_; }
+  unsigned CPUCount() const { return root_->ncpus_;}
+  unsigned NodeCount() const { return root_->nnodes_;}
+  unsigned PhyCPUCount() const { return root_->nphycpus_; }
   unsigned UsedNodeCount() const { return last_used_node_; }
-  const std::vector<std::vector<int> > * Topology() const { return cpuids_; }
+  const std::vector<std::vector<int> > * Topology() const { return root_->cpuids_; }
+  /*! \brief Number of last level cache domains with cores in the pool.
+   * A domain is a set of cores sharing the last level cache, e.g. a CCX of
+   * an AMD EPYC (several per node) or a whole socket of most Intel CPUs.
+   * Consecutive physical cores of a node belong to the same domain.
+   */
+  unsigned CacheDomainCount() const { return root_->ncaches_; }
+  //! Number of physical cores in the given cache domain
+  unsigned CacheDomainPhyCPUCount(unsigned domain) const;
   int GetThreadCoreAffinity(unsigned thread_id) const; 
   int GetThreadNodeAffinity(unsigned thread_id) const;
   int GetThreadPhyCoreAffinity(unsigned thread_id) const;
+  //! Cache domain of the core of a thread, see CacheDomainCount()
+  int GetThreadCacheDomain(unsigned thread_id) const;
 
  private:
   unsigned n_threads_; //!< number of thrads in the pool
-  barrier_t ready_; //!< wait for a task to work on
-  barrier_t finished_; //!< wait when done working on a task
+  ThreadPool *root_; //!< the pool that owns the threads, this for a root
+  unsigned *workers_; //!< thread i of this pool is worker workers_[i] of root
   ThreadMeta *metas_; //!< one for each thread, thread-specific meta data
   pthread_t *threads_; //!< pthead objects, one per thread
   bool ready_flag_; //!< ready for a call to Execute()
-  void *arg_; //!< the Task& argument from Execute, cast to void*
-  void *hook_; //!< the hook* from Execute, cast to void*
-  void (*callback_)(ThreadPool&, unsigned); //!< template nonsense callback
+  Job job_; //!< the job of the last Execute()
+  event_t done_; //!< waited on by a caller of Wait() that is not a worker
+  std::vector<unsigned> inline_; //!< shares Wait() runs in the calling thread
 
   unsigned ncpus_;
   unsigned nnodes_;
@@ -119,10 +259,37 @@ class ThreadPool {
   int * thread_core_mapping_;
   int * thread_node_mapping_;
   int * thread_phycore_mapping_;
+  int * thread_cache_mapping_;
+  unsigned ncaches_;
+  std::vector<int> cpu_cache_domain_; //!< cache domain of each CPU, -1 if unused
+  std::vector<unsigned> cache_phycpus_; //!< physical cores of each cache domain
+  int node_only_; //!< see RestrictToNode(), -1 to use all nodes
+  int affinity_; //!< see SetAffinity()
+  std::vector<int> cpu_list_; //!< see SetCPUList()
+  int nice_; //!< see SetNice()
+  unsigned max_cpus_; //!< one more than the highest CPU id
+  std::vector<int> cpu_phycore_; //!< first sibling of each allowed CPU, -1 if not allowed
+  unsigned long long barrier_spin_nsec_; //!< see SetBarrierSpin()
+  bool barrier_spin_set_; //!< SetBarrierSpin() was called
+  bool unshared_; //!< see SetUnshared()
   void BindToCPU(ThreadMeta &meta);
   void GetTopology();
-  void AssignThreadAffinity(unsigned thread_id, int * node_id, int * core_id, int * phycore_id);
+  void GetCacheDomains();
+  //! Parses a sysfs CPU list such as "0-3,8-11"
+  static std::vector<int> ReadCPUList(std::string const &path);
+  //! Lowest CPU sharing the last level cache of cpu, -1 if unknown
+  static int LastLevelCache(int cpu);
+  //! The CPUs in the order threads are placed on them
+  std::vector<int> PlacementOrder();
   void ConfigThreadAffinity(); 
+  void InitView(ThreadPool &parent, std::vector<unsigned> const &threads);
+  //! Queues a share to a worker of this root pool
+  void Post(unsigned worker, JobShare const &share);
+  //! Runs the next share queued to meta, returns false if there is none
+  bool RunQueued(ThreadMeta &meta);
+  static void RunShare(JobShare const &share);
+  //! The worker of this root that runs the calling thread, or NULL
+  ThreadMeta * CurrentWorker();
   
   /*! \brief tell all the threads to exit safely (at some point) */
   void SetExitFlags(bool flag) {
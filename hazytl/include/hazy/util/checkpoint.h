@@ -0,0 +1,313 @@
+// Copyright 2012 Victor Bittorf, Chris Re
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Hazy Template Library
+
+
+#ifndef HAZY_UTIL_CHECKPOINT_H
+#define HAZY_UTIL_CHECKPOINT_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "hazy/util/simple_random-inl.h"
+
+namespace hazy {
+namespace util {
+
+//! Version written by CheckpointWriter, Checkpoint reads only this one
+const uint32_t kCheckpointVersion = 1;
+
+//! Offset of the weights in the file, a page so that they map aligned
+const size_t kCheckpointDataOffset = 4096;
+
+/*! \brief The header of a checkpoint file
+ * Followed at kCheckpointDataOffset by replicas arrays of dim doubles, one
+ * per replica of the model (or a single average), in the byte order of the
+ * machine that wrote it. A matrix factorization ("mf") has one array of
+ * rows + cols vectors of rank dim / (rows + cols), L then R.
+ */
+struct CheckpointHeader {
+  char magic[8]; //!< "HOGCKPT" and a NUL
+  uint32_t version; //!< kCheckpointVersion
+  uint32_t value_size; //!< bytes of a weight, sizeof(double)
+  char model[16]; //!< what the weights are, e.g. "svm"
+  uint64_t replicas; //!< weight vectors in the file
+  uint64_t dim; //!< length of each of them
+  int64_t epoch; //!< epochs trained
+  double step_size; //!< of the next epoch
+  uint32_t seed; //!< state of SimpleRandom::RandInt
+  uint16_t drand[3]; //!< state of SimpleRandom::RandDouble, see seed48(3)
+  uint16_t reserved;
+  uint64_t rows; //!< of a matrix factorization, 0 otherwise
+  uint64_t cols;
+  double mean; //!< added to the predictions of a matrix factorization
+};
+
+/*! \brief Writes checkpoints of a model in the background
+ * Save() copies the weights and returns, a thread then writes them to a
+ * temporary file that is renamed over the checkpoint once synced, so that
+ * a crash leaves the previous checkpoint whole. A failed write is reported
+ * and does not stop the training.
+ */
+class CheckpointWriter {
+ public:
+  explicit CheckpointWriter(std::string const &path) : path_(path),
+      rows_(0), cols_(0), mean_(0), busy_(false), ok_(true) { }
+
+  ~CheckpointWriter() { Wait(); }
+
+  /*! \brief Snapshots the replicas and starts writing them
+   * Waits for the previous checkpoint to be written first.
+   * \param model stored in the header, e.g. "svm"
+   * \param epoch epochs trained so far
+   * \param step_size step size of the next epoch
+   * \param replicas the distinct weight vectors of the model
+   * \param dim length of each replica
+   */
+  void Save(char const *model, int epoch, double step_size,
+            std::vector<double const *> const &replicas, size_t dim) {
+    Wait();
+    memset(&header_, 0, sizeof(header_));
+    memcpy(header_.magic, "HOGCKPT", 8);
+    header_.version = kCheckpointVersion;
+    header_.value_size = sizeof(double);
+    strncpy(header_.model, model, sizeof(header_.model) - 1);
+    header_.replicas = replicas.size();
+    header_.dim = dim;
+    header_.epoch = epoch;
+    header_.step_size = step_size;
+    unsigned seed;
+    unsigned short drand[3];
+    SimpleRandom::GetState(seed, drand);
+    header_.seed = seed;
+    memcpy(header_.drand, drand, sizeof(drand));
+    header_.rows = rows_;
+    header_.cols = cols_;
+    header_.mean = mean_;
+    buf_.resize(replicas.size() * dim);
+    for (size_t r = 0; r < replicas.size(); ++r) {
+      memcpy(&buf_[r * dim], replicas[r], sizeof(double) * dim);
+    }
+    busy_ = true;
+    if (pthread_create(&thread_, NULL, Write, this) != 0) {
+      // write it here then
+      busy_ = false;
+      Write(this);
+    }
+  }
+
+  //! The shape of a matrix factorization, see CheckpointHeader
+  void SetShape(size_t rows, size_t cols, double mean) {
+    rows_ = rows;
+    cols_ = cols;
+    mean_ = mean;
+  }
+
+  //! Waits for the checkpoint being written, false if its write failed
+  bool Wait() {
+    if (busy_) {
+      pthread_join(thread_, NULL);
+      busy_ = false;
+    }
+    return ok_;
+  }
+
+  std::string const & Path() const { return path_; }
+
+ private:
+  CheckpointWriter(CheckpointWriter const &);
+  void operator=(CheckpointWriter const &);
+
+  static void * Write(void *arg) {
+    CheckpointWriter &w = *static_cast<CheckpointWriter*>(arg);
+    std::string tmp = w.path_ + ".tmp";
+    std::vector<char> head(kCheckpointDataOffset, 0);
+    memcpy(&head[0], &w.header_, sizeof(w.header_));
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    w.ok_ = fd >= 0 &&
+            WriteAll(fd, &head[0], head.size()) &&
+            WriteAll(fd, w.buf_.empty() ? NULL : &w.buf_[0],
+                     sizeof(double) * w.buf_.size()) &&
+            fsync(fd) == 0;
+    if (fd >= 0 && close(fd) != 0) {
+      w.ok_ = false;
+    }
+    if (w.ok_ && rename(tmp.c_str(), w.path_.c_str()) != 0) {
+      w.ok_ = false;
+    }
+    if (!w.ok_) {
+      perror(("Cannot write checkpoint " + w.path_).c_str());
+      unlink(tmp.c_str());
+    }
+    return NULL;
+  }
+
+  static bool WriteAll(int fd, void const *data, size_t bytes) {
+    char const *p = static_cast<char const*>(data);
+    while (bytes > 0) {
+      ssize_t n = write(fd, p, bytes);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+      p += n;
+      bytes -= n;
+    }
+    return true;
+  }
+
+  std::string path_;
+  size_t rows_, cols_; //!< see SetShape()
+  double mean_;
+  CheckpointHeader header_; //!< of the checkpoint being written
+  std::vector<double> buf_; //!< its replicas, one after the other
+  pthread_t thread_;
+  bool busy_; //!< thread_ is writing
+  bool ok_; //!< the last write succeeded
+};
+
+/*! \brief A checkpoint of CheckpointWriter, mapped read only
+ * The weights are read from the page cache on demand, a restart or a warm
+ * start copies them without parsing anything.
+ */
+class Checkpoint {
+ public:
+  Checkpoint() : base_(NULL), bytes_(0) { }
+
+  ~Checkpoint() { Close(); }
+
+  /*! \brief Maps the file, prints why and returns false if it is not a
+   * checkpoint of this version
+   */
+  bool Open(std::string const &path) {
+    Close();
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      perror(("Cannot open checkpoint " + path).c_str());
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < kCheckpointDataOffset) {
+      printf("%s is not a checkpoint\n", path.c_str());
+      close(fd);
+      return false;
+    }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+      perror(("Cannot map checkpoint " + path).c_str());
+      return false;
+    }
+    base_ = static_cast<char*>(base);
+    bytes_ = st.st_size;
+    CheckpointHeader const &h = Header();
+    if (memcmp(h.magic, "HOGCKPT", 8) != 0) {
+      printf("%s is not a checkpoint\n", path.c_str());
+    } else if (h.version != kCheckpointVersion || h.value_size != sizeof(double)) {
+      printf("%s is a checkpoint of version %u with %u byte weights, expected "
+             "version %u with %lu\n", path.c_str(), h.version, h.value_size,
+             kCheckpointVersion, sizeof(double));
+    } else if (!FitsReplicas(h)) {
+      printf("%s is truncated\n", path.c_str());
+    } else {
+      madvise(base_, bytes_, MADV_SEQUENTIAL);
+      return true;
+    }
+    Close();
+    return false;
+  }
+
+  void Close() {
+    if (base_ != NULL) {
+      munmap(base_, bytes_);
+    }
+    base_ = NULL;
+    bytes_ = 0;
+  }
+
+  CheckpointHeader const & Header() const {
+    return *reinterpret_cast<CheckpointHeader const*>(base_);
+  }
+
+  size_t Replicas() const { return Header().replicas; }
+  size_t Dim() const { return Header().dim; }
+  int Epoch() const { return Header().epoch; }
+  double StepSize() const { return Header().step_size; }
+
+  //! The weights of replica r, Dim() of them
+  double const * Replica(size_t r) const {
+    return reinterpret_cast<double const*>(base_ + kCheckpointDataOffset) +
+           r * Dim();
+  }
+
+  /*! \brief Initializes a replica of a model of nreplicas from this one
+   * The same replica when there are as many, otherwise their average.
+   * \param out Dim() weights
+   */
+  template <class T>
+  void Restore(size_t replica, size_t nreplicas, T *out) const {
+    size_t const n = Replicas();
+    size_t const dim = Dim();
+    if (n == nreplicas) {
+      double const *w = Replica(replica);
+      for (size_t i = 0; i < dim; ++i) {
+        out[i] = w[i];
+      }
+      return;
+    }
+    for (size_t i = 0; i < dim; ++i) {
+      double sum = 0;
+      for (size_t r = 0; r < n; ++r) {
+        sum += Replica(r)[i];
+      }
+      out[i] = n > 0 ? sum / n : 0;
+    }
+  }
+
+  //! Resumes SimpleRandom where the checkpoint left it
+  void RestoreRandom() const {
+    unsigned short drand[3];
+    memcpy(drand, Header().drand, sizeof(drand));
+    SimpleRandom::SetState(Header().seed, drand);
+  }
+
+ private:
+  Checkpoint(Checkpoint const &);
+  void operator=(Checkpoint const &);
+
+  //! The file holds h.replicas of h.dim weights, without overflowing
+  bool FitsReplicas(CheckpointHeader const &h) const {
+    size_t const values = (bytes_ - kCheckpointDataOffset) / sizeof(double);
+    return h.dim != 0 && h.dim <= values && h.replicas <= values / h.dim;
+  }
+
+  char *base_;
+  size_t bytes_;
+};
+
+} // namespace util
+} // namespace hazy
+#endif
@@ -0,0 +1,156 @@
+// Copyright 2012 Victor Bittorf, Chris Re
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Hazy Template Library
+
+
+#ifndef HAZY_UTIL_METRICS_H
+#define HAZY_UTIL_METRICS_H
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace hazy {
+namespace util {
+
+/*! \brief One JSON object of a MetricsSink, built field by field
+ * Fields keep the order they are added in, non finite numbers are null.
+ */
+class MetricsRecord {
+ public:
+  MetricsRecord() { }
+
+  //! A record with "type" as its first field
+  explicit MetricsRecord(char const *type) { Add("type", type); }
+
+  void Add(char const *key, double v) {
+    Key(key);
+    if (std::isfinite(v)) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "%.9g", v);
+      body_ += buf;
+    } else {
+      body_ += "null";
+    }
+  }
+
+  void Add(char const *key, long long v) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld", v);
+    Key(key);
+    body_ += buf;
+  }
+
+  void Add(char const *key, int v) { Add(key, (long long) v); }
+  void Add(char const *key, unsigned v) { Add(key, (long long) v); }
+  void Add(char const *key, unsigned long v) { Add(key, (long long) v); }
+  void Add(char const *key, unsigned long long v) { Add(key, (long long) v); }
+
+  void Add(char const *key, char const *v) {
+    Key(key);
+    Quote(v);
+  }
+
+  void Add(char const *key, std::string const &v) { Add(key, v.c_str()); }
+
+  //! An array of objects, e.g. one per thread
+  void Add(char const *key, std::vector<MetricsRecord> const &v) {
+    Key(key);
+    body_ += '[';
+    for (size_t i = 0; i < v.size(); ++i) {
+      if (i > 0) {
+        body_ += ',';
+      }
+      body_ += v[i].Json();
+    }
+    body_ += ']';
+  }
+
+  //! The object, without a newline
+  std::string Json() const { return "{" + body_ + "}"; }
+
+  bool Empty() const { return body_.empty(); }
+
+ private:
+  void Key(char const *key) {
+    if (!body_.empty()) {
+      body_ += ',';
+    }
+    Quote(key);
+    body_ += ':';
+  }
+
+  void Quote(char const *s) {
+    body_ += '"';
+    for (; *s != '\0'; ++s) {
+      if (*s == '"' || *s == '\\') {
+        body_ += '\\';
+        body_ += *s;
+      } else if ((unsigned char) *s < 0x20) {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\u%04x", *s);
+        body_ += buf;
+      } else {
+        body_ += *s;
+      }
+    }
+    body_ += '"';
+  }
+
+  std::string body_; //!< the fields, without the braces
+};
+
+/*! \brief Writes MetricsRecord as JSON lines
+ * One object per line, flushed right away so that a run can be followed
+ * (or survive a crash) while it trains.
+ */
+class MetricsSink {
+ public:
+  /*! \brief Opens the output, exits if it cannot be opened
+   * \param path a file, truncated, or - for stdout
+   */
+  explicit MetricsSink(std::string const &path) : file_(stdout) {
+    if (path != "-") {
+      file_ = fopen(path.c_str(), "w");
+      if (file_ == NULL) {
+        perror(("Cannot open metrics file " + path).c_str());
+        exit(-1);
+      }
+    }
+  }
+
+  ~MetricsSink() {
+    if (file_ != stdout) {
+      fclose(file_);
+    }
+  }
+
+  void Write(MetricsRecord const &rec) {
+    fprintf(file_, "%s\n", rec.Json().c_str());
+    fflush(file_);
+  }
+
+ private:
+  MetricsSink(MetricsSink const &);
+  void operator=(MetricsSink const &);
+
+  FILE *file_;
+};
+
+} // namespace util
+} // namespace hazy
+#endif
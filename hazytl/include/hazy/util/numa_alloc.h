@@ -0,0 +1,179 @@
+// Copyright 2012 Victor Bittorf, Chris Re
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Hazy Template Library
+
+
+#ifndef HAZY_UTIL_NUMA_ALLOC_H
+#define HAZY_UTIL_NUMA_ALLOC_H
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <numa.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "hazy/thread/thread_pool.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+namespace hazy {
+namespace util {
+
+//! Pages backing a NumaAlloc() buffer
+enum HugePages {
+  kHugePagesNone, //!< regular pages
+  kHugePagesTHP, //!< transparent huge pages, see madvise(MADV_HUGEPAGE)
+  kHugePages2M, //!< 2MB pages reserved in /proc/sys/vm/nr_hugepages
+  kHugePages1G //!< 1GB pages reserved at boot
+};
+
+/*! \brief Parses the name of a HugePages policy
+ * \return the policy for none, thp, 2m or 1g, -1 if unknown
+ */
+int ParseHugePages(std::string const &name) {
+  if (name == "none")
+    return kHugePagesNone;
+  if (name == "thp")
+    return kHugePagesTHP;
+  if (name == "2m")
+    return kHugePages2M;
+  if (name == "1g")
+    return kHugePages1G;
+  return -1;
+}
+
+//! Length of the mapping of a NumaAlloc() buffer
+size_t NumaAllocLength(size_t bytes, int huge_pages) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  if (huge_pages == kHugePages2M)
+    page = 2UL << 20;
+  else if (huge_pages == kHugePages1G)
+    page = 1UL << 30;
+  if (bytes == 0)
+    bytes = 1;
+  return (bytes + page - 1) / page * page;
+}
+
+/*! \brief Allocates zeroed memory bound to a node, with mmap and mbind
+ * Unlike numa_set_preferred() the binding holds whichever thread touches
+ * the pages first, and no page is touched here (see FirstTouch). When not
+ * enough explicit huge pages are reserved, transparent huge pages are used.
+ * Exits if out of memory.
+ * \param bytes size of the buffer
+ * \param node the node of the pages, -1 to follow the policy of the thread
+ *  touching them first
+ * \param huge_pages one of HugePages
+ * \return the buffer, free with NumaFree() and the same bytes and huge_pages
+ */
+void* NumaAlloc(size_t bytes, int node, int huge_pages) {
+  // the fallback keeps the same length, so that NumaFree() unmaps all of it
+  size_t length = NumaAllocLength(bytes, huge_pages);
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  void *buf = MAP_FAILED;
+  if (huge_pages == kHugePages2M || huge_pages == kHugePages1G) {
+    int size_flag = huge_pages == kHugePages1G ? MAP_HUGE_1GB : MAP_HUGE_2MB;
+    buf = mmap(NULL, length, PROT_READ | PROT_WRITE,
+               flags | MAP_HUGETLB | size_flag, -1, 0);
+    if (buf == MAP_FAILED) {
+      static bool warned = false;
+      if (!warned) {
+        perror("Not enough huge pages reserved, using transparent huge pages");
+        warned = true;
+      }
+      huge_pages = kHugePagesTHP;
+    }
+  }
+  if (buf == MAP_FAILED) {
+    buf = mmap(NULL, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (buf == MAP_FAILED) {
+      perror("mmap failed");
+      exit(-1);
+    }
+  }
+  if (huge_pages == kHugePagesTHP) {
+    madvise(buf, length, MADV_HUGEPAGE);
+  }
+  if (node >= 0) {
+    numa_tonode_memory(buf, length, node);
+  }
+  return buf;
+}
+
+//! Frees a buffer of NumaAlloc()
+void NumaFree(void *buf, size_t bytes, int huge_pages) {
+  if (buf != NULL) {
+    munmap(buf, NumaAllocLength(bytes, huge_pages));
+  }
+}
+
+/*! \brief Faults in the pages of buffers on the threads of a pool.
+ * Every thread zeroes its share of every buffer, so that the pages of a
+ * large model are faulted in (and placed on the node of the threads when
+ * they are not bound) in parallel, instead of by one thread or during the
+ * first epoch. Several FirstTouch can run at once on disjoint views.
+ */
+class FirstTouch {
+ public:
+  FirstTouch() : tpool_(NULL) { }
+
+  //! Adds a buffer to touch, call before Start()
+  void Add(void *buf, size_t bytes) {
+    buffers_.push_back(std::make_pair(static_cast<char*>(buf), bytes));
+  }
+
+  //! Starts touching the buffers on the threads of tpool
+  void Start(thread::ThreadPool &tpool) {
+    tpool_ = &tpool;
+    tpool.Execute(*this, Touch);
+  }
+
+  //! Waits for Start() to finish
+  void Wait() {
+    tpool_->Wait();
+  }
+
+ private:
+  static void Touch(FirstTouch &t, unsigned tid, unsigned total) {
+    size_t const page = sysconf(_SC_PAGESIZE);
+    for (size_t b = 0; b < t.buffers_.size(); ++b) {
+      size_t pages = (t.buffers_[b].second + page - 1) / page;
+      size_t start = pages * tid / total * page;
+      size_t end = std::min(pages * (tid + 1) / total * page, t.buffers_[b].second);
+      if (start < end) {
+        memset(t.buffers_[b].first + start, 0, end - start);
+      }
+    }
+  }
+
+  std::vector<std::pair<char*, size_t> > buffers_;
+  thread::ThreadPool *tpool_;
+};
+
+} // namespace util
+} // namespace hazy
+#endif
@@ -0,0 +1,226 @@
+// Copyright 2012 Victor Bittorf, Chris Re
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Hazy Template Library
+
+
+#ifndef HAZY_UTIL_PERF_COUNTERS_H
+#define HAZY_UTIL_PERF_COUNTERS_H
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "hazy/thread/thread_pool.h"
+
+namespace hazy {
+namespace util {
+
+//! The events counted by PerfCounters
+enum PerfEvent {
+  kPerfCycles,
+  kPerfInstructions,
+  kPerfLLCMisses, //!< last level cache misses
+  kPerfRemoteDRAM, //!< reads missing the local node (NODE cache event)
+  kPerfStalledCycles, //!< cycles stalled in the back-end
+  kPerfPageFaults,
+  kPerfContextSwitches,
+  kPerfEventCount
+};
+
+/*! \brief Performance counters of each thread of a pool.
+ * Every thread opens its own counters with perf_event_open(2), the caller
+ * reads them from any thread around a job with Start() and Stop(). Events
+ * the machine or the kernel does not provide (in a VM, or with a high
+ * /proc/sys/kernel/perf_event_paranoid) are reported as n/a, the others
+ * still count. Multiplexed counters are scaled to the time they ran.
+ */
+class PerfCounters {
+ public:
+  /*! \brief Opens the counters on every thread of the pool
+   * \param tpool an initialized pool, counters follow its threads
+   */
+  explicit PerfCounters(thread::ThreadPool &tpool) : tpool_(tpool),
+      nthreads_(tpool.ThreadCount()),
+      fds_(nthreads_ * kPerfEventCount, -1),
+      start_(nthreads_ * kPerfEventCount, 0),
+      delta_(nthreads_ * kPerfEventCount, 0),
+      errors_(kPerfEventCount, 0) {
+    tpool.Execute(*this, Open);
+    tpool.Wait();
+    for (int ev = 0; ev < kPerfEventCount; ++ev) {
+      if (!Available(ev)) {
+        printf("perf: %s unavailable (%s)\n", Name(ev), strerror(errors_[ev]));
+      }
+    }
+  }
+
+  ~PerfCounters() {
+    for (size_t i = 0; i < fds_.size(); ++i) {
+      if (fds_[i] >= 0) {
+        close(fds_[i]);
+      }
+    }
+  }
+
+  //! Remembers the current counts, call before the measured job
+  void Start() {
+    for (size_t i = 0; i < fds_.size(); ++i) {
+      start_[i] = Read(fds_[i]);
+    }
+  }
+
+  //! Computes the counts since Start(), call after the measured job
+  void Stop() {
+    for (size_t i = 0; i < fds_.size(); ++i) {
+      delta_[i] = Read(fds_[i]) - start_[i];
+    }
+  }
+
+  //! True if the event could be opened on every thread
+  bool Available(int event) const {
+    for (unsigned t = 0; t < nthreads_; ++t) {
+      if (fds_[t * kPerfEventCount + event] < 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  //! Count of the event on thread tid between Start() and Stop()
+  long long Delta(unsigned tid, int event) const {
+    return delta_[tid * kPerfEventCount + event];
+  }
+
+  //! Name of the event in the output of Print()
+  static char const * Name(int event) {
+    static char const * const names[kPerfEventCount] = {
+      "cycles", "instructions", "llc_misses", "remote_dram",
+      "stalled_cycles", "page_faults", "context_switches"
+    };
+    return names[event];
+  }
+
+  /*! \brief Prints the counts of the last Start() and Stop()
+   * One "perf:" line per thread and one for the total of the threads.
+   * \param epoch the epoch number printed on each line
+   */
+  void Print(int epoch) const {
+    std::vector<long long> total(kPerfEventCount, 0);
+    for (unsigned t = 0; t < nthreads_; ++t) {
+      printf("perf: epoch: %d thread: %u cpu: %d", epoch, t,
+             tpool_.GetThreadCoreAffinity(t));
+      PrintCounts(&delta_[t * kPerfEventCount]);
+      for (int ev = 0; ev < kPerfEventCount; ++ev) {
+        total[ev] += Delta(t, ev);
+      }
+    }
+    printf("perf: epoch: %d total", epoch);
+    PrintCounts(&total[0]);
+    fflush(stdout);
+  }
+
+ private:
+  static void Open(PerfCounters &pc, unsigned tid, unsigned /* total */) {
+    for (int ev = 0; ev < kPerfEventCount; ++ev) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                         PERF_FORMAT_TOTAL_TIME_RUNNING;
+      Config(ev, attr);
+      // this thread, on whichever CPU it runs
+      int fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+      if (fd < 0) {
+        pc.errors_[ev] = errno;
+      }
+      pc.fds_[tid * kPerfEventCount + ev] = fd;
+    }
+  }
+
+  static void Config(int event, struct perf_event_attr &attr) {
+    attr.type = PERF_TYPE_HARDWARE;
+    switch (event) {
+      case kPerfCycles:
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+      case kPerfInstructions:
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+      case kPerfLLCMisses:
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+      case kPerfRemoteDRAM:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_NODE |
+                      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+      case kPerfStalledCycles:
+        attr.config = PERF_COUNT_HW_STALLED_CYCLES_BACKEND;
+        break;
+      case kPerfPageFaults:
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+        break;
+      case kPerfContextSwitches:
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+        break;
+    }
+  }
+
+  //! The count scaled to the time the counter was enabled, 0 if not open
+  static long long Read(int fd) {
+    if (fd < 0) {
+      return 0;
+    }
+    unsigned long long v[3]; // value, time enabled, time running
+    if (read(fd, v, sizeof(v)) != sizeof(v) || v[2] == 0) {
+      return 0;
+    }
+    return v[2] < v[1] ? (long long) ((double) v[0] * v[1] / v[2]) : v[0];
+  }
+
+  void PrintCounts(long long const *counts) const {
+    for (int ev = 0; ev < kPerfEventCount; ++ev) {
+      if (Available(ev)) {
+        printf(" %s: %lld", Name(ev), counts[ev]);
+      } else {
+        printf(" %s: n/a", Name(ev));
+      }
+    }
+    if (Available(kPerfCycles) && Available(kPerfInstructions)) {
+      printf(" ipc: %.3f", counts[kPerfCycles] > 0 ?
+             (double) counts[kPerfInstructions] / counts[kPerfCycles] : 0.0);
+    }
+    putchar('\n');
+  }
+
+  thread::ThreadPool &tpool_;
+  unsigned nthreads_;
+  std::vector<int> fds_; //!< kPerfEventCount per thread, -1 if not open
+  std::vector<long long> start_; //!< counts at Start()
+  std::vector<long long> delta_; //!< counts between Start() and Stop()
+  std::vector<int> errors_; //!< errno of the failed opens of each event
+};
+
+} // namespace util
+} // namespace hazy
+#endif
@@ -23,6 +23,7 @@
 #include <sys/types.h>
 #include <sys/ipc.h> 
 #include <sys/shm.h>
+#include <cstdio>
 
 namespace hazy {
 namespace util {
@@ -109,6 +110,48 @@ bool DetachSharedSegment(char* shmaddr) {
   return true;
 }
 
+/*! \brief Creates a segment only reachable through its id, and attaches it
+ * The segment is zero filled and already marked for removal: it is destroyed
+ * once the last process detaches from it, even if a process crashes. Children
+ * forked afterwards inherit the attachment; other processes attach it by id
+ * with AttachSegmentById(), which Linux allows until the last detach.
+ * \param size the size in bytes of the segment
+ * \param shmid set to the id of the segment
+ * \return the pointer to the memory block or NULL if it failed.
+ */
+char* CreatePrivateSegment(size_t size, int *shmid) {
+  *shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+  if (*shmid < 0) {
+    perror("shmget failed");
+    return NULL;
+  }
+  char* shmaddr = static_cast<char*>(shmat(*shmid, NULL, 0));
+  if (shmaddr == (char *)-1) {
+    perror("shmat failed");
+    shmctl(*shmid, IPC_RMID, NULL);
+    return NULL;
+  }
+  if (shmctl(*shmid, IPC_RMID, NULL) < 0) {
+    perror("shmctl failed");
+    shmdt(shmaddr);
+    return NULL;
+  }
+  return shmaddr;
+}
+
+/*! \brief Attaches the segment of a CreatePrivateSegment(...) by its id
+ * \param shmid the id of the segment
+ * \return the pointer to the memory block or NULL if it failed.
+ */
+char* AttachSegmentById(int shmid) {
+  char* shmaddr = static_cast<char*>(shmat(shmid, NULL, 0));
+  if (shmaddr == (char *)-1) {
+    perror("shmat failed");
+    return NULL;
+  }
+  return shmaddr;
+}
+
 } //namespace util
 } //namespace hazy
 #endif
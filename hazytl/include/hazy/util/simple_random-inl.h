@@ -37,10 +37,47 @@ void SimpleRandom::SetSeed(unsigned int seed) {
   srand48(seed_);
 }
 
+unsigned int SimpleRandom::StreamSeed(unsigned int seed, unsigned int stream) {
+  // the finalizer of MurmurHash3 on both, 0 is never returned
+  unsigned int h = seed ^ (stream * 0x9e3779b9u + 0x7f4a7c15u);
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h != 0 ? h : 1;
+}
+
+void SimpleRandom::GetState(unsigned int &seed, unsigned short drand[3]) {
+  seed = seed_;
+  // seed48 returns the previous state, put it back
+  unsigned short tmp[3] = {0, 0, 0};
+  memcpy(drand, seed48(tmp), sizeof(tmp));
+  seed48(drand);
+}
+
+void SimpleRandom::SetState(unsigned int seed, unsigned short const drand[3]) {
+  seed_ = seed;
+  unsigned short tmp[3];
+  memcpy(tmp, drand, sizeof(tmp));
+  seed48(tmp);
+}
+
 unsigned int SimpleRandom::RandInt(unsigned int nMax) {
   return (unsigned int) (((double) nMax) * (rand_r(&seed_) / (RAND_MAX + 1.0)));
 }
 
+unsigned int SimpleRandom::RandInt(unsigned int &state, unsigned int nMax) {
+  return (unsigned int) (((double) nMax) * (rand_r(&state) / (RAND_MAX + 1.0)));
+}
+
+double SimpleRandom::RandDouble(unsigned int &state) {
+  // two draws of 31 bits, as one has fewer bits than a double
+  double hi = rand_r(&state) / (RAND_MAX + 1.0);
+  double lo = rand_r(&state) / (RAND_MAX + 1.0);
+  return hi + lo / (RAND_MAX + 1.0);
+}
+
 double SimpleRandom::RandDouble() { return drand48(); } 
 
 SimpleRandom& SimpleRandom::GetInstance() {
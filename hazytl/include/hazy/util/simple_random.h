@@ -40,6 +40,32 @@ class SimpleRandom {
   /*! \brief Uses the current time as the argument to SetSeed(...) */
   static void SeedByTime();
 
+  /*! \brief The seed of the last SetSeed(...), advanced by RandInt() */
+  static unsigned int Seed() { return seed_; }
+
+  /*! \brief A seed of its own for stream (e.g. a run or a thread) of seed
+   * The streams of a seed are distinct and the same on every run, so that
+   * they can be drawn from concurrently and reproduced.
+   */
+  static unsigned int StreamSeed(unsigned int seed, unsigned int stream);
+
+  /*! \brief RandInt() on a state of the caller, e.g. of StreamSeed(...)
+   * Unlike the singleton, the state is not shared with other threads.
+   */
+  inline static unsigned RandInt(unsigned int &state, unsigned int nMax);
+
+  /*! \brief A double in [0.0, 1.0) drawn with a state of the caller */
+  inline static double RandDouble(unsigned int &state);
+
+  /*! \brief Reads the state of RandInt() and RandDouble(), e.g. to checkpoint
+   * \param seed the state of RandInt()
+   * \param drand the state of RandDouble(), see seed48(3)
+   */
+  static void GetState(unsigned int &seed, unsigned short drand[3]);
+
+  /*! \brief Resumes the generators from a state of GetState() */
+  static void SetState(unsigned int seed, unsigned short const drand[3]);
+
   /*! \brief Gets the singleton RNG */
   inline static SimpleRandom& GetInstance();
   
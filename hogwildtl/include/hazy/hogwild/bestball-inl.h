@@ -16,12 +16,8 @@
 #ifndef HAZY_HOGWILD_BESTBALL_INL_H
 #define HAZY_HOGWILD_BESTBALL_INL_H
 
-#ifdef __APPLE__
-#define isnan std::isnan
-#endif
-
-
 #include <cmath>
+#include <vector>
 
 #include "hazy/vector/fvector.h"
 #include "hazy/vector/operations-inl.h"
@@ -72,13 +68,16 @@ class BestBall {
     Hogwild_t** hogwilds;
     thread::ThreadPool **tpools;
 
-    BBParams(BBModel &models, vector::FVector<Params*> &ps, unsigned threads) 
+    /*! Ball i trains on the threads [i * threads, (i + 1) * threads) of the
+     * shared pool, these wrap around when the pool is smaller.
+     */
+    BBParams(BBModel &models, vector::FVector<Params*> &ps, unsigned threads,
+             thread::ThreadPool &shared) 
           : params(ps) {
       tpools = new thread::ThreadPool*[ps.size];
       hogwilds = new Hogwild_t*[ps.size];
       for (unsigned i = 0; i < ps.size; i++) {
-        tpools[i] = new thread::ThreadPool(threads);
-        tpools[i]->Init();
+        tpools[i] = new thread::ThreadPool(shared, i * threads, threads);
         hogwilds[i] = new Hogwild_t(*models.models.values[i], *ps.values[i],
                                     *tpools[i]);
       }
@@ -105,10 +104,16 @@ class BestBall {
   }
 
   BestBall(Model &model, vector::FVector<Params*> &ps, unsigned threads) {
-    tpool_ = new thread::ThreadPool(ps.size);
-    tpool_->Init();
+    thread::ThreadPool &shared = thread::ThreadPool::Shared(ps.size * threads);
+    // ball i is driven by the first thread of its own view, which then runs
+    // its share of the ball itself
+    std::vector<unsigned> drivers(ps.size);
+    for (unsigned i = 0; i < ps.size; i++) {
+      drivers[i] = i * threads;
+    }
+    tpool_ = new thread::ThreadPool(shared, drivers);
     models_ = new BBModel(model, ps.size);
-    params_ = new BBParams(*models_, ps, threads);
+    params_ = new BBParams(*models_, ps, threads, shared);
     res_.size = ps.size;
     res_.values = new double[res_.size];
     train_.size = ps.size;
@@ -209,16 +214,16 @@ class BestBall {
       res_.values[i] = (2 * train_.values[i] * test_.values[i]) /
           (train_.values[i] + test_.values[i]);
       printf("Ball #%u harmonic mean of RMSEs = %lf\n", i, res_.values[i]);
-      if (! isnan(res_.values[i])) {
+      if (! std::isnan(res_.values[i])) {
         lowest = i;
       }
     }
-    if (isnan(res_.values[lowest])) {
+    if (std::isnan(res_.values[lowest])) {
       printf("All models diverged!!\n");
       assert(false);
     }
     for (unsigned i = 0; i < res_.size; i++) {
-      if (isnan(res_.values[lowest])) {
+      if (std::isnan(res_.values[lowest])) {
         continue;
       }
       if (res_.values[lowest] > res_.values[i]) {
@@ -50,12 +50,22 @@ class FileScan {
   /*! \brief Initialize this file scanner. Call exactly once before use.
    */
   void Init() {
+    // the loader has its own thread, on a CPU the application pool leaves
+    // when there is one, so that it runs while the pool is training
+    hazy::thread::ThreadPool *shared = hazy::thread::ThreadPool::SharedIfAny();
+    if (shared != NULL) {
+      std::vector<int> spare = shared->UnusedCPUs();
+      if (!spare.empty()) {
+        tpool_.SetCPUList(spare);
+      }
+    }
+    tpool_.SetUnshared();
     tpool_.Init();
-    size_t bufsize = (max_mem_ / (2 * (sizeof(Example) + sizeof(size_t))) + 1);
+    size_t bufsize = (max_mem_ / (2 * (sizeof(Example) + sizeof(perm_type))) + 1);
     blk_.ex.values = new Example[bufsize];
-    blk_.perm.values = new size_t[bufsize];
+    blk_.perm.values = new perm_type[bufsize];
     shadow_blk_.ex.values = new Example[bufsize];
-    shadow_blk_.perm.values = new size_t[bufsize];
+    shadow_blk_.perm.values = new perm_type[bufsize];
     task_.max_size = bufsize;
     task_.scan = &scan_;
 
@@ -142,6 +152,7 @@ class FileScan {
   ExampleBlock<Example> shadow_blk_;
   bool has_next_;
   ShadowTask task_;
+  //! loads the shadow buffer, see Init()
   hazy::thread::ThreadPool tpool_;
   size_t pageno_;
   size_t max_mem_;
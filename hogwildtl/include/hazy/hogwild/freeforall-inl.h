@@ -17,6 +17,10 @@
 #ifndef HAZY_HOGWILD_FREEFORALL_INL_H
 #define HAZY_HOGWILD_FREEFORALL_INL_H
 
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+
 #include "hazy/hogwild/tools-inl.h"
 #include "hazy/hogwild/hogwild_task.h"
 
@@ -46,19 +50,19 @@ class ForEachDeleg {
  public:
  struct Pack {
     Pack(Model &mm, Params &pp, vector::FVector<Ex> v,
-         vector::FVector<size_t> per) 
+         vector::FVector<perm_type> per) 
         : model(mm), params(pp), examps(v), perm(per) { }
     Model &model;
     Params &params;
     vector::FVector<Ex> examps;
-    vector::FVector<size_t> perm;
+    vector::FVector<perm_type> perm;
   };
 
   static void ForEachHook(Pack &pack, unsigned tid, unsigned tot) {
     size_t start = GetStartIndex(pack.examps.size, tid, tot);
     size_t end = GetEndIndex(pack.examps.size, tid, tot);
 
-    size_t *perm = pack.perm.values;
+    perm_type *perm = pack.perm.values;
     const Ex *examps = pack.examps.values;
     const Params &params = pack.params;
     Model &model = pack.model;
@@ -83,12 +87,12 @@ class AggDelegate {
  public:
  struct Pack {
     Pack(Model &mm, Params &pp, vector::FVector<Ex> v,
-         vector::FVector<size_t> per) 
+         vector::FVector<perm_type> per) 
         : model(mm), params(pp), examps(v), perm(per) { }
     Model &model;
     Params &params;
     vector::FVector<Ex> examps;
-    vector::FVector<size_t> perm;
+    vector::FVector<perm_type> perm;
     
     Aggregate_t *results;
   };
@@ -97,7 +101,7 @@ class AggDelegate {
     size_t start = GetStartIndex(pack.examps.size, tid, tot);
     size_t end = GetEndIndex(pack.examps.size, tid, tot);
 
-    size_t *perm = pack.perm.values;
+    perm_type *perm = pack.perm.values;
     const Ex *examps = pack.examps.values;
     const Params &params = pack.params;
     Model &model = pack.model;
@@ -168,6 +172,165 @@ class AggDelegate {
 };
 
 
+/*! \brief Hands out the examples of a block to the threads in chunks.
+ * Every thread starts with the range the static split (GetStartIndex,
+ * GetEndIndex) gives it and claims chunks from its front. A thread that runs
+ * out steals the back half of another thread's range, trying the threads of
+ * its own node first. A slow thread (a hyperthread sibling, a token holder
+ * busy syncing, a slower core) then no longer decides when the block is done.
+ *
+ * Each range is a single word, begin and end, that the owner and the thieves
+ * update with CAS. The begin of a range only grows until it is consumed, so a
+ * stale CAS can never succeed.
+ */
+class ChunkScheduler {
+ public:
+  //! Chunks per thread in the static split, more balance but more CAS
+  static const size_t kChunksPerThread = 16;
+
+  ChunkScheduler() : nthreads_(0), chunk_(1), ranges_(NULL), victims_(NULL) { }
+
+  ~ChunkScheduler() {
+    delete [] ranges_;
+    delete [] victims_;
+  }
+
+  /*! \brief Orders the victims of each thread: same node first, then by id
+   * \param tpool the pool that runs the tasks
+   */
+  void Init(thread::ThreadPool &tpool) {
+    nthreads_ = tpool.ThreadCount();
+    delete [] ranges_;
+    delete [] victims_;
+    ranges_ = new Range[nthreads_];
+    victims_ = new unsigned[nthreads_ * nthreads_];
+    for (unsigned t = 0; t < nthreads_; ++t) {
+      unsigned *v = victims_ + t * nthreads_;
+      unsigned n = 0;
+      int node = tpool.GetThreadNodeAffinity(t);
+      for (unsigned pass = 0; pass < 2; ++pass) {
+        for (unsigned k = 1; k < nthreads_; ++k) {
+          unsigned u = (t + k) % nthreads_;
+          bool local = tpool.GetThreadNodeAffinity(u) == node;
+          if (local == (pass == 0)) {
+            v[n++] = u;
+          }
+        }
+      }
+    }
+  }
+
+  /*! \brief Splits [0, size) statically among the threads, call before each
+   * Execute() on a new block
+   */
+  void Reset(size_t size) {
+    assert(size <= 0xffffffffUL);
+    chunk_ = std::max(size / (nthreads_ * kChunksPerThread), (size_t) 1);
+    for (unsigned t = 0; t < nthreads_; ++t) {
+      ranges_[t].word = Pack(GetStartIndex(size, t, nthreads_),
+                             GetEndIndex(size, t, nthreads_));
+    }
+  }
+
+  /*! \brief Claims the next chunk of thread tid
+   * \return false when the block is done
+   */
+  bool Next(unsigned tid, size_t &start, size_t &end) {
+    while (!Claim(tid, start, end)) {
+      if (!Steal(tid)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  struct __attribute__((aligned(64))) Range {
+    volatile uint64_t word; //!< begin in the high half, end in the low half
+  };
+
+  static uint64_t Pack(size_t begin, size_t end) {
+    return ((uint64_t) begin << 32) | end;
+  }
+  static size_t Begin(uint64_t w) { return w >> 32; }
+  static size_t End(uint64_t w) { return w & 0xffffffffUL; }
+
+  //! Takes a chunk from the front of the own range
+  bool Claim(unsigned tid, size_t &start, size_t &end) {
+    Range &r = ranges_[tid];
+    while (true) {
+      uint64_t w = r.word;
+      size_t b = Begin(w), e = End(w);
+      if (b >= e) {
+        return false;
+      }
+      size_t nb = std::min(b + chunk_, e);
+      if (__sync_bool_compare_and_swap(&r.word, w, Pack(nb, e))) {
+        start = b;
+        end = nb;
+        return true;
+      }
+    }
+  }
+
+  //! Moves the back half of a victim's range into the own, empty, range
+  bool Steal(unsigned tid) {
+    unsigned const *v = victims_ + tid * nthreads_;
+    for (unsigned k = 0; k + 1 < nthreads_; ++k) {
+      Range &r = ranges_[v[k]];
+      while (true) {
+        uint64_t w = r.word;
+        size_t b = Begin(w), e = End(w);
+        if (b >= e) {
+          break;
+        }
+        size_t mid = e - (e - b + 1) / 2;
+        if (__sync_bool_compare_and_swap(&r.word, w, Pack(b, mid))) {
+          // thieves skip empty ranges, so nobody else writes ours now
+          ranges_[tid].word = Pack(mid, e);
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  unsigned nthreads_;
+  size_t chunk_;
+  Range *ranges_;
+  unsigned *victims_; //!< nthreads - 1 victims per thread, in steal order
+};
+
+/*! \brief Iterates over the example ranges of one thread: the chunks of
+ * the task's scheduler, or the static split when the task has none.
+ */
+class ExampleRanges {
+ public:
+  ExampleRanges(ChunkScheduler *sched, size_t size, unsigned tid,
+                unsigned total) :
+      sched_(sched), size_(size), tid_(tid), total_(total), done_(false) { }
+
+  bool Next(size_t &start, size_t &end) {
+    if (sched_ != NULL) {
+      return sched_->Next(tid_, start, end);
+    }
+    if (done_) {
+      return false;
+    }
+    start = GetStartIndex(size_, tid_, total_);
+    end = GetEndIndex(size_, tid_, total_);
+    done_ = true;
+    return true;
+  }
+
+ private:
+  ChunkScheduler *sched_;
+  size_t size_;
+  unsigned tid_;
+  unsigned total_;
+  bool done_;
+};
+
 template <class HogwildTask_t>
 struct FFATask {
   HogwildTask_t *task;
@@ -212,11 +375,15 @@ size_t FFAScan(Model &m, Params &p, Scan &scan,
   HogwildTask<Model, Params, Example> task;
   task.model = &m;
   task.params = &p;
+  ChunkScheduler sched;
+  sched.Init(tpool);
+  task.sched = &sched;
 
   while (scan.HasNext()) {
     ExampleBlock<Example> &ex = scan.Next();
     task.block = &ex;
     count += ex.ex.size;
+    sched.Reset(ex.ex.size);
 
     train_time.Start();
     epoch_time.Start();
@@ -238,11 +405,15 @@ size_t FFAScan(Model &m, Params &p, Scan &scan,
   HogwildTask<Model, Params, Example> task;
   task.model = &m;
   task.params = &p;
+  ChunkScheduler sched;
+  sched.Init(tpool);
+  task.sched = &sched;
 
   while (scan.HasNext()) {
     ExampleBlock<Example> &ex = scan.Next();
     task.block = &ex;
     count += ex.ex.size;
+    sched.Reset(ex.ex.size);
 
     FreeForAll(task, tpool, hook, result);
   }
@@ -18,6 +18,7 @@
 
 #include "hazy/vector/fvector.h"
 #include "hazy/thread/thread_pool-inl.h"
+#include "hazy/util/clock.h"
 
 #include "hazy/hogwild/hogwild_task.h"
 
@@ -16,10 +16,16 @@
 #ifndef HAZY_HOGWILD_HOGWILD_INL_H
 #define HAZY_HOGWILD_HOGWILD_INL_H
 
+#include <numa.h>
+#include <sched.h>
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
+#include <utility>
+#include <vector>
 
 #include "hazy/util/clock.h"
+#include "hazy/util/simple_random-inl.h"
 #include "hazy/hogwild/freeforall-inl.h"
 
 // See for documentation
@@ -35,7 +41,14 @@ double Hogwild<Model, Params, Exec>::UpdateModel(Scan &scan) {
   Zero();
   // train_time_.Start();
   // epoch_time_.Start();
-  FFAScan(model_, params_, scan, tpool_, Exec::UpdateModel, res_, train_time_, epoch_time_);
+  if (perf_ != NULL) {
+    perf_->Start();
+  }
+  epoch_examples_ = FFAScan(model_, params_, scan, tpool_, Exec::UpdateModel,
+                            res_, train_time_, epoch_time_);
+  if (perf_ != NULL) {
+    perf_->Stop();
+  }
   // epoch_time_.Stop();
   // train_time_.Pause();
   double time = 0;
@@ -45,10 +58,18 @@ double Hogwild<Model, Params, Exec>::UpdateModel(Scan &scan) {
   return time;
 }
 
+/*! \brief Resets a scan for a pass whose order does not matter
+ * Overloaded for the scans that can then skip shuffling their examples.
+ */
+template <class Scan>
+void ResetUnshuffled(Scan &scan) {
+  scan.Reset();
+}
+
 template <class Model, class Params, class Exec>
 template <class Scan>
 double Hogwild<Model, Params, Exec>::ComputeRMSE(Scan &scan) {
-  scan.Reset();
+  ResetUnshuffled(scan);
   Zero();
   test_time_.Start();
   size_t count = FFAScan(model_, params_, scan, 
@@ -65,11 +86,10 @@ double Hogwild<Model, Params, Exec>::ComputeRMSE(Scan &scan) {
 template <class Model, class Params, class Exec>
 template <class Scan>
 double Hogwild<Model, Params, Exec>::ComputeObj(Scan &scan) {
-  scan.Reset();
+  ResetUnshuffled(scan);
   Zero();
   test_time_.Start();
-  size_t count = FFAScan(model_, params_, scan, 
-                         tpool_, Exec::ModelObj, res_);
+  FFAScan(model_, params_, scan, tpool_, Exec::ModelObj, res_);
   test_time_.Stop();
 
   double obj = 0;
@@ -82,7 +102,7 @@ double Hogwild<Model, Params, Exec>::ComputeObj(Scan &scan) {
 template <class Model, class Params, class Exec>
 template <class Scan>
 double Hogwild<Model, Params, Exec>::ComputeAccuracy(Scan &scan) {
-  scan.Reset();
+  ResetUnshuffled(scan);
   Zero();
   test_time_.Start();
   size_t count = FFAScan(model_, params_, scan, 
@@ -96,86 +116,632 @@ double Hogwild<Model, Params, Exec>::ComputeAccuracy(Scan &scan) {
   return obj / count;
 }
 
-  template<class Model, class Example, class Scan>
-  void CalcF1Score(const Model& model, int (* hook)(const Example& e, const Model& model), Scan& scan, int& tp, int& tn, int& fp, int& fn) {
-      scan.Reset();
-      while (scan.HasNext()) {
-          ExampleBlock<Example> &ex = scan.Next();
-          vector::FVector<Example> vec = ex.ex;
-          for (int i = 0; i < vec.size; ++i) {
-              bool correct = hook(vec[i], model) == 1;
-              bool positive = vec[i].value > 0;
-              if (correct) {
-                  if (positive) tp++; else tn++;
-              } else {
-                  if (positive) fn++; else fp++;
-              }
+template <class Model, class Params, class Exec>
+void Hogwild<Model, Params, Exec>::TrainMetrics(
+    int epoch, double wall_clock, double epoch_time,
+    hazy::util::MetricsRecord &rec,
+    std::vector<hazy::util::MetricsRecord> &threads) {
+  rec = hazy::util::MetricsRecord("epoch");
+  rec.Add("epoch", epoch);
+  rec.Add("wall_clock", wall_clock);
+  rec.Add("train_time", train_time_.value);
+  rec.Add("epoch_time", epoch_time);
+  rec.Add("examples", epoch_examples_);
+  rec.Add("examples_per_sec", epoch_time > 0 ? epoch_examples_ / epoch_time : 0.0);
+  threads.assign(tpool_.ThreadCount(), hazy::util::MetricsRecord());
+  for (unsigned t = 0; t < tpool_.ThreadCount(); ++t) {
+    threads[t].Add("thread", t);
+    threads[t].Add("cpu", tpool_.GetThreadCoreAffinity(t));
+    threads[t].Add("node", tpool_.GetThreadNodeAffinity(t));
+    // what Exec::UpdateModel returned, its time
+    threads[t].Add("train_time", res_.values[t]);
+    if (perf_ != NULL) {
+      for (int ev = 0; ev < hazy::util::kPerfEventCount; ++ev) {
+        if (perf_->Available(ev)) {
+          threads[t].Add(hazy::util::PerfCounters::Name(ev), perf_->Delta(t, ev));
+        }
+      }
+    }
+  }
+  Exec::EpochMetrics(model_, params_, rec, threads);
+}
+
+template <class Model, class Params, class Exec>
+void Hogwild<Model, Params, Exec>::WriteMetrics(
+    hazy::util::MetricsRecord &rec,
+    std::vector<hazy::util::MetricsRecord> const &threads) {
+  rec.Add("threads", threads);
+  metrics_->Write(rec);
+}
+
+template <class Model, class Params, class Exec>
+void Hogwild<Model, Params, Exec>::ResultMetrics(int epoch, double train_time,
+                                                 double eval_time,
+                                                 char const *reason) {
+  if (metrics_ != NULL) {
+    hazy::util::MetricsRecord rec("result");
+    rec.Add("reason", reason);
+    rec.Add("threads", tpool_.ThreadCount());
+    rec.Add("epoch", epoch);
+    rec.Add("train_time", train_time);
+    rec.Add("eval_time", eval_time);
+    metrics_->Write(rec);
+  }
+}
+
+template <class Model, class Params, class Exec>
+void Hogwild<Model, Params, Exec>::PrintConvergence(int epoch, double obj,
+                                                    double decrease,
+                                                    double grad_norm,
+                                                    int flat) {
+  if (conv_obj_tol_ <= 0 && conv_grad_tol_ <= 0) {
+    return;
+  }
+  printf("converge: epoch: %d", epoch);
+  if (conv_obj_tol_ > 0) {
+    printf(" train_obj: %.6g decrease: %.3g", obj, decrease);
+  }
+  if (conv_grad_tol_ > 0) {
+    printf(" grad_norm: %.3g", grad_norm);
+  }
+  printf(" flat: %d/%d\n", flat, conv_patience_);
+}
+
+/*! \brief Appends the example blocks of a scan, which must keep them in memory
+ * Overloaded for scans holding a copy of the examples on every node.
+ * \return the number of copies of the examples in blocks
+ */
+template <class Scan, class Example>
+unsigned ScanBlocks(Scan &scan, std::vector<vector::FVector<Example> > &blocks) {
+  ResetUnshuffled(scan);
+  while (scan.HasNext()) {
+    blocks.push_back(scan.Next().ex);
+  }
+  return 1;
+}
+
+/*! \brief Selection sampling of the examples of the first nblocks blocks
+ * Each example is picked with probability needed / left, in the order of
+ * the blocks, so that every subset of count examples is equally likely.
+ * \param count examples to pick, all of them if there are fewer
+ * \param picks appended the (block, index) of each example picked
+ */
+template <class Example>
+void SampleBlocks(std::vector<vector::FVector<Example> > const &blocks,
+                  size_t nblocks, size_t count,
+                  std::vector<std::pair<unsigned, size_t> > &picks) {
+  size_t n = 0;
+  for (size_t b = 0; b < nblocks; ++b) {
+    n += blocks[b].size;
+  }
+  util::SimpleRandom &rand = util::SimpleRandom::GetInstance();
+  size_t needed = std::min(count, n);
+  size_t left = n;
+  for (size_t b = 0; b < nblocks; ++b) {
+    for (size_t i = 0; i < blocks[b].size; ++i, --left) {
+      if (rand.RandDouble() * left < needed) {
+        picks.push_back(std::make_pair((unsigned) b, i));
+        --needed;
+      }
+    }
+  }
+}
+
+/*! \brief A random sample of the examples of a scan
+ * \param scan keeps its blocks in memory while the sample is used
+ * \param count examples in the sample, all of them if there are fewer
+ * \param sample the examples, in the order of the scan
+ */
+template <class Scan, class Example>
+void SampleExamples(Scan &scan, size_t count,
+                    std::vector<Example const *> &sample) {
+  std::vector<vector::FVector<Example> > blocks;
+  unsigned copies = ScanBlocks(scan, blocks);
+  std::vector<std::pair<unsigned, size_t> > picks;
+  SampleBlocks(blocks, blocks.size() / copies, count, picks);
+  for (size_t k = 0; k < picks.size(); ++k) {
+    sample.push_back(&blocks[picks[k].first].values[picks[k].second]);
+  }
+}
+
+//! Counts of the predictions of a binary classifier
+struct Confusion {
+  size_t tp, tn, fp, fn;
+
+  Confusion() : tp(0), tn(0), fp(0), fn(0) { }
+
+  void Add(Confusion const &o) {
+    tp += o.tp;
+    tn += o.tn;
+    fp += o.fp;
+    fn += o.fn;
+  }
+
+  double Precision() const { return double(tp) / (tp + fp); }
+  double Recall() const { return double(tp) / (tp + fn); }
+  //! Fraction of the examples predicted correctly
+  double Correct() const { return double(tp + tn) / (tp + tn + fp + fn); }
+  double F1() const {
+    double precision = Precision();
+    double recall = Recall();
+    return 2 * precision * recall / (precision + recall);
+  }
+
+  /*! \brief Half width of a confidence interval of F1() on a random sample
+   * From the delta method, with p the rate of tp and q the rate of fp + fn,
+   * F1 = 2p / (2p + q) and Var(F1) = 4pq(p + q) / (n (2p + q)^4).
+   * \param z the normal quantile of the confidence, 1.96 for 95%
+   */
+  double F1HalfWidth(double z) const {
+    double n = tp + tn + fp + fn;
+    double p = tp / n;
+    double q = (fp + fn) / n;
+    double d = 2 * p + q;
+    return z * std::sqrt(4 * p * q * (p + q) / (n * d * d * d * d));
+  }
+};
+
+/*! \brief Confusion matrices of a model, reduced over the threads of a pool
+ * The examples of every scan added are split among the threads, each thread
+ * reads the copy of its node and counts its own Confusion. Start() returns
+ * right away, so that the caller can go on training until Wait().
+ */
+template<class Model, class Example>
+class ParallelConfusion {
+ public:
+  //! \param hook returns 1 if the model predicts the example correctly
+  explicit ParallelConfusion(int (*hook)(const Example&, const Model&)) :
+      hook_(hook), model_(NULL), tpool_(NULL) { }
+
+  /*! \brief Scores the examples of scan in every Start()
+   * \param scan keeps its blocks in memory until the last Wait()
+   * \param stride scores every stride-th example only
+   * \return the index of the scan for Result()
+   */
+  template <class Scan>
+  unsigned AddScan(Scan &scan, size_t stride = 1) {
+    Set set;
+    set.copies = ScanBlocks(scan, set.blocks);
+    set.stride = std::max(stride, (size_t) 1);
+    set.enabled = true;
+    sets_.push_back(set);
+    return sets_.size() - 1;
+  }
+
+  /*! \brief Scores the same random sample of a scan in every Start()
+   * \param scan keeps its blocks in memory until the last Wait()
+   * \param count examples in the sample, all of them if there are fewer
+   * \return the index of the sample for Result()
+   */
+  template <class Scan>
+  unsigned AddSample(Scan &scan, size_t count) {
+    unsigned s = AddScan(scan);
+    Set &set = sets_[s];
+    SampleBlocks(set.blocks, set.blocks.size() / set.copies, count, set.picks);
+    return s;
+  }
+
+  //! Includes a scan in the next Start(), or skips it (the default is on)
+  void Enable(unsigned set, bool on) { sets_[set].enabled = on; }
+
+  /*! \brief Starts scoring the scans
+   * \param model the model, must not change until Wait()
+   * \param tpool the pool to run on
+   */
+  void Start(const Model &model, hazy::thread::ThreadPool &tpool) {
+    model_ = &model;
+    tpool_ = &tpool;
+    counts_.assign(sets_.size() * tpool.ThreadCount(), Confusion());
+    seconds_.assign(tpool.ThreadCount(), 0);
+    tpool.Execute(*this, Run);
+  }
+
+  //! Waits for Start() and sums the counts of the threads
+  void Wait() {
+    tpool_->Wait();
+    results_.assign(sets_.size(), Confusion());
+    for (size_t i = 0; i < counts_.size(); ++i) {
+      results_[i % sets_.size()].Add(counts_[i]);
+    }
+  }
+
+  //! Counts of a scan in the last Wait()
+  Confusion const & Result(unsigned set) const { return results_[set]; }
+
+  //! Time the slowest thread of the last Start() spent scoring
+  double Seconds() const {
+    return *std::max_element(seconds_.begin(), seconds_.end());
+  }
+
+ private:
+  struct Set {
+    std::vector<vector::FVector<Example> > blocks; //!< copies * blocks per copy
+    unsigned copies; //!< copies of the examples, one per node
+    size_t stride;
+    //! the block in a copy and the index of each example of a sample
+    std::vector<std::pair<unsigned, size_t> > picks;
+    bool enabled;
+  };
+
+  void Count(Example const &ex, Confusion &c) const {
+    bool correct = hook_(ex, *model_) == 1;
+    bool positive = ex.value > 0;
+    if (correct) {
+      if (positive) c.tp++; else c.tn++;
+    } else {
+      if (positive) c.fn++; else c.fp++;
+    }
+  }
+
+  static void Run(ParallelConfusion &pc, unsigned tid, unsigned total) {
+    hazy::util::Clock clock;
+    clock.Start();
+    int node = numa_node_of_cpu(sched_getcpu());
+    for (size_t s = 0; s < pc.sets_.size(); ++s) {
+      Set const &set = pc.sets_[s];
+      Confusion c;
+      if (!set.enabled) {
+        pc.counts_[tid * pc.sets_.size() + s] = c;
+        continue;
+      }
+      size_t nblocks = set.blocks.size() / set.copies;
+      unsigned copy = node >= 0 && (unsigned) node < set.copies ? node : 0;
+      vector::FVector<Example> const *blocks = &set.blocks[copy * nblocks];
+      if (!set.picks.empty()) {
+        size_t start = GetStartIndex(set.picks.size(), tid, total);
+        size_t end = GetEndIndex(set.picks.size(), tid, total);
+        for (size_t k = start; k < end; ++k) {
+          pc.Count(blocks[set.picks[k].first].values[set.picks[k].second], c);
+        }
+      }
+      else {
+        for (size_t b = 0; b < nblocks; ++b) {
+          vector::FVector<Example> const &vec = blocks[b];
+          size_t n = (vec.size + set.stride - 1) / set.stride;
+          size_t start = GetStartIndex(n, tid, total);
+          size_t end = GetEndIndex(n, tid, total);
+          for (size_t i = start * set.stride; i < end * set.stride; i += set.stride) {
+            pc.Count(vec.values[i], c);
           }
+        }
       }
+      pc.counts_[tid * pc.sets_.size() + s] = c;
+    }
+    pc.seconds_[tid] = clock.Stop();
   }
 
-  template<class Model, class Params, class Exec>
-  template<class Scan>
-  double Hogwild<Model, Params, Exec>::ComputeF1Score(Scan& scan) {
-      int tp = 0, tn = 0, fp = 0, fn = 0;
-      CalcF1Score(this->model_, Exec::ComputeAccuracy, scan, tp, tn, fp, fn);
-      double precision = double(tp) / (tp + fp);
-      double recall = double(tp) / (tp + fn);
-      return 2 * precision * recall / (precision + recall);
+  int (*hook_)(const Example&, const Model&);
+  Model const *model_;
+  hazy::thread::ThreadPool *tpool_;
+  std::vector<Set> sets_;
+  std::vector<Confusion> counts_; //!< of each thread, for each set
+  std::vector<Confusion> results_; //!< of each set
+  std::vector<double> seconds_; //!< time of each thread
+};
+
+template<class Model, class Params, class Exec>
+template<class Scan>
+double Hogwild<Model, Params, Exec>::ComputeF1Score(Scan& scan) {
+  return ComputeConfusion(scan, Exec::ComputeAccuracy).F1();
+}
+
+template<class Model, class Params, class Exec>
+template<class Scan, class Example>
+Confusion Hogwild<Model, Params, Exec>::ComputeConfusion(
+    Scan &scan, int (*hook)(const Example&, const Model&)) {
+  ParallelConfusion<Model, Example> score(hook);
+  score.AddScan(scan);
+  score.Start(model_, tpool_);
+  score.Wait();
+  return score.Result(0);
+}
+
+template <class Model, class Params, class Exec>
+void Hogwild<Model, Params, Exec>::ScoreMetrics(
+    hazy::util::MetricsRecord &rec, double eval_time,
+    Confusion const *train, Confusion const &test) {
+  rec.Add("eval_time", eval_time);
+  rec.Add("train_acc", (train != NULL ? *train : test).F1());
+  rec.Add("test_acc", test.F1());
+  rec.Add("test_precision", test.Precision());
+  rec.Add("test_recall", test.Recall());
+  rec.Add("test_correct", test.Correct());
+  if (train != NULL) {
+    rec.Add("train_correct", train->Correct());
   }
+}
 
 template <class Model, class Params, class Exec>
-template <class TrainScan, class TestScan>
-bool Hogwild<Model, Params, Exec>::RunExperiment(
-    int nepochs, hazy::util::Clock &wall_clock, 
-    TrainScan &trscan, TestScan &tescan, double target_accuracy) {
-  printf("wall_clock: %.5f    Going Hogwild!\n", wall_clock.Read());
+template <class TrainScan, class TestScan, class Example>
+bool Hogwild<Model, Params, Exec>::RunScoredExperiment(
+    int nepochs, hazy::util::Clock &wall_clock,
+    TrainScan &trscan, TestScan &tescan, double target_accuracy,
+    int (*hook)(const Example&, const Model&)) {
+  // scored on the training threads after each epoch, or on eval_pool_
+  // during the next one
+  bool async = eval_pool_ != NULL;
+  hazy::thread::ThreadPool &pool = async ? *eval_pool_ : tpool_;
+  if (async) {
+    printf("wall_clock: %.5f    Going Hogwild! (evaluating on %d threads)\n",
+           wall_clock.Read(), eval_pool_->ThreadCount());
+  }
+  else {
+    printf("wall_clock: %.5f    Going Hogwild!\n", wall_clock.Read());
+  }
+  ParallelConfusion<Model, Example> score(hook);
+  unsigned test_set = score.AddScan(tescan);
+  unsigned train_set = 0;
+  unsigned sample_set = 0;
+  if (train_sample_ > 0) {
+    train_set = score.AddScan(trscan, (size_t) (1 / train_sample_ + 0.5));
+  }
+  if (eval_policy_ == kEvalSample) {
+    sample_set = score.AddSample(tescan, eval_sample_);
+  }
   bool stop = false;
+  bool pending = false;
   double time_s = 0.0;
+  double eval_s = 0.0;
+  // the statistics of the epoch waiting to be reported, and how it is scored
+  double wall = 0, train_time = 0, epoch_time = 0;
+  size_t epoch_examples = 0;
   int epoch = 0;
-  for (int e = 1; e <= nepochs; e++) {
-    double epoch_time = UpdateModel(trscan);
-      double f1_train = ComputeF1Score(tescan);
-      double f1_test = ComputeF1Score(tescan);
+  int scored = kScoredNone;
+  result_ = RunResult();
+  // the schedule of kEvalAdaptive
+  int next_eval = 1, interval = 1, last_epoch = 0;
+  double last_acc = 0;
+  // the convergence, see SetConvergence()
+  std::vector<Example const *> grad_sample;
+  if (conv_grad_tol_ > 0) {
+    SampleExamples(trscan, conv_sample_, grad_sample);
+  }
+  double obj = 0, last_obj = 0, decrease = 0, grad_norm = 0;
+  int flat = 0;
+  bool converged = false;
+  int saved = start_epoch_;
+  hazy::util::MetricsRecord rec;
+  std::vector<hazy::util::MetricsRecord> threads;
+  for (int e = start_epoch_ + 1; e <= nepochs + 1 && !stop; e++) {
+    double next_epoch_time = 0;
+    if (async && e <= nepochs && !converged) {
+      next_epoch_time = UpdateModel(trscan);
+      if (perf_ != NULL) {
+        perf_->Print(e);
+      }
+    }
+    if (pending) {
+      pending = false;
+      time_s += epoch_time;
+      result_.epochs = epoch - start_epoch_;
+      result_.examples += epoch_examples;
+      if (scored == kScoredNone) {
+        // the epoch line comes last, as below
+        PrintConvergence(epoch, obj, decrease, grad_norm, flat);
+        if (perf_ != NULL && !async) {
+          perf_->Print(epoch);
+        }
+        printf("epoch: %d wall_clock: %.5f train_time!!!: %.5f epoch_time: %.5f\n",
+               epoch, wall, train_time, epoch_time);
+        fflush(stdout);
+        if (metrics_ != NULL) {
+          rec.Add("eval", "none");
+          WriteMetrics(rec, threads);
+        }
+      }
+      else {
+        // in turn, the training threads score the previous epoch here
+        score.Wait();
+        double eval_time = score.Seconds();
+        Confusion test = score.Result(scored == kScoredSample ? sample_set : test_set);
+        Confusion const *train = train_sample_ > 0 ? &score.Result(train_set) : NULL;
+        Confusion train_copy = train != NULL ? *train : Confusion();
+        double ci = 0;
+        if (scored == kScoredSample) {
+          ci = test.F1HalfWidth(1.96);
+          if (!(test.F1() + ci < target_accuracy)) {
+            // the target may be reached, confirm on the whole test set (in
+            // async mode the copy of the epoch is still there)
+            score.Enable(test_set, true);
+            score.Enable(sample_set, false);
+            if (train_sample_ > 0) {
+              score.Enable(train_set, false);
+            }
+            score.Start(model_, pool);
+            score.Wait();
+            eval_time += score.Seconds();
+            test = score.Result(test_set);
+            scored = kScoredFull;
+          }
+        }
+        eval_s += eval_time;
+        // without a train sample the test score stands for both
+        double f1_test = test.F1();
+        double f1_train = train != NULL ? train_copy.F1() : f1_test;
+        if (scored == kScoredFull) {
+          result_.test_acc = f1_test;
+        }
+        // the scripts read the accuracy from the line just before the final
+        // "threads: ... epoch:" line, so the epoch line comes last
+        PrintConvergence(epoch, obj, decrease, grad_norm, flat);
+        if (perf_ != NULL && !async) {
+          perf_->Print(epoch);
+        }
+        printf("epoch: %d wall_clock: %.5f train_time!!!: %.5f epoch_time: %.5f train_acc: %.5g test_acc: %.5g\n",
+               epoch, wall, train_time, epoch_time, f1_train, f1_test);
+        fflush(stdout);
+        if (metrics_ != NULL) {
+          ScoreMetrics(rec, eval_time, train != NULL ? &train_copy : NULL, test);
+          rec.Add("eval", scored == kScoredSample ? "sample" : "full");
+          if (scored == kScoredSample) {
+            rec.Add("test_acc_ci", ci);
+          }
+          WriteMetrics(rec, threads);
+        }
+        // only the whole test set decides, in async mode the epoch trained
+        // meanwhile is not counted
+        stop = scored == kScoredFull && f1_test >= target_accuracy;
+        converged = converged && !stop;
+        if (eval_policy_ == kEvalAdaptive) {
+          // the next score when the trend of the last two would reach half
+          // way to the target, sooner if it improves fast
+          if (last_epoch > 0) {
+            double gain = (f1_test - last_acc) / (epoch - last_epoch);
+            double wait = gain > 0 ? (target_accuracy - f1_test) / gain / 2
+                                   : 2.0 * interval;
+            interval = (int) std::min(std::max(wait, 1.0), 8.0 * eval_every_);
+          }
+          last_epoch = epoch;
+          last_acc = f1_test;
+          next_eval = epoch + interval;
+        }
+      }
+    }
+    if (e > nepochs || stop || converged) {
+      break;
+    }
+    if (!async) {
+      next_epoch_time = UpdateModel(trscan);
+    }
+    epoch = e;
+    wall = wall_clock.Read();
+    train_time = train_time_.value;
+    epoch_time = next_epoch_time;
+    epoch_examples = epoch_examples_;
+    if (metrics_ != NULL) {
+      TrainMetrics(epoch, wall, epoch_time, rec, threads);
+    }
+    // the last epoch is always scored on the whole test set
+    scored = kScoredFull;
+    if (e < nepochs) {
+      if (eval_policy_ == kEvalSample) {
+        scored = kScoredSample;
+      } else if (eval_policy_ == kEvalEvery && e % eval_every_ != 0) {
+        scored = kScoredNone;
+      } else if (eval_policy_ == kEvalAdaptive && e < next_eval) {
+        scored = kScoredNone;
+      }
+    }
+    // before the evaluation, so that Exec can prepare the model it scores,
+    // in async mode the copy scored from now on
     Exec::PostEpoch(model_, params_);
+    if (conv_obj_tol_ > 0 || conv_grad_tol_ > 0) {
+      // on the model scored, between the epochs
+      hazy::util::Clock clock;
+      clock.Start();
+      bool is_flat = false;
+      if (conv_obj_tol_ > 0) {
+        obj = ComputeObj(trscan);
+        bool first = e == start_epoch_ + 1;
+        decrease = !first ? (last_obj - obj) / std::fabs(last_obj) : NAN;
+        is_flat = !first && decrease < conv_obj_tol_;
+        last_obj = obj;
+      }
+      if (conv_grad_tol_ > 0) {
+        grad_norm = Exec::GradientNorm(model_, params_, grad_sample);
+        is_flat = is_flat || grad_norm < conv_grad_tol_;
+      }
+      flat = is_flat ? flat + 1 : 0;
+      if (flat >= conv_patience_) {
+        // the last epoch of the run
+        converged = true;
+        scored = kScoredFull;
+      }
+      eval_s += clock.Stop();
+      if (metrics_ != NULL) {
+        if (conv_obj_tol_ > 0) {
+          rec.Add("train_obj", obj);
+          rec.Add("obj_decrease", decrease);
+        }
+        if (conv_grad_tol_ > 0) {
+          rec.Add("grad_norm", grad_norm);
+        }
+        rec.Add("flat", flat);
+        rec.Add("converge_time", clock.value);
+      }
+    }
+    if (scored != kScoredNone) {
+      score.Enable(test_set, scored == kScoredFull);
+      if (eval_policy_ == kEvalSample) {
+        score.Enable(sample_set, scored == kScoredSample);
+      }
+      if (train_sample_ > 0) {
+        score.Enable(train_set, true);
+      }
+      score.Start(model_, pool);
+    }
+    pending = true;
     Exec::PostUpdate(model_, params_);
-/*
-    printf("epoch: %d wall_clock: %.5f train_time: %.5f test_time: %.5f epoch_time: %.5f train_rmse: %.5g test_rmse: %.5g\n", 
-           e, wall_clock.Read(), train_time_.value, test_time_.value, 
-           epoch_time_.value, train_rmse, test_rmse);
-*/
-   
-    printf("epoch: %d wall_clock: %.5f train_time!!!: %.5f epoch_time: %.5f train_acc: %.5g test_acc: %.5g\n",
-           e, wall_clock.Read(), train_time_.value,
-           epoch_time, f1_train, f1_test);
-    fflush(stdout);
-    time_s += epoch_time;
-    if (f1_test >= target_accuracy) {
-      epoch = e;
-      stop = true;
-      break;
+    if (checkpoint_ != NULL &&
+        (e % checkpoint_every_ == 0 || e == nepochs || converged)) {
+      hazy::util::Clock clock;
+      clock.Start();
+      Exec::SaveCheckpoint(model_, params_, e, *checkpoint_);
+      saved = e;
+      if (metrics_ != NULL) {
+        rec.Add("checkpoint_time", clock.Stop());
+      }
     }
   }
+  result_.train_time = time_s;
+  result_.eval_time = eval_s;
+  result_.reached = stop;
+  result_.converged = converged;
+  if (stop && checkpoint_ != NULL && saved != epoch && !async) {
+    // in async mode the model has trained one more epoch since
+    Exec::SaveCheckpoint(model_, params_, epoch, *checkpoint_);
+  }
   if (stop) {
-    printf("threads: %d epoch: %d train_time: %.5f\n", tpool_.ThreadCount(), epoch, time_s);
+    printf("threads: %d epoch: %d train_time: %.5f eval_time: %.5f\n",
+           tpool_.ThreadCount(), epoch, time_s, eval_s);
+    fflush(stdout);
+    ResultMetrics(epoch, time_s, eval_s, "target");
+  }
+  else if (converged) {
+    // not a "threads:" line, the target was not reached
+    printf("converged at epoch %d: threads: %d train_time: %.5f eval_time: %.5f\n",
+           epoch, tpool_.ThreadCount(), time_s, eval_s);
     fflush(stdout);
+    ResultMetrics(epoch, time_s, eval_s, "converged");
   }
   return stop;
 }
 
+template <class Model, class Params, class Exec>
+template <class TrainScan, class TestScan>
+bool Hogwild<Model, Params, Exec>::RunExperiment(
+    int nepochs, hazy::util::Clock &wall_clock, 
+    TrainScan &trscan, TestScan &tescan, double target_accuracy) {
+  return RunScoredExperiment(nepochs, wall_clock, trscan, tescan,
+                             target_accuracy, Exec::ComputeAccuracy);
+}
+
 template <class Model, class Params, class Exec>
 template <class TrainScan>
 void Hogwild<Model, Params, Exec>::RunExperiment(
     int nepochs, hazy::util::Clock &wall_clock, TrainScan &trscan) {
   printf("wall_clock: %.5f    Going Hogwild!\n", wall_clock.Read());
+  hazy::util::MetricsRecord rec;
+  std::vector<hazy::util::MetricsRecord> threads;
   for (int e = 1; e <= nepochs; e++) {
-    UpdateModel(trscan);
+    double epoch_time = UpdateModel(trscan);
+    if (metrics_ != NULL) {
+      TrainMetrics(e, wall_clock.Read(), epoch_time, rec, threads);
+    }
     double train_rmse = ComputeRMSE(trscan);
 
     printf("epoch: %d wall_clock: %.5f train_time: %.5f test_time: %.5f epoch_time: %.5g train_rmse: %.5g\n", 
            e, wall_clock.Read(), train_time_.value, test_time_.value, 
            epoch_time_.value, train_rmse);
     fflush(stdout);
+    if (perf_ != NULL) {
+      perf_->Print(e);
+    }
+    if (metrics_ != NULL) {
+      rec.Add("eval_time", test_time_.value);
+      rec.Add("train_rmse", train_rmse);
+      WriteMetrics(rec, threads);
+    }
   }
 }
 
@@ -17,12 +17,55 @@
 #ifndef HAZY_HOGWILD_HOGWILD_H
 #define HAZY_HOGWILD_HOGWILD_H
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 #include "hazy/vector/fvector.h"
 #include "hazy/thread/thread_pool-inl.h"
+#include "hazy/util/checkpoint.h"
+#include "hazy/util/metrics.h"
+#include "hazy/util/perf_counters.h"
 
 namespace hazy {
 namespace hogwild {
 
+struct Confusion;
+
+//! The epochs RunExperiment() scores, see Hogwild::SetEvalPolicy()
+enum EvalPolicy {
+  kEvalEvery, //!< every eval_every epochs
+  kEvalSample, //!< a random sample every epoch, all of it near the target
+  kEvalAdaptive //!< less often as the accuracy flattens
+};
+
+/*! \brief Parses the name of an EvalPolicy
+ * \return the policy for every, sample or adaptive, -1 if unknown
+ */
+int ParseEvalPolicy(std::string const &name) {
+  if (name == "every")
+    return kEvalEvery;
+  if (name == "sample")
+    return kEvalSample;
+  if (name == "adaptive")
+    return kEvalAdaptive;
+  return -1;
+}
+
+//! What the last RunExperiment() measured, see Hogwild::Result()
+struct RunResult {
+  int epochs; //!< epochs trained and reported
+  size_t examples; //!< examples trained on in them
+  double train_time; //!< seconds spent training them
+  double eval_time; //!< seconds spent scoring them
+  double test_acc; //!< of the last epoch scored on the whole test set
+  bool reached; //!< stopped at the target, train_time is the time to it
+  bool converged; //!< stopped once the training plateaued
+
+  RunResult() : epochs(0), examples(0), train_time(0), eval_time(0),
+      test_acc(0), reached(false), converged(false) { }
+};
+
 /*! \brief Hogwild! parallel executor
  * \tparam Exec implements Exec::UpateModel, Exec::TestModel, Exec::PostUpdate
  */
@@ -35,7 +78,11 @@ class Hogwild {
    * \param tpool the already init'd thread pool
    */
   Hogwild(Model &m, Params &p, hazy::thread::ThreadPool &tpool) :
-      model_(m), params_(p), tpool_(tpool) {
+      model_(m), params_(p), tpool_(tpool), eval_pool_(NULL), perf_(NULL),
+      metrics_(NULL), epoch_examples_(0), train_sample_(0),
+      eval_policy_(kEvalEvery), eval_every_(1), eval_sample_(0),
+      conv_obj_tol_(0), conv_grad_tol_(0), conv_patience_(1), conv_sample_(0),
+      checkpoint_(NULL), checkpoint_every_(1), start_epoch_(0) {
     res_.size = tpool_.ThreadCount();
     res_.values = new double[res_.size];
   }
@@ -67,14 +114,120 @@ class Hogwild {
    * \param nepochs number of epochs to run for
    * \param wall_clock a clock that was already started
    * \param trscan the train example scanner
-   * \param tescan the test eample scanner
+   * \param tescan the test eample scanner, scored in parallel, so it keeps
+   *  its blocks in memory
    */
   template <class TrainScan, class TestScan>
   bool RunExperiment(int nepochs, hazy::util::Clock &wall_clock,
                      TrainScan &trscan, TestScan &tescan, double target_accuracy = 1.0);
 
+  //! F1 score of the model on a scan, see ComputeConfusion()
   template <class Scan>
   double ComputeF1Score(Scan &scan);
+
+  /*! \brief Counts the predictions of hook on a scan, on the pool's threads
+   * \param scan keeps its blocks in memory (e.g. a MemoryScan)
+   * \param hook returns 1 if the model predicts an example correctly
+   */
+  template <class Scan, class Example>
+  Confusion ComputeConfusion(Scan &scan,
+                             int (*hook)(const Example&, const Model&));
+
+  /*! \brief Also scores a sample of the training examples in RunExperiment()
+   * Every 1 / fraction-th example of the train scan, which must keep its
+   * blocks in memory, is scored together with the test scan. Without it
+   * (the default) train_acc repeats test_acc.
+   * \param fraction of the training examples, 0 for none
+   */
+  void SetTrainSample(double fraction) { train_sample_ = fraction; }
+
+  /*! \brief Chooses the epochs RunExperiment() scores
+   * Only the whole test set decides when target_accuracy is reached, and the
+   * last epoch is always scored on it. With kEvalSample each epoch is scored
+   * on a fixed random sample of the test set, and on all of it only when the
+   * 95% confidence interval of the sample's F1 reaches the target. With
+   * kEvalAdaptive the next score is planned half way to the target along the
+   * trend of the last two, at most 8 * every epochs later. Epochs that are
+   * not scored print no accuracy. The time reported when the target is
+   * reached is the training time of the epochs up to the first one scored
+   * above it.
+   * \param policy one of EvalPolicy
+   * \param every epochs between two scores with kEvalEvery, at least 1
+   * \param sample test examples in the sample of kEvalSample
+   */
+  void SetEvalPolicy(int policy, int every, size_t sample) {
+    eval_policy_ = policy;
+    eval_every_ = std::max(every, 1);
+    eval_sample_ = sample;
+  }
+
+  /*! \brief Stops RunExperiment() once the training has plateaued
+   * After each epoch the objective of the training set (Exec::ModelObj, on
+   * the pool's threads, which needs a train scan keeping its blocks in
+   * memory) and the norm of the average stochastic gradient of a fixed
+   * random sample of it (Exec::GradientNorm) are computed, each when its
+   * tolerance is positive. An epoch is flat when the objective decreased by
+   * less than obj_tol of its previous value, or when the gradient norm is
+   * below grad_tol. After patience flat epochs in a row the last one is
+   * scored on the whole test set and the run stops.
+   * \param obj_tol relative decrease of the objective, 0 to not compute it
+   * \param grad_tol norm of the gradient, 0 to not compute it
+   * \param patience flat epochs in a row, at least 1
+   * \param sample training examples of the gradient estimate
+   */
+  void SetConvergence(double obj_tol, double grad_tol, int patience,
+                      size_t sample) {
+    conv_obj_tol_ = obj_tol;
+    conv_grad_tol_ = grad_tol;
+    conv_patience_ = std::max(patience, 1);
+    conv_sample_ = sample;
+  }
+
+  /*! \brief Evaluates each epoch on the given pool while the next one trains
+   * RunExperiment() then scores epoch e on pool during epoch e + 1, and
+   * prints it (or stops at target_accuracy) one epoch late. Exec must
+   * evaluate a copy of the model made by Exec::PostEpoch, which is not
+   * called before the evaluation of the previous epoch is done.
+   * \param pool threads not used by the training, NULL to evaluate in turn
+   */
+  void SetEvalPool(hazy::thread::ThreadPool *pool) { eval_pool_ = pool; }
+
+  /*! \brief Counts events of the training threads in every UpdateModel()
+   * RunExperiment() prints the counts of each epoch as "perf:" lines.
+   * \param perf counters opened on the threads of the pool, NULL for none
+   */
+  void SetPerfCounters(hazy::util::PerfCounters *perf) { perf_ = perf; }
+
+  /*! \brief Writes a JSON line for every epoch of RunExperiment()
+   * The "epoch" records have the times, the throughput and the evaluation
+   * of the epoch, the counters added by Exec::EpochMetrics, and a "threads"
+   * array with the time (and perf counters) of each training thread. A
+   * "result" record follows when the target accuracy is reached.
+   * \param metrics the sink, NULL for none
+   */
+  void SetMetrics(hazy::util::MetricsSink *metrics) { metrics_ = metrics; }
+
+  /*! \brief Checkpoints the model during RunExperiment()
+   * After every k-th epoch, the last one and the one that converged, once
+   * Exec::PostUpdate has decayed the step size, Exec::SaveCheckpoint hands
+   * the replicas of the model to writer, which writes them while the next
+   * epoch trains. In sync mode the epoch that reached the target is saved
+   * too.
+   * \param writer NULL for none
+   * \param every epochs between two checkpoints, at least 1
+   */
+  void SetCheckpoint(hazy::util::CheckpointWriter *writer, int every) {
+    checkpoint_ = writer;
+    checkpoint_every_ = std::max(every, 1);
+  }
+
+  /*! \brief Resumes RunExperiment() after the given epoch, e.g. of a
+   * checkpoint restored into the model and the params
+   */
+  void SetStartEpoch(int epoch) { start_epoch_ = epoch; }
+
+  //! The measures of the last RunExperiment() scored by accuracy
+  RunResult const & Result() const { return result_; }
  
   /*! \brief Runs an experiment printing statistics
    * \param nepochs number of epochs to run for
@@ -93,6 +246,58 @@ class Hogwild {
   Params &params_; //!< the params
   hazy::thread::ThreadPool &tpool_; //!< thread pool to use for train & test
   vector::FVector<double> res_; //!< results (for computing RMSE) size=nthreads
+  hazy::thread::ThreadPool *eval_pool_; //!< see SetEvalPool()
+  hazy::util::PerfCounters *perf_; //!< see SetPerfCounters()
+  hazy::util::MetricsSink *metrics_; //!< see SetMetrics()
+  size_t epoch_examples_; //!< examples of the most recent UpdateModel
+  double train_sample_; //!< see SetTrainSample()
+  int eval_policy_; //!< see SetEvalPolicy()
+  int eval_every_;
+  size_t eval_sample_;
+  double conv_obj_tol_; //!< see SetConvergence()
+  double conv_grad_tol_;
+  int conv_patience_;
+  size_t conv_sample_;
+  hazy::util::CheckpointWriter *checkpoint_; //!< see SetCheckpoint()
+  int checkpoint_every_;
+  int start_epoch_; //!< see SetStartEpoch()
+  RunResult result_; //!< see Result()
+
+  //! How RunScoredExperiment() scores an epoch
+  enum Scored { kScoredNone, kScoredSample, kScoredFull };
+
+  //! RunExperiment() scored by hook, which is Exec::ComputeAccuracy
+  template <class TrainScan, class TestScan, class Example>
+  bool RunScoredExperiment(int nepochs, hazy::util::Clock &wall_clock,
+                           TrainScan &trscan, TestScan &tescan,
+                           double target_accuracy,
+                           int (*hook)(const Example&, const Model&));
+
+  //! Adds the scores of an epoch to its metrics, train is NULL if not scored
+  void ScoreMetrics(hazy::util::MetricsRecord &rec, double eval_time,
+                    Confusion const *train, Confusion const &test);
+
+  /*! \brief Starts the metrics of the epoch UpdateModel() just trained
+   * Call before Exec::PostEpoch, which may reset what Exec reports.
+   */
+  void TrainMetrics(int epoch, double wall_clock, double epoch_time,
+                    hazy::util::MetricsRecord &rec,
+                    std::vector<hazy::util::MetricsRecord> &threads);
+
+  //! Writes the metrics of an epoch, with its evaluation added to rec
+  void WriteMetrics(hazy::util::MetricsRecord &rec,
+                    std::vector<hazy::util::MetricsRecord> const &threads);
+
+  /*! \brief Writes the "result" record of a run that stopped early
+   * \param reason target when it reached its target, converged when it
+   *  plateaued, see SetConvergence()
+   */
+  void ResultMetrics(int epoch, double train_time, double eval_time,
+                     char const *reason);
+
+  //! Prints the "converge:" line of an epoch, see SetConvergence()
+  void PrintConvergence(int epoch, double obj, double decrease,
+                        double grad_norm, int flat);
 
   /*! set the res_ to be all zeros
    */
@@ -2,22 +2,37 @@
 #ifndef HAZY_HOGWILD_HOGWILD_TASK_H
 #define HAZY_HOGWILD_HOGWILD_TASK_H
 
+#include <cstddef>
+#include <stdint.h>
+
 #include "hazy/vector/fvector.h"
 
 namespace hazy {
 namespace hogwild {
 
+/*! \brief An index in the permutation of an ExampleBlock
+ * 32 bits, SimpleRandom::LazyPODShuffle() shuffles at most 2^32 examples,
+ * which halves the permutation read along with the examples.
+ */
+typedef uint32_t perm_type;
+
 template <class Example>
 struct ExampleBlock {
     vector::FVector<Example> ex;
-    vector::FVector<size_t> perm;
+    vector::FVector<perm_type> perm;
 };
 
+class ChunkScheduler;
+
 template <class Model, class Params, class Example>
 struct HogwildTask {
   Model *model;
   Params *params;
   ExampleBlock<Example> *block;
+  //! Hands out ranges of block to the threads, NULL for a static split
+  ChunkScheduler *sched;
+
+  HogwildTask() : model(NULL), params(NULL), block(NULL), sched(NULL) { }
 };
 
 } // namespace hogwild
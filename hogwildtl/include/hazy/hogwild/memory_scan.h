@@ -16,6 +16,9 @@
 #ifndef HAZY_HOGWILD_HOGWILD_FILE_SCAN_H
 #define HAZY_HOGWILD_HOGWILD_FILE_SCAN_H
 
+#include <cstdio>
+#include <cstdlib>
+
 #include "hazy/util/simple_random-inl.h"
 
 #include "hazy/vector/fvector.h"
@@ -26,25 +29,34 @@ namespace hazy {
 namespace hogwild {
 
 /*! \brief A simple scanner that permutes examples stored in memroy.
- * Returns all examples in a single page
+ * Returns all examples in a single page. The permutation is allocated once,
+ * and only shuffled for the passes whose order matters.
  */
 template <class Example>
 class MemoryScan {
  public:
   /*! \brief Makes a new scanner over the given vector of examples
+   * \param shuffle false to always return the examples in order, e.g. for
+   *  a test set
    */
-  MemoryScan(vector::FVector<Example> &fv) { 
+  MemoryScan(vector::FVector<Example> &fv, bool shuffle = true) :
+      shuffle_(shuffle), permute_(shuffle) { 
+    if (fv.size > UINT32_MAX) {
+      printf("%lu examples, at most 2^32 - 1 can be permuted\n", fv.size);
+      exit(-1);
+    }
     blk_.ex.size = fv.size;
     blk_.ex.values = fv.values;
-    blk_.perm.size = 0;
-    blk_.perm.values = NULL;
+    blk_.perm.size = fv.size;
+    blk_.perm.values = new perm_type[fv.size];
+    for (size_t i = 0; i < fv.size; i++) {
+      blk_.perm.values[i] = i;
+    }
     has_next_ = true;
   }
 
   ~MemoryScan() {
-    if (blk_.perm.values != NULL) {
-      delete [] blk_.perm.values;
-    }
+    delete [] blk_.perm.values;
   }
   
   /*! \brief returns true if there it is valid to call Next()
@@ -55,34 +67,46 @@ class MemoryScan {
    * First permutes the block of examples and the returns the block
    */
   ExampleBlock<Example>& Next() {
-
-    size_t size = blk_.ex.size;
-
-    if (blk_.perm.values != NULL) {
-      delete [] blk_.perm.values;
-      blk_.perm.values = NULL;
-    }
-    blk_.perm.size = size;
-    blk_.perm.values = new size_t[size];
-    for (size_t i = 0; i < size; i++) {
-      blk_.perm.values[i] = i;
+    if (permute_) {
+      size_t size = blk_.ex.size;
+      for (size_t i = 0; i < size; i++) {
+        blk_.perm.values[i] = i;
+      }
+      util::SimpleRandom &rand = util::SimpleRandom::GetInstance();
+      rand.LazyPODShuffle(blk_.perm.values, size);
     }
-
-    util::SimpleRandom &rand = util::SimpleRandom::GetInstance();
-    rand.LazyPODShuffle(blk_.perm.values, size);
     has_next_ = false;
     return blk_;
   }
 
   /*! \brief Resets the scanner to the begining.
    */
-  void Reset() { has_next_ = true; }
+  void Reset() {
+    has_next_ = true;
+    permute_ = shuffle_;
+  }
+
+  /*! \brief Resets the scanner for a pass whose order does not matter
+   * The next Next() keeps the last permutation.
+   */
+  void ResetUnshuffled() {
+    has_next_ = true;
+    permute_ = false;
+  }
 
  private:
   ExampleBlock<Example> blk_;
   bool has_next_;
+  bool shuffle_; //!< see MemoryScan()
+  bool permute_; //!< the next Next() shuffles
 };
 
+//! Resets scan without shuffling it, see ResetUnshuffled() in hogwild-inl.h
+template <class Example>
+void ResetUnshuffled(MemoryScan<Example> &scan) {
+  scan.ResetUnshuffled();
+}
+
 } // namespace hogwild
 } // namespace hazy
 #endif
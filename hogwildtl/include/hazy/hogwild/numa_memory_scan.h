@@ -20,8 +20,10 @@
 #include <sched.h>
 #include <cstdio>
 #include <cstdlib>
+#include <vector>
 
 #include "hazy/util/simple_random-inl.h"
+#include "hazy/util/numa_alloc.h"
 
 #include "hazy/vector/fvector.h"
 #include "hazy/thread/thread_pool-inl.h"
@@ -31,31 +33,48 @@ namespace hazy {
 namespace hogwild {
 
 /*! \brief A simple scanner that permutes examples stored in memroy.
- * Returns all examples in a single page
+ * Returns all examples in a single page. The permutation of each node is
+ * allocated once, and only shuffled for the passes whose order matters.
  */
 template <class Example>
 class NumaMemoryScan {
  public:
   /*! \brief Makes a new scanner over the given vector of examples
+   * \param node_fv the examples of each node
+   * \param node_size number of nodes
+   * \param huge_pages pages of the permutations, one of util::HugePages
+   * \param shuffle false to always return the examples in order, e.g. for
+   *  a test set
    */
-  NumaMemoryScan(vector::FVector<Example> *node_fv, unsigned node_size) : node_size(node_size) { 
+  NumaMemoryScan(vector::FVector<Example> *node_fv, unsigned node_size,
+                 int huge_pages = util::kHugePagesNone, bool shuffle = true) :
+      node_size(node_size), huge_pages_(huge_pages), shuffle_(shuffle),
+      permute_(shuffle) { 
     node_blk_ = new ExampleBlock<Example>[node_size];
     for (unsigned i = 0; i < node_size; ++i) {
       ExampleBlock<Example> &blk_ = node_blk_[i];
       blk_.ex.size = node_fv[i].size;
       blk_.ex.values = node_fv[i].values;
       printf("Examples Block %d at %p, values at %p\n", i, &blk_, blk_.ex.values);
-      blk_.perm.size = 0;
-      blk_.perm.values = NULL;
+      if (blk_.ex.size > UINT32_MAX) {
+        printf("%lu examples, at most 2^32 - 1 can be permuted\n", blk_.ex.size);
+        exit(-1);
+      }
+      // the permutation of each node is bound to it, and reused every epoch
+      blk_.perm.size = blk_.ex.size;
+      blk_.perm.values = static_cast<perm_type*>(util::NumaAlloc(
+          sizeof(perm_type) * blk_.perm.size, i, huge_pages_));
+      for (size_t k = 0; k < blk_.perm.size; k++) {
+        blk_.perm.values[k] = k;
+      }
     }
     has_next_ = true;
   }
 
   ~NumaMemoryScan() {
     for (unsigned i = 0; i < node_size; ++i) {
-      if (node_blk_[i].perm.values != NULL) {
-	delete [] node_blk_[i].perm.values;
-      }
+      util::NumaFree(node_blk_[i].perm.values,
+                     sizeof(perm_type) * node_blk_[i].perm.size, huge_pages_);
     }
     delete [] node_blk_;
   }
@@ -68,37 +87,22 @@ class NumaMemoryScan {
    * First permutes the block of examples and the returns the block
    */
   ExampleBlock<Example>& Next() {
-    // Only generate the permutation once
-    numa_set_preferred(0);
-    ExampleBlock<Example> &blk0_ = node_blk_[0];
-    size_t size = blk0_.ex.size;
-    if (blk0_.perm.values != NULL) {
-      delete [] blk0_.perm.values;
-      blk0_.perm.values = NULL;
-    }
-    blk0_.perm.size = size;
-    blk0_.perm.values = new size_t[size];
-    for (size_t i = 0; i < size; i++) {
-      blk0_.perm.values[i] = i;
-    }
-    util::SimpleRandom &rand = util::SimpleRandom::GetInstance();
-    rand.LazyPODShuffle(blk0_.perm.values, size);
-    // Copy this permutation to other nodes
-    for (unsigned node = 1; node < node_size; ++node) {
-      numa_set_preferred(node);
-      ExampleBlock<Example> &blk_ = node_blk_[node];
-      size = blk_.ex.size;
-
-      if (blk_.perm.values != NULL) {
-	delete [] blk_.perm.values;
-	blk_.perm.values = NULL;
+    if (permute_) {
+      // Only generate the permutation once
+      ExampleBlock<Example> &blk0_ = node_blk_[0];
+      size_t size = blk0_.ex.size;
+      for (size_t i = 0; i < size; i++) {
+        blk0_.perm.values[i] = i;
+      }
+      util::SimpleRandom &rand = util::SimpleRandom::GetInstance();
+      rand.LazyPODShuffle(blk0_.perm.values, size);
+      // Copy this permutation to other nodes
+      for (unsigned node = 1; node < node_size; ++node) {
+        ExampleBlock<Example> &blk_ = node_blk_[node];
+        std::memcpy(blk_.perm.values, blk0_.perm.values, blk_.perm.size * sizeof(perm_type));
       }
-      blk_.perm.size = size;
-      blk_.perm.values = new size_t[size];
-      std::memcpy(blk_.perm.values, blk0_.perm.values, size * sizeof(size_t));
     }
     has_next_ = false;
-    numa_set_preferred(-1);
     return node_blk_[0];
   }
 
@@ -106,14 +110,52 @@ class NumaMemoryScan {
    */
   void Reset() { 
     has_next_ = true;
+    permute_ = shuffle_;
+  }
+
+  /*! \brief Resets the scanner for a pass whose order does not matter
+   * The next Next() keeps the last permutation.
+   */
+  void ResetUnshuffled() {
+    has_next_ = true;
+    permute_ = false;
+  }
+
+  //! Number of nodes, each with a copy of the examples
+  unsigned NodeCount() const { return node_size; }
+
+  //! The examples of a node, not permuted
+  vector::FVector<Example> const & NodeExamples(unsigned node) const {
+    return node_blk_[node].ex;
   }
 
  private:
   ExampleBlock<Example> * node_blk_;
   bool has_next_;
   unsigned node_size;
+  int huge_pages_; //!< pages of the permutations
+  bool shuffle_; //!< see NumaMemoryScan()
+  bool permute_; //!< the next Next() shuffles
 };
 
+//! Resets scan without shuffling it, see ResetUnshuffled() in hogwild-inl.h
+template <class Example>
+void ResetUnshuffled(NumaMemoryScan<Example> &scan) {
+  scan.ResetUnshuffled();
+}
+
+/*! \brief The examples of every node, without permuting them
+ * \return the number of copies in blocks, one per node
+ */
+template <class Example>
+unsigned ScanBlocks(NumaMemoryScan<Example> &scan,
+                    std::vector<vector::FVector<Example> > &blocks) {
+  for (unsigned node = 0; node < scan.NodeCount(); ++node) {
+    blocks.push_back(scan.NodeExamples(node));
+  }
+  return scan.NodeCount();
+}
+
 } // namespace hogwild
 } // namespace hazy
 #endif
@@ -0,0 +1,247 @@
+// Copyright 2012 Victor Bittorf, Chris Re
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Hogwild!, part of the Hazy Project
+// Author : Victor Bittorf (bittorf [at] cs.wisc.edu)
+// Original Hogwild! Author: Chris Re (chrisre [at] cs.wisc.edu)
+
+#ifndef HAZY_HOGWILD_SCALING_REPORT_H
+#define HAZY_HOGWILD_SCALING_REPORT_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "hazy/util/metrics.h"
+#include "hazy/hogwild/hogwild.h"
+
+namespace hazy {
+namespace hogwild {
+
+/*! \brief Summarizes the runs of a sweep over thread counts
+ * Each configuration gets the medians of its runs: epoch time, examples
+ * per second and, over the runs that reached the target, the time to it.
+ * Speedups are relative to the configuration with the fewest threads (1
+ * if it was run) and the same parameters, the cluster size aside.
+ */
+class ScalingReport {
+ public:
+  //! Parameters of a configuration other than its threads and cluster size
+  typedef std::vector<std::pair<std::string, double> > Params;
+
+  //! Starts a configuration, AddRun() then adds its runs
+  void AddConfig(unsigned threads, int cluster_size, Params const &params) {
+    Config c;
+    c.threads = threads;
+    c.cluster_size = cluster_size;
+    c.params = params;
+    configs_.push_back(c);
+  }
+
+  void AddRun(RunResult const &r) {
+    if (configs_.empty() || r.epochs == 0) {
+      return;
+    }
+    Config &c = configs_.back();
+    c.epoch_time.push_back(r.train_time / r.epochs);
+    c.per_sec.push_back(r.train_time > 0 ? r.examples / r.train_time : 0.0);
+    c.epochs.push_back(r.epochs);
+    c.test_acc.push_back(r.test_acc);
+    if (r.reached) {
+      c.time_to_target.push_back(r.train_time);
+    }
+  }
+
+  //! Prints a "scaling:" line per configuration
+  void Print() const {
+    for (size_t i = 0; i < configs_.size(); ++i) {
+      Row row = Summarize(i);
+      if (row.runs == 0) {
+        continue;
+      }
+      printf("scaling: threads: %u c: %d%s runs: %lu epoch_time: %.5f "
+             "per_sec: %.5g speedup: %.3f time_to_target: %.5f "
+             "target_speedup: %.3f reached: %lu\n",
+             configs_[i].threads, configs_[i].cluster_size,
+             ParamString(configs_[i], " ", ": ").c_str(), row.runs,
+             row.epoch_time, row.per_sec, row.speedup, row.time_to_target,
+             row.target_speedup, row.reached);
+    }
+    fflush(stdout);
+  }
+
+  //! A "scaling" record per configuration, missing values are null
+  void WriteMetrics(util::MetricsSink &sink) const {
+    for (size_t i = 0; i < configs_.size(); ++i) {
+      Row row = Summarize(i);
+      if (row.runs == 0) {
+        continue;
+      }
+      Config const &c = configs_[i];
+      util::MetricsRecord rec("scaling");
+      rec.Add("config", i);
+      rec.Add("threads", c.threads);
+      rec.Add("cluster_size", c.cluster_size);
+      for (size_t p = 0; p < c.params.size(); ++p) {
+        rec.Add(c.params[p].first.c_str(), c.params[p].second);
+      }
+      rec.Add("runs", row.runs);
+      rec.Add("epochs", row.epochs);
+      rec.Add("epoch_time", row.epoch_time);
+      rec.Add("examples_per_sec", row.per_sec);
+      rec.Add("baseline_threads", row.baseline_threads);
+      rec.Add("speedup", row.speedup);
+      rec.Add("reached", row.reached);
+      rec.Add("time_to_target", row.time_to_target);
+      rec.Add("target_speedup", row.target_speedup);
+      rec.Add("test_acc", row.test_acc);
+      sink.Write(rec);
+    }
+  }
+
+  //! Writes a CSV with a header line, prints why and returns false if it cannot
+  bool WriteCSV(std::string const &path) const {
+    FILE *f = fopen(path.c_str(), "w");
+    if (f == NULL) {
+      perror(("Cannot open " + path).c_str());
+      return false;
+    }
+    fprintf(f, "config,threads,cluster_size");
+    if (!configs_.empty()) {
+      fprintf(f, "%s", ParamString(configs_[0], ",", "").c_str());
+    }
+    fprintf(f, ",runs,epochs,epoch_time,examples_per_sec,baseline_threads,"
+               "speedup,reached,time_to_target,target_speedup,test_acc\n");
+    for (size_t i = 0; i < configs_.size(); ++i) {
+      Row row = Summarize(i);
+      if (row.runs == 0) {
+        continue;
+      }
+      Config const &c = configs_[i];
+      fprintf(f, "%lu,%u,%d", i, c.threads, c.cluster_size);
+      for (size_t p = 0; p < c.params.size(); ++p) {
+        fprintf(f, ",%g", c.params[p].second);
+      }
+      fprintf(f, ",%lu,%s,%s,%s,%u,%s,%lu,%s,%s,%s\n", row.runs,
+              Number(row.epochs).c_str(), Number(row.epoch_time).c_str(),
+              Number(row.per_sec).c_str(), row.baseline_threads,
+              Number(row.speedup).c_str(), row.reached,
+              Number(row.time_to_target).c_str(),
+              Number(row.target_speedup).c_str(), Number(row.test_acc).c_str());
+    }
+    if (fclose(f) != 0) {
+      perror(("Cannot write " + path).c_str());
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  struct Config {
+    unsigned threads;
+    int cluster_size;
+    Params params;
+    std::vector<double> epoch_time; //!< of each run
+    std::vector<double> per_sec;
+    std::vector<double> epochs;
+    std::vector<double> test_acc;
+    std::vector<double> time_to_target; //!< of the runs that reached it
+  };
+
+  //! The medians of a configuration, NAN when there is nothing to report
+  struct Row {
+    size_t runs, reached;
+    double epochs, epoch_time, per_sec, time_to_target, test_acc;
+    unsigned baseline_threads;
+    double speedup, target_speedup;
+  };
+
+  static double Median(std::vector<double> v) {
+    if (v.empty()) {
+      return NAN;
+    }
+    size_t mid = v.size() / 2;
+    std::nth_element(v.begin(), v.begin() + mid, v.end());
+    double m = v[mid];
+    if (v.size() % 2 == 0) {
+      m = (m + *std::max_element(v.begin(), v.begin() + mid)) / 2;
+    }
+    return m;
+  }
+
+  //! An empty CSV field for NAN
+  static std::string Number(double v) {
+    if (!std::isfinite(v)) {
+      return "";
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.9g", v);
+    return buf;
+  }
+
+  //! The parameters as sep name kv value ..., or sep name ... without kv
+  static std::string ParamString(Config const &c, char const *sep,
+                                 char const *kv) {
+    std::string s;
+    for (size_t p = 0; p < c.params.size(); ++p) {
+      s += sep;
+      s += c.params[p].first;
+      if (*kv != '\0') {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%s%g", kv, c.params[p].second);
+        s += buf;
+      }
+    }
+    return s;
+  }
+
+  //! The configuration the speedups of config i are relative to
+  size_t Baseline(size_t i) const {
+    size_t best = i;
+    for (size_t j = 0; j < configs_.size(); ++j) {
+      if (configs_[j].params == configs_[i].params &&
+          !configs_[j].epoch_time.empty() &&
+          configs_[j].threads < configs_[best].threads) {
+        best = j;
+      }
+    }
+    return best;
+  }
+
+  Row Summarize(size_t i) const {
+    Config const &c = configs_[i];
+    Row row;
+    row.runs = c.epoch_time.size();
+    row.reached = c.time_to_target.size();
+    row.epochs = Median(c.epochs);
+    row.epoch_time = Median(c.epoch_time);
+    row.per_sec = Median(c.per_sec);
+    row.time_to_target = Median(c.time_to_target);
+    row.test_acc = Median(c.test_acc);
+    Config const &base = configs_[Baseline(i)];
+    row.baseline_threads = base.threads;
+    row.speedup = Median(base.epoch_time) / row.epoch_time;
+    row.target_speedup = Median(base.time_to_target) / row.time_to_target;
+    return row;
+  }
+
+  std::vector<Config> configs_;
+};
+
+} // namespace hogwild
+} // namespace hazy
+#endif
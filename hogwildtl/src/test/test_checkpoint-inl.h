@@ -0,0 +1,169 @@
+#ifndef HOGWILD_TEST_CHECKPOINT_INL_H
+#define HOGWILD_TEST_CHECKPOINT_INL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "hazy/util/checkpoint.h"
+
+using hazy::util::Checkpoint;
+using hazy::util::CheckpointHeader;
+using hazy::util::CheckpointWriter;
+using hazy::util::SimpleRandom;
+using hazy::util::kCheckpointDataOffset;
+
+//! A path in /tmp, removed with the temporary file of the writer
+class CheckpointTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char name[] = "/tmp/hogwild_ckpt_XXXXXX";
+    int fd = mkstemp(name);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    path_ = name;
+  }
+
+  virtual void TearDown() {
+    unlink(path_.c_str());
+    unlink((path_ + ".tmp").c_str());
+  }
+
+  //! Writes nreplicas of dim weights, replica r holding r * 100 + i
+  void Save(size_t nreplicas, size_t dim) {
+    weights_.assign(nreplicas, std::vector<double>(dim));
+    std::vector<double const *> replicas;
+    for (size_t r = 0; r < nreplicas; r++) {
+      for (size_t i = 0; i < dim; i++) {
+        weights_[r][i] = r * 100.0 + i;
+      }
+      replicas.push_back(&weights_[r][0]);
+    }
+    CheckpointWriter writer(path_);
+    writer.Save("svm", 7, 0.25, replicas, dim);
+    ASSERT_TRUE(writer.Wait());
+  }
+
+  //! Writes a header and values weights as is
+  void WriteRaw(CheckpointHeader const &h, size_t values) {
+    std::vector<char> buf(kCheckpointDataOffset + values * sizeof(double), 0);
+    memcpy(&buf[0], &h, sizeof(h));
+    FILE *f = fopen(path_.c_str(), "wb");
+    ASSERT_TRUE(f != NULL);
+    ASSERT_EQ(buf.size(), fwrite(&buf[0], 1, buf.size(), f));
+    fclose(f);
+  }
+
+  //! A valid header of CheckpointWriter
+  static CheckpointHeader MakeHeader(uint64_t replicas, uint64_t dim) {
+    CheckpointHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "HOGCKPT", 8);
+    h.version = hazy::util::kCheckpointVersion;
+    h.value_size = sizeof(double);
+    strncpy(h.model, "svm", sizeof(h.model) - 1);
+    h.replicas = replicas;
+    h.dim = dim;
+    return h;
+  }
+
+  std::string path_;
+  std::vector<std::vector<double> > weights_;
+};
+
+TEST_F(CheckpointTest, WriteOpenRestore) {
+  SimpleRandom::SetSeed(1234);
+  unsigned seed;
+  unsigned short drand[3];
+  SimpleRandom::GetState(seed, drand);
+  Save(3, 10);
+
+  Checkpoint ckpt;
+  ASSERT_TRUE(ckpt.Open(path_));
+  ASSERT_EQ(0, strcmp("svm", ckpt.Header().model));
+  ASSERT_EQ(3u, ckpt.Replicas());
+  ASSERT_EQ(10u, ckpt.Dim());
+  ASSERT_EQ(7, ckpt.Epoch());
+  ASSERT_EQ(0.25, ckpt.StepSize());
+
+  // as many replicas: each gets its own
+  for (size_t r = 0; r < 3; r++) {
+    std::vector<double> out(10, -1);
+    ckpt.Restore(r, 3, &out[0]);
+    ASSERT_EQ(weights_[r], out);
+  }
+
+  SimpleRandom::SetSeed(99);
+  ckpt.RestoreRandom();
+  unsigned seed2;
+  unsigned short drand2[3];
+  SimpleRandom::GetState(seed2, drand2);
+  ASSERT_EQ(seed, seed2);
+  ASSERT_EQ(0, memcmp(drand, drand2, sizeof(drand)));
+}
+
+TEST_F(CheckpointTest, RestoreAverages) {
+  Save(3, 10);
+  Checkpoint ckpt;
+  ASSERT_TRUE(ckpt.Open(path_));
+  // another replica count, e.g. restarted on other nodes: the average
+  for (size_t nreplicas = 1; nreplicas < 5; nreplicas += 3) {
+    std::vector<float> out(10, -1);
+    ckpt.Restore(0, nreplicas, &out[0]);
+    for (size_t i = 0; i < 10; i++) {
+      ASSERT_FLOAT_EQ(100.0f + i, out[i]);
+    }
+  }
+}
+
+TEST_F(CheckpointTest, Truncated) {
+  Save(2, 100);
+  // the last weight is cut
+  ASSERT_EQ(0, truncate(path_.c_str(),
+                        kCheckpointDataOffset + 199 * sizeof(double)));
+  Checkpoint ckpt;
+  ASSERT_FALSE(ckpt.Open(path_));
+  // not even a header
+  ASSERT_EQ(0, truncate(path_.c_str(), sizeof(CheckpointHeader)));
+  ASSERT_FALSE(ckpt.Open(path_));
+  ASSERT_EQ(0, truncate(path_.c_str(), 0));
+  ASSERT_FALSE(ckpt.Open(path_));
+}
+
+TEST_F(CheckpointTest, OverflowingHeader) {
+  Checkpoint ckpt;
+  WriteRaw(MakeHeader(2, 4), 8);
+  ASSERT_TRUE(ckpt.Open(path_));
+  // replicas * dim wraps around to 0, it must not pass for 8 weights
+  WriteRaw(MakeHeader(1ULL << 63, 2), 8);
+  ASSERT_FALSE(ckpt.Open(path_));
+  WriteRaw(MakeHeader(1ULL << 32, 1ULL << 32), 8);
+  ASSERT_FALSE(ckpt.Open(path_));
+  WriteRaw(MakeHeader(1, ~0ULL), 8);
+  ASSERT_FALSE(ckpt.Open(path_));
+  WriteRaw(MakeHeader(1, 0), 8);
+  ASSERT_FALSE(ckpt.Open(path_));
+}
+
+TEST_F(CheckpointTest, NotACheckpoint) {
+  Checkpoint ckpt;
+  CheckpointHeader h = MakeHeader(1, 8);
+  h.magic[0] = 'X';
+  WriteRaw(h, 8);
+  ASSERT_FALSE(ckpt.Open(path_));
+  h = MakeHeader(1, 8);
+  h.version = hazy::util::kCheckpointVersion + 1;
+  WriteRaw(h, 8);
+  ASSERT_FALSE(ckpt.Open(path_));
+  h = MakeHeader(1, 8);
+  h.value_size = sizeof(float);
+  WriteRaw(h, 8);
+  ASSERT_FALSE(ckpt.Open(path_));
+}
+
+#endif
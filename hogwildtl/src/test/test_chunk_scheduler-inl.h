@@ -0,0 +1,96 @@
+#ifndef HOGWILD_TEST_CHUNK_SCHEDULER_INL_H
+#define HOGWILD_TEST_CHUNK_SCHEDULER_INL_H
+
+#include <unistd.h>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "hazy/hogwild/freeforall-inl.h"
+#include "hazy/thread/thread_pool-inl.h"
+
+//! Counts how many times each index of a block is run
+struct ChunkCounts {
+  hazy::hogwild::ChunkScheduler *sched; //!< NULL for the static split
+  std::vector<int> runs; //!< per index
+  std::vector<size_t> done; //!< per thread
+  unsigned slow; //!< this thread sleeps after each chunk
+};
+
+static void RunChunks(ChunkCounts &c, unsigned tid, unsigned total) {
+  hazy::hogwild::ExampleRanges ranges(c.sched, c.runs.size(), tid, total);
+  size_t start, end;
+  while (ranges.Next(start, end)) {
+    for (size_t i = start; i < end; i++) {
+      __sync_fetch_and_add(&c.runs[i], 1);
+    }
+    c.done[tid] += end - start;
+    if (tid == c.slow) {
+      usleep(2000);
+    }
+  }
+}
+
+class ChunkSchedulerTest : public ::testing::TestWithParam<size_t> {
+};
+
+TEST_P(ChunkSchedulerTest, EveryIndexOnce) {
+  size_t const size = GetParam();
+  unsigned const nthreads = 4;
+  hazy::thread::ThreadPool tpool(nthreads);
+  tpool.Init();
+  hazy::hogwild::ChunkScheduler sched;
+  sched.Init(tpool);
+
+  ChunkCounts c;
+  c.sched = &sched;
+  c.slow = 0;
+  // several blocks, as FFAScan resets the scheduler for each
+  for (int block = 0; block < 3; block++) {
+    c.runs.assign(size + block, 0);
+    c.done.assign(nthreads, 0);
+    sched.Reset(c.runs.size());
+    tpool.Execute(c, RunChunks);
+    tpool.Wait();
+    for (size_t i = 0; i < c.runs.size(); i++) {
+      ASSERT_EQ(1, c.runs[i]) << "index " << i << " of " << c.runs.size();
+    }
+    size_t total = 0;
+    for (unsigned t = 0; t < nthreads; t++) {
+      total += c.done[t];
+    }
+    ASSERT_EQ(c.runs.size(), total);
+    if (size >= 1000) {
+      // the others took most of the share of the sleeping thread
+      ASSERT_LT(c.done[c.slow], c.runs.size() / nthreads);
+    }
+  }
+  tpool.Join();
+}
+
+INSTANTIATE_TEST_SUITE_P(Sizes, ChunkSchedulerTest,
+                         ::testing::Values(0, 1, 3, 64, 1000, 100003));
+
+TEST(ExampleRanges, StaticSplit) {
+  unsigned const nthreads = 3;
+  hazy::thread::ThreadPool tpool(nthreads);
+  tpool.Init();
+  ChunkCounts c;
+  c.sched = NULL;
+  c.slow = nthreads;
+  c.runs.assign(1001, 0);
+  c.done.assign(nthreads, 0);
+  tpool.Execute(c, RunChunks);
+  tpool.Wait();
+  for (size_t i = 0; i < c.runs.size(); i++) {
+    ASSERT_EQ(1, c.runs[i]);
+  }
+  for (unsigned t = 0; t < nthreads; t++) {
+    ASSERT_EQ(hazy::hogwild::GetEndIndex(c.runs.size(), t, nthreads) -
+              hazy::hogwild::GetStartIndex(c.runs.size(), t, nthreads),
+              c.done[t]);
+  }
+  tpool.Join();
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef HOGWILD_TEST_CPU_LIST_INL_H
+#define HOGWILD_TEST_CPU_LIST_INL_H
+
+#include <numa.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "hazy/thread/thread_pool-inl.h"
+
+using hazy::thread::ThreadPool;
+
+TEST(ParseCPUList, Valid) {
+  std::vector<int> cpus = ThreadPool::ParseCPUList("0-3,8-11");
+  int const want[] = {0, 1, 2, 3, 8, 9, 10, 11};
+  ASSERT_EQ(std::vector<int>(want, want + 8), cpus);
+
+  cpus = ThreadPool::ParseCPUList("5");
+  ASSERT_EQ(1u, cpus.size());
+  ASSERT_EQ(5, cpus[0]);
+
+  // the order of the list is kept, it is the placement order
+  cpus = ThreadPool::ParseCPUList("6,2-3,0");
+  int const order[] = {6, 2, 3, 0};
+  ASSERT_EQ(std::vector<int>(order, order + 4), cpus);
+
+  cpus = ThreadPool::ParseCPUList("4-4");
+  ASSERT_EQ(1u, cpus.size());
+  ASSERT_EQ(4, cpus[0]);
+
+  ASSERT_TRUE(ThreadPool::ParseCPUList("").empty());
+}
+
+TEST(ParseCPUList, LastPossibleCPU) {
+  std::stringstream last, past;
+  last << numa_num_possible_cpus() - 1;
+  past << numa_num_possible_cpus();
+  ASSERT_EQ(1u, ThreadPool::ParseCPUList(last.str()).size());
+  ASSERT_TRUE(ThreadPool::ParseCPUList(past.str()).empty());
+  ASSERT_TRUE(ThreadPool::ParseCPUList("0-" + past.str()).empty());
+}
+
+TEST(ParseCPUList, Malformed) {
+  char const *lists[] = {
+    "3-1", "1x", "1-2junk", "0-", "-1", "1,,2", " 1", "+1", "1-+2", "1- 2",
+    "a", ",", "0-3,8-", "99999999999999999999999",
+  };
+  for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+    ASSERT_TRUE(ThreadPool::ParseCPUList(lists[i]).empty()) << lists[i];
+  }
+}
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef HOGWILD_TEST_DELTA_CODEC_INL_H
+#define HOGWILD_TEST_DELTA_CODEC_INL_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "numasvm/delta_codec.h"
+
+using namespace hazy::hogwild::svm;
+
+//! A delta of mixed magnitudes, some of them below the tolerance
+static void FillDelta(DeltaExchange &ex, unsigned seed) {
+  for (unsigned i = 0; i < ex.dim; i++) {
+    unsigned h = (i + 1) * 2654435761u ^ seed;
+    ex.delta[i] = ((int) (h % 2001) - 1000) * 1e-3 * ((i % 7) + 1);
+  }
+}
+
+TEST(DeltaExchange, Q8RoundTrip) {
+  // the last block is partial
+  unsigned const dim = 3 * kQ8BlockSize + 17;
+  DeltaExchange src, dst;
+  src.Allocate(dim, kCompressQ8, 0, 1);
+  dst.Allocate(dim, kCompressQ8, 0, 2);
+  FillDelta(src, 7);
+  // one block stays below the tolerance
+  for (unsigned i = kQ8BlockSize; i < 2 * kQ8BlockSize; i++) {
+    src.delta[i] = 1e-6;
+  }
+  std::vector<double> orig(src.delta, src.delta + dim);
+
+  size_t sent;
+  size_t bytes = EncodeDelta(src, dst, 1e-4, sent);
+  ASSERT_EQ(1, dst.pending);
+  ASSERT_EQ(dim - kQ8BlockSize, sent);
+  ASSERT_EQ(sent + sizeof(float) * dst.nblocks, bytes);
+  ASSERT_EQ(0.0f, dst.scales[1]);
+
+  std::vector<double> w(dim, 0.0);
+  DrainDelta(dst, &w[0], 1.0);
+  ASSERT_EQ(0, dst.pending);
+  for (unsigned i = 0; i < dim; i++) {
+    // the receiver sees what the sender decoded, the rest is the residual
+    ASSERT_DOUBLE_EQ(src.decoded[i], w[i]);
+    ASSERT_NEAR(orig[i], src.decoded[i] + src.delta[i], 1e-12);
+    float const scale = dst.scales[i / kQ8BlockSize];
+    if (scale != 0) {
+      ASSERT_LE(fabs(src.delta[i]), scale + 1e-12);
+    }
+  }
+  for (unsigned i = kQ8BlockSize; i < 2 * kQ8BlockSize; i++) {
+    ASSERT_EQ(0.0, w[i]);
+    ASSERT_EQ(orig[i], src.delta[i]);
+  }
+}
+
+TEST(DeltaExchange, Q8ErrorFeedback) {
+  unsigned const dim = 2 * kQ8BlockSize;
+  DeltaExchange src, dst;
+  src.Allocate(dim, kCompressQ8, 0, 3);
+  dst.Allocate(dim, kCompressQ8, 0, 4);
+  FillDelta(src, 11);
+  std::vector<double> orig(src.delta, src.delta + dim);
+
+  // sending the residual again and again delivers the whole delta
+  std::vector<double> w(dim, 0.0);
+  double last = HUGE_VAL;
+  for (int round = 0; round < 4; round++) {
+    size_t sent;
+    EncodeDelta(src, dst, 0, sent);
+    DrainDelta(dst, &w[0], 0.5);
+    double residual = 0;
+    for (unsigned i = 0; i < dim; i++) {
+      ASSERT_NEAR(0.5 * orig[i], w[i] + 0.5 * src.delta[i], 1e-12);
+      residual = std::max(residual, fabs(src.delta[i]));
+    }
+    ASSERT_LT(residual, last);
+    last = residual;
+  }
+}
+
+TEST(DeltaExchange, TopKRoundTrip) {
+  unsigned const dim = 1000;
+  DeltaExchange src, dst;
+  src.Allocate(dim, kCompressTopK, 0.05, 1);
+  dst.Allocate(dim, kCompressTopK, 0.05, 2);
+  ASSERT_EQ(50u, dst.capacity);
+  FillDelta(src, 5);
+  std::vector<double> orig(src.delta, src.delta + dim);
+  std::vector<double> mag(dim);
+  for (unsigned i = 0; i < dim; i++) {
+    mag[i] = fabs(orig[i]);
+  }
+  std::sort(mag.begin(), mag.end());
+
+  size_t sent;
+  size_t bytes = EncodeDelta(src, dst, 0, sent);
+  ASSERT_EQ(50u, sent);
+  ASSERT_EQ(sent, dst.count);
+  ASSERT_EQ(sent * (sizeof(uint32_t) + sizeof(float)), bytes);
+
+  std::vector<double> w(dim, 0.0);
+  DrainDelta(dst, &w[0], 1.0);
+  size_t nonzero = 0;
+  for (unsigned i = 0; i < dim; i++) {
+    ASSERT_DOUBLE_EQ(src.decoded[i], w[i]);
+    ASSERT_NEAR(orig[i], src.decoded[i] + src.delta[i], 1e-12);
+    if (w[i] != 0) {
+      // only the largest magnitudes are sent
+      ASSERT_GE((float) fabs(orig[i]), (float) mag[dim - 50]);
+      ASSERT_NEAR(0, src.delta[i], 1e-6);
+      nonzero++;
+    }
+  }
+  ASSERT_EQ(sent, nonzero);
+
+  // the residual goes out in the next rounds
+  for (int round = 0; round < 30; round++) {
+    EncodeDelta(src, dst, 0, sent);
+    DrainDelta(dst, &w[0], 1.0);
+  }
+  for (unsigned i = 0; i < dim; i++) {
+    ASSERT_NEAR(orig[i], w[i], 1e-6);
+  }
+}
+
+TEST(DeltaExchange, TopKTolerance) {
+  unsigned const dim = 100;
+  DeltaExchange src, dst;
+  src.Allocate(dim, kCompressTopK, 0.5, 1);
+  dst.Allocate(dim, kCompressTopK, 0.5, 2);
+  for (unsigned i = 0; i < dim; i++) {
+    src.delta[i] = i < 3 ? 1.0 : 1e-9;
+  }
+  size_t sent;
+  EncodeDelta(src, dst, 1e-6, sent);
+  ASSERT_EQ(3u, sent);
+  for (unsigned i = 3; i < dim; i++) {
+    ASSERT_EQ(1e-9, src.delta[i]);
+  }
+}
+
+#endif
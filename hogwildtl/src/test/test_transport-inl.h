@@ -0,0 +1,170 @@
+#ifndef HOGWILD_TEST_TRANSPORT_INL_H
+#define HOGWILD_TEST_TRANSPORT_INL_H
+
+#include <sched.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "numasvm/transport.h"
+
+using namespace hazy::hogwild::svm;
+
+//! How the two ranks of TrainRing() are connected
+enum RingKind { kRingShm, kRingUnix, kRingTCP };
+
+static unsigned const kRingDim = 64;
+static int const kRingRounds = 400;
+static double const kRingBeta = 0.5;
+
+//! The weights both ranks are pulled to
+static double RingTarget(unsigned i) {
+  return ((int) (i * 37 % 19) - 9) * 0.1;
+}
+
+/*! \brief A deterministic stand-in for the SGD of a rank
+ * Rank r only sees the coordinates i with i % 2 == r, the others only move
+ * with the deltas of the other rank: the rank that trains a coordinate
+ * settles on its target, and passes beta of it to the other one. The token
+ * alternates: rank r syncs in the rounds of its parity, after its local
+ * step, as a cluster of numasvm with an update_delay of one.
+ */
+static void TrainRank(Transport &transport, NumaSVMModel &m, int rank) {
+  SVMParams params(1.0, 1.0, 0, kRingBeta, 0, 2, true, 1, 0, NULL);
+  double * const w = m.weights.values;
+  transport.Reset();
+  for (int round = 0; round < kRingRounds; round++) {
+    for (unsigned i = rank; i < kRingDim; i += 2) {
+      w[i] += 0.1 * (RingTarget(i) - w[i]);
+    }
+    if (round % 2 == rank) {
+      while (!transport.TryAcquire(&m)) {
+        sched_yield();
+      }
+      size_t bytes;
+      transport.Sync(&m, NULL, params, bytes);
+      transport.Release(&m);
+    }
+  }
+}
+
+//! Runs one rank, see TrainRing(), false on error
+static bool RunRank(RingKind kind, ShmRing &ring,
+                    std::vector<std::string> const &addrs, int rank,
+                    std::vector<double> &out) {
+  NumaSVMModel m;
+  m.AllocateModel(kRingDim);
+  m.atomic_mask = 1;
+  m.atomic_inc_value = 1;
+  m.token_index = rank;
+  int token = 0; // unused, the token travels with the messages
+  bool ok;
+  if (kind == kRingShm) {
+    ring.SetRank(rank);
+    ok = ring.Attach(kRingDim);
+    if (ok) {
+      m.atomic_ptr = ring.Token();
+      ShmTransport transport(ring);
+      TrainRank(transport, m, rank);
+    }
+    ring.Detach();
+  } else {
+    SocketTransport transport(addrs, rank);
+    ok = transport.Connect(kRingDim, kCompressNone, 0);
+    if (ok) {
+      m.atomic_ptr = &token;
+      TrainRank(transport, m, rank);
+    }
+  }
+  out.assign(m.weights.values, m.weights.values + kRingDim);
+  m.FreeModel();
+  return ok;
+}
+
+/*! \brief Trains two ranks, rank 1 in a forked process
+ * \param w set to the weights of each rank
+ * \return false if a rank failed
+ */
+static bool TrainRing(RingKind kind, std::vector<double> w[2]) {
+  std::vector<std::string> addrs;
+  std::stringstream a0, a1;
+  if (kind == kRingUnix) {
+    a0 << "unix:/tmp/hogwild_ring_" << getpid() << "_0";
+    a1 << "unix:/tmp/hogwild_ring_" << getpid() << "_1";
+  } else {
+    int port = 20000 + getpid() % 20000;
+    a0 << "127.0.0.1:" << port;
+    a1 << "127.0.0.1:" << port + 1;
+  }
+  addrs.push_back(a0.str());
+  addrs.push_back(a1.str());
+  ShmRing ring(2, 0);
+  if (kind == kRingShm && !ring.Create()) {
+    return false;
+  }
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return false;
+  }
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    return false;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    std::vector<double> mine;
+    bool ok = RunRank(kind, ring, addrs, 1, mine) &&
+        write(fds[1], &mine[0], sizeof(double) * kRingDim) ==
+        (ssize_t) (sizeof(double) * kRingDim);
+    _exit(ok ? 0 : 1);
+  }
+  close(fds[1]);
+  bool ok = RunRank(kind, ring, addrs, 0, w[0]);
+  w[1].resize(kRingDim);
+  size_t got = 0;
+  char *p = reinterpret_cast<char*>(&w[1][0]);
+  while (got < sizeof(double) * kRingDim) {
+    ssize_t n = read(fds[0], p + got, sizeof(double) * kRingDim - got);
+    if (n <= 0) {
+      break;
+    }
+    got += n;
+  }
+  close(fds[0]);
+  int status;
+  waitpid(pid, &status, 0);
+  return ok && got == sizeof(double) * kRingDim &&
+      WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+class TransportTest : public ::testing::TestWithParam<int> {
+};
+
+/*! The socket ring sends the deltas as floats and skips the lambda mix, so
+ * it is compared with the shared memory ring with a lambda of 0.
+ */
+TEST_P(TransportTest, LoopbackMatchesShm) {
+  std::vector<double> shm[2], sock[2];
+  ASSERT_TRUE(TrainRing(kRingShm, shm));
+  ASSERT_TRUE(TrainRing((RingKind) GetParam(), sock));
+  for (int r = 0; r < 2; r++) {
+    for (unsigned i = 0; i < kRingDim; i++) {
+      ASSERT_NEAR(shm[r][i], sock[r][i], 1e-5) << "rank " << r << " w" << i;
+      // the coordinates a rank never sees came from the other one
+      double const share = i % 2 == (unsigned) r ? 1 : kRingBeta;
+      ASSERT_NEAR(share * RingTarget(i), sock[r][i], 1e-5)
+          << "rank " << r << " w" << i;
+    }
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(Sockets, TransportTest,
+                         ::testing::Values((int) kRingUnix, (int) kRingTCP));
+
+#endif
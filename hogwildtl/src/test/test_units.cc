@@ -0,0 +1,14 @@
+// Unit tests of the HogWild++ instances and the thread pool, they do not
+// need the old HogWild! interfaces basic_test-inl.h is written for.
+
+#include "test_filescan-inl.h"
+#include "test_delta_codec-inl.h"
+#include "test_chunk_scheduler-inl.h"
+#include "test_cpu_list-inl.h"
+#include "test_checkpoint-inl.h"
+#include "test_transport-inl.h"
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,438 @@
+// Copyright 2012 Victor Bittorf, Chris Re
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Hogwild!, part of the Hazy Project
+// Author : Victor Bittorf (bittorf [at] cs.wisc.edu)
+// Original Hogwild! Author: Chris Re (chrisre [at] cs.wisc.edu)
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "hazy/vector/fvector.h"
+#include "hazy/vector/svector.h"
+#include "hazy/vector/dot-inl.h"
+#include "hazy/vector/scale_add-inl.h"
+#include "hazy/vector/operations-inl.h"
+#include "hazy/thread/thread_pool-inl.h"
+#include "hazy/util/simple_random-inl.h"
+
+#include "frontend_util.h"
+
+#include "numasvm/svmmodel.h"
+#include "numasvm/transport.h"
+#include "mysvm/svmmodel.h"
+#include "mysvm/svm_exec.h"
+#include "tracenorm/mat_model.h"
+#include "tracenorm/mat_exec-inl.h"
+
+#include "bench/bench.h"
+
+// Hazy imports
+using namespace hazy;
+using namespace hazy::hogwild;
+using hazy::bench::Runner;
+using hazy::hogwild::svm::fp_type;
+
+namespace {
+
+std::string Name(char const *kernel, char const *param, size_t value,
+                 char const *param2 = NULL, size_t value2 = 0) {
+  std::stringstream ss;
+  ss << kernel << "/" << param << "=" << value;
+  if (param2 != NULL) {
+    ss << "/" << param2 << "=" << value2;
+  }
+  return ss.str();
+}
+
+/* sparse examples of nnz sorted features among dim, enough of them to cycle
+   through 2^20 features so that the weights they touch are not all cached */
+struct SparseExamples {
+  std::vector<fp_type> values;
+  std::vector<int> index;
+  std::vector<vector::SVector<const fp_type> > examples;
+
+  SparseExamples(size_t nnz, size_t dim) {
+    nnz = std::min(nnz, dim);
+    size_t count = std::max((size_t) 1, (1UL << 20) / nnz);
+    util::SimpleRandom &rand = util::SimpleRandom::GetInstance();
+    values.resize(count * nnz);
+    index.resize(count * nnz);
+    for (size_t e = 0; e < count; ++e) {
+      std::set<int> feats;
+      while (feats.size() < nnz) {
+        feats.insert(rand.RandInt(dim));
+      }
+      std::copy(feats.begin(), feats.end(), index.begin() + e * nnz);
+    }
+    for (size_t i = 0; i < values.size(); ++i) {
+      values[i] = rand.RandDouble() - 0.5;
+    }
+    for (size_t e = 0; e < count; ++e) {
+      examples.push_back(vector::SVector<const fp_type>(
+          &values[e * nnz], &index[e * nnz], nnz));
+    }
+  }
+};
+
+//! One vector::Dot() of the weights and an example per call
+struct DotKernel {
+  vector::FVector<fp_type> &w;
+  SparseExamples &ex;
+  size_t next;
+
+  DotKernel(vector::FVector<fp_type> &w, SparseExamples &ex) :
+      w(w), ex(ex), next(0) { }
+
+  void Run(size_t calls) {
+    double s = 0;
+    size_t const n = ex.examples.size();
+    for (size_t c = 0; c < calls; ++c) {
+      s += vector::Dot(w, ex.examples[next]);
+      next = next + 1 < n ? next + 1 : 0;
+    }
+    bench::sink = bench::sink + s;
+  }
+};
+
+//! One vector::ScaleAndAdd() of an example into the weights per call
+struct ScaleAndAddKernel {
+  vector::FVector<fp_type> &w;
+  SparseExamples &ex;
+  size_t next;
+
+  ScaleAndAddKernel(vector::FVector<fp_type> &w, SparseExamples &ex) :
+      w(w), ex(ex), next(0) { }
+
+  void Run(size_t calls) {
+    size_t const n = ex.examples.size();
+    for (size_t c = 0; c < calls; ++c) {
+      vector::ScaleAndAdd(w, ex.examples[next], 1e-6);
+      next = next + 1 < n ? next + 1 : 0;
+    }
+    bench::sink = bench::sink + w.values[0];
+  }
+};
+
+//! One LocalTransport::Sync() of a cluster with the next one per call
+struct SyncKernel {
+  svm::NumaSVMModel &m, &next;
+  svm::SVMParams &params;
+  svm::LocalTransport transport;
+
+  SyncKernel(svm::NumaSVMModel &m, svm::NumaSVMModel &next,
+             svm::SVMParams &params) : m(m), next(next), params(params) { }
+
+  void Run(size_t calls) {
+    size_t bytes = 0;
+    int sent = 0;
+    for (size_t c = 0; c < calls; ++c) {
+      sent += transport.Sync(&m, &next, params, bytes);
+    }
+    bench::sink = bench::sink + sent;
+  }
+};
+
+//! One mysvm PerformAveraging() of two replicas per call
+struct AveragingKernel {
+  svm::MyNumaSVMModel &a, &b;
+
+  AveragingKernel(svm::MyNumaSVMModel &a, svm::MyNumaSVMModel &b) :
+      a(a), b(b) { }
+
+  void Run(size_t calls) {
+    for (size_t c = 0; c < calls; ++c) {
+      svm::PerformAveraging(&a, &b);
+    }
+    bench::sink = bench::sink + a.weights.values[0];
+  }
+};
+
+//! One SimpleRandom::LazyPODShuffle() of a permutation per call
+struct ShuffleKernel {
+  std::vector<perm_type> perm;
+
+  explicit ShuffleKernel(size_t n) : perm(n) {
+    for (size_t i = 0; i < n; ++i) {
+      perm[i] = i;
+    }
+  }
+
+  void Run(size_t calls) {
+    util::SimpleRandom &rand = util::SimpleRandom::GetInstance();
+    for (size_t c = 0; c < calls; ++c) {
+      rand.LazyPODShuffle(&perm[0], perm.size());
+    }
+    bench::sink = bench::sink + perm[0];
+  }
+};
+
+//! One vector::SimplexProject() of a fresh copy of a vector per call
+struct SimplexKernel {
+  std::vector<double> src, buf;
+
+  explicit SimplexKernel(size_t n) : src(n), buf(n) {
+    util::SimpleRandom &rand = util::SimpleRandom::GetInstance();
+    for (size_t i = 0; i < n; ++i) {
+      src[i] = rand.RandDouble();
+    }
+  }
+
+  void Run(size_t calls) {
+    vector::FVector<double> v(&buf[0], buf.size());
+    for (size_t c = 0; c < calls; ++c) {
+      memcpy(&buf[0], &src[0], sizeof(double) * buf.size());
+      vector::SimplexProject(v);
+    }
+    bench::sink = bench::sink + buf[0];
+  }
+};
+
+//! One tracenorm ModelUpdate() of a rank-k factorization per call
+struct RankKernel {
+  tnorm::MFModel &model;
+  tnorm::MFParams &params;
+  std::vector<types::Entry> &entries;
+  std::vector<double> swap;
+  size_t next;
+
+  RankKernel(tnorm::MFModel &model, tnorm::MFParams &params,
+             std::vector<types::Entry> &entries) :
+      model(model), params(params), entries(entries),
+      swap(params.max_rank), next(0) { }
+
+  void Run(size_t calls) {
+    vector::FVector<double> swapL(&swap[0], params.max_rank);
+    size_t const n = entries.size();
+    for (size_t c = 0; c < calls; ++c) {
+      tnorm::ModelUpdate(model, params, entries[next], swapL);
+      next = next + 1 < n ? next + 1 : 0;
+    }
+    bench::sink = bench::sink + model.L[0].values[0];
+  }
+};
+
+//! One ThreadPool::Execute() and Wait() of an empty job per call
+struct PoolKernel {
+  thread::ThreadPool &tpool;
+  unsigned long touched;
+
+  explicit PoolKernel(thread::ThreadPool &tpool) : tpool(tpool), touched(0) { }
+
+  static void Touch(PoolKernel &k, unsigned tid, unsigned /* total */) {
+    if (tid == 0) {
+      k.touched++;
+    }
+  }
+
+  void Run(size_t calls) {
+    for (size_t c = 0; c < calls; ++c) {
+      tpool.Execute(*this, Touch);
+      tpool.Wait();
+    }
+    bench::sink = bench::sink + touched;
+  }
+};
+
+void RunSparse(Runner &runner) {
+  size_t const dims[] = {1 << 14, 1 << 20, 1 << 23};
+  size_t const nnzs[] = {16, 128, 1024};
+  for (size_t d = 0; d < sizeof(dims) / sizeof(dims[0]); ++d) {
+    std::vector<fp_type> weights(dims[d], 0.01);
+    vector::FVector<fp_type> w(&weights[0], weights.size());
+    for (size_t n = 0; n < sizeof(nnzs) / sizeof(nnzs[0]); ++n) {
+      SparseExamples ex(nnzs[n], dims[d]);
+      // the example and the weights it reads, and writes back
+      double nnz = ex.examples[0].size;
+      double feat = sizeof(fp_type) + sizeof(int);
+      DotKernel dot(w, ex);
+      runner.Run(Name("dot", "nnz", nnzs[n], "dim", dims[d]), "example", dot,
+                 1, nnz * (feat + sizeof(fp_type)));
+      ScaleAndAddKernel axpy(w, ex);
+      runner.Run(Name("scale_add", "nnz", nnzs[n], "dim", dims[d]), "example",
+                 axpy, 1, nnz * (feat + 2 * sizeof(fp_type)));
+    }
+  }
+}
+
+void RunSync(Runner &runner) {
+  size_t const dims[] = {1 << 14, 1 << 20, 1 << 23};
+  for (size_t d = 0; d < sizeof(dims) / sizeof(dims[0]); ++d) {
+    svm::NumaSVMModel m, next;
+    m.AllocateModel(dims[d]);
+    next.AllocateModel(dims[d]);
+    util::SimpleRandom &rand = util::SimpleRandom::GetInstance();
+    for (size_t i = 0; i < dims[d]; ++i) {
+      m.weights.values[i] = rand.RandDouble() - 0.5;
+      next.weights.values[i] = rand.RandDouble() - 0.5;
+    }
+    svm::SVMParams params(5e-2, 0.8, 1.0, 0.9, 0.1, 2, true, 256, 0, NULL);
+    SyncKernel sync(m, next, params);
+    // every delta is sent: w, old and next are read and written
+    params.tolerance = -1;
+    runner.Run(Name("sync/send", "dim", dims[d]), "element", sync, dims[d],
+               6.0 * sizeof(fp_type) * dims[d]);
+    // none is: next is only read
+    params.tolerance = 1e30;
+    runner.Run(Name("sync/keep", "dim", dims[d]), "element", sync, dims[d],
+               5.0 * sizeof(fp_type) * dims[d]);
+    m.FreeModel();
+    next.FreeModel();
+
+    svm::MyNumaSVMModel a, b;
+    a.peers.values = b.peers.values = NULL;
+    a.AllocateModel(dims[d]);
+    b.AllocateModel(dims[d]);
+    for (size_t i = 0; i < dims[d]; ++i) {
+      a.weights.values[i] = rand.RandDouble() - 0.5;
+    }
+    AveragingKernel avg(a, b);
+    runner.Run(Name("averaging", "dim", dims[d]), "element", avg, dims[d],
+               4.0 * sizeof(fp_type) * dims[d]);
+    a.FreeModel();
+    b.FreeModel();
+  }
+}
+
+void RunShuffle(Runner &runner) {
+  size_t const sizes[] = {1 << 14, 1 << 20, 1 << 24};
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    ShuffleKernel shuffle(sizes[s]);
+    // two elements read and written per element
+    runner.Run(Name("shuffle", "n", sizes[s]), "element", shuffle, sizes[s],
+               4.0 * sizeof(perm_type) * sizes[s]);
+  }
+}
+
+void RunSimplex(Runner &runner) {
+  size_t const sizes[] = {16, 1024, 65536};
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    SimplexKernel simplex(sizes[s]);
+    // the copy in, the sorted copy and the projection
+    runner.Run(Name("simplex", "n", sizes[s]), "element", simplex, sizes[s],
+               6.0 * sizeof(double) * sizes[s]);
+  }
+}
+
+void RunRank(Runner &runner) {
+  size_t const ranks[] = {10, 50, 100};
+  size_t const rows = 1 << 14, cols = 1 << 12;
+  for (size_t r = 0; r < sizeof(ranks) / sizeof(ranks[0]); ++r) {
+    tnorm::MFModel model(0, rows, cols, ranks[r]);
+    tnorm::MFParams params;
+    params.Setup(rows, cols, 1 << 20);
+    params.max_rank = ranks[r];
+    params.mu = 1e-3;
+    params.step_size = 1e-2;
+    params.step_decay = 1;
+    util::SimpleRandom &rand = util::SimpleRandom::GetInstance();
+    std::vector<types::Entry> entries(params.nExamples);
+    for (size_t i = 0; i < entries.size(); ++i) {
+      entries[i].row = rand.RandInt(rows);
+      entries[i].col = rand.RandInt(cols);
+      entries[i].rating = rand.RandDouble() * 5;
+      params.L_degree[entries[i].row]++;
+      params.R_degree[entries[i].col]++;
+    }
+    RankKernel rank(model, params, entries);
+    // Li and Rj read and written, Li through the swap
+    runner.Run(Name("rank_update", "rank", ranks[r]), "entry", rank, 1,
+               8.0 * sizeof(double) * ranks[r]);
+    delete [] params.L_degree;
+    delete [] params.R_degree;
+  }
+}
+
+void RunPool(Runner &runner, unsigned nthreads) {
+  unsigned const counts[] = {1, 2, 4, 8, 16, 32, 64, 128, 256};
+  for (size_t t = 0; t < sizeof(counts) / sizeof(counts[0]); ++t) {
+    unsigned n = std::min(counts[t], nthreads);
+    thread::ThreadPool tpool(n);
+    tpool.Init();
+    PoolKernel pool(tpool);
+    runner.Run(Name("pool_round_trip", "threads", n), "job", pool, 1, 0);
+    tpool.Join();
+    if (n == nthreads) {
+      break;
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  double min_time = 0.5;
+  std::string filter;
+  std::string metrics_path;
+  unsigned nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  static struct extended_option long_options[] = {
+    {"filter", required_argument, NULL, 'f', "only the kernels whose name contains this, e.g. dot/ or sync"},
+    {"min_time", required_argument, NULL, 't', "seconds each kernel is timed for (default 0.5)"},
+    {"splits", required_argument, NULL, 'r', "most threads of the thread pool round trips (default the CPUs)"},
+    {"metrics", required_argument, NULL, 'M', "also write one JSON line per kernel to this file, - for stdout"},
+    {NULL,0,NULL,0,0}
+  };
+
+  char usage_str[] = "";
+  int c = 0, option_index = 0;
+  option* opt_struct = convert_extended_options(long_options);
+  while( (c = getopt_long(argc, argv, "", opt_struct, &option_index)) != -1)
+  {
+    switch (c) {
+      case 'f':
+        filter = optarg;
+        break;
+      case 't':
+        min_time = atof(optarg);
+        break;
+      case 'r':
+        nthreads = std::max(atoi(optarg), 1);
+        break;
+      case 'M':
+        metrics_path = optarg;
+        break;
+      case ':':
+      case '?':
+        print_usage(long_options, argv[0], usage_str);
+        exit(-1);
+        break;
+    }
+  }
+  if (optind != argc) {
+    print_usage(long_options, argv[0], usage_str);
+    exit(-1);
+  }
+
+  // the same inputs on every run
+  util::SimpleRandom::SetSeed(1);
+  util::MetricsSink *metrics = NULL;
+  if (!metrics_path.empty()) {
+    metrics = new util::MetricsSink(metrics_path);
+  }
+  Runner runner(min_time, filter, metrics);
+  RunSparse(runner);
+  RunSync(runner);
+  RunShuffle(runner);
+  RunSimplex(runner);
+  RunRank(runner);
+  RunPool(runner, nthreads);
+  delete metrics;
+  return 0;
+}
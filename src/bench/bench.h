@@ -0,0 +1,116 @@
+// Copyright 2012 Victor Bittorf, Chris Re
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Hogwild!, part of the Hazy Project
+// Author : Victor Bittorf (bittorf [at] cs.wisc.edu)
+// Original Hogwild! Author: Chris Re (chrisre [at] cs.wisc.edu)
+
+#ifndef HAZY_HOGWILD_INSTANCES_BENCH_BENCH_H
+#define HAZY_HOGWILD_INSTANCES_BENCH_BENCH_H
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "hazy/util/clock.h"
+#include "hazy/util/metrics.h"
+
+namespace hazy {
+//! Microbenchmarks of the kernels, see bin/bench
+namespace bench {
+
+//! Results the kernels fold their outputs into, so that none is optimized out
+static volatile double sink = 0;
+
+/*! \brief Times kernels and prints their ns/op and GB/s
+ * A kernel is a class with a void Run(size_t calls) method. Its calls are
+ * batched until a batch lasts a fifth of the minimum time, then five
+ * batches are timed and their median is reported, so that a single
+ * preemption does not skew the result.
+ */
+class Runner {
+ public:
+  /*! \param min_time seconds each kernel is timed for, at least
+   * \param filter only the kernels whose name contains it, all if empty
+   * \param metrics also writes a "bench" record per kernel, may be NULL
+   */
+  Runner(double min_time, std::string const &filter,
+         util::MetricsSink *metrics) :
+      min_time_(min_time), filter_(filter), metrics_(metrics) { }
+
+  /*! \brief Times a kernel, unless it is filtered out
+   * \param name printed, e.g. "dot/nnz=16/dim=16384"
+   * \param op what an op is, e.g. "example" or "element"
+   * \param ops ops in a call of k.Run()
+   * \param bytes memory a call reads and writes, 0 if not meaningful
+   */
+  template <class Kernel>
+  void Run(std::string const &name, char const *op, Kernel &k, double ops,
+           double bytes) {
+    if (!filter_.empty() && name.find(filter_) == std::string::npos) {
+      return;
+    }
+    size_t calls = 1;
+    double secs = Time(k, calls);
+    while (secs < min_time_ / kBatches && calls < (1UL << 40)) {
+      // aim past the batch time, at most a hundredfold at once
+      double grow = secs > 0 ? 1.2 * min_time_ / kBatches / secs : 100;
+      calls = (size_t) (calls * std::min(std::max(grow, 2.0), 100.0));
+      secs = Time(k, calls);
+    }
+    std::vector<double> batches;
+    for (int b = 0; b < kBatches; ++b) {
+      batches.push_back(Time(k, calls));
+    }
+    std::sort(batches.begin(), batches.end());
+    double ns = batches[kBatches / 2] * 1e9 / (calls * ops);
+    double gbs = bytes > 0 ? bytes / ops / ns : 0;
+    char gbs_str[32] = "-";
+    if (bytes > 0) {
+      snprintf(gbs_str, sizeof(gbs_str), "%.3f", gbs);
+    }
+    printf("bench: %-36s ns/op: %12.3f GB/s: %8s op: %s\n", name.c_str(), ns,
+           gbs_str, op);
+    fflush(stdout);
+    if (metrics_ != NULL) {
+      util::MetricsRecord rec("bench");
+      rec.Add("name", name);
+      rec.Add("op", op);
+      rec.Add("ns_per_op", ns);
+      rec.Add("gb_per_sec", bytes > 0 ? gbs : NAN);
+      rec.Add("calls", calls * kBatches);
+      metrics_->Write(rec);
+    }
+  }
+
+ private:
+  static const int kBatches = 5;
+
+  template <class Kernel>
+  static double Time(Kernel &k, size_t calls) {
+    util::Clock clock;
+    clock.Start();
+    k.Run(calls);
+    return clock.Stop();
+  }
+
+  double min_time_;
+  std::string filter_;
+  util::MetricsSink *metrics_;
+};
+
+} // namespace bench
+} // namespace hazy
+#endif
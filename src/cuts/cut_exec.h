@@ -22,9 +22,11 @@
 #include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <vector>
 
 #include "hazy/vector/fvector.h"
 #include "hazy/types/tuple.h"
+#include "hazy/util/metrics.h"
 #include "cut_model.h"
 
 namespace hazy {
@@ -179,6 +181,12 @@ class CutExec {
   static void PostEpoch(CutModel &m, CutParams &p) {
     p.stepsize *= p.step_diminish;
   }
+
+  //! Adds the counters of the last epoch to its metrics, before PostEpoch
+  static void EpochMetrics(CutModel &model, CutParams &params,
+                           util::MetricsRecord &epoch,
+                           std::vector<util::MetricsRecord> &threads) {
+  }
 };
 
 bool CutExec::UseZeroOneLoss = false;
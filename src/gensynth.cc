@@ -0,0 +1,167 @@
+// Copyright 2012 Victor Bittorf, Chris Re
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Hogwild!, part of the Hazy Project
+// Author : Victor Bittorf (bittorf [at] cs.wisc.edu)
+// Original Hogwild! Author: Chris Re (chrisre [at] cs.wisc.edu)
+
+#include <climits>
+#include <cstdlib>
+
+#include "hazy/util/clock.h"
+
+#include "frontend_util.h"
+
+#include "gensynth/synth.h"
+
+// Hazy imports
+using namespace hazy;
+using namespace hazy::hogwild;
+using namespace hazy::hogwild::synth;
+
+//! Writes a file of a stream, prints how long it took
+static void WriteFile(Writer &writer, SynthParams const &p, unsigned stream,
+                      uint64_t rows, char const *path) {
+  Generator gen(p, stream);
+  hazy::util::Clock clock;
+  clock.Start();
+  if (!writer.Write(gen, rows, path)) {
+    exit(-1);
+  }
+  double secs = clock.Stop();
+  double mb = (sizeof(uint64_t) + writer.Count() * sizeof(types::Entry)) / 1e6;
+  printf("wrote %s rows: %lu entries: %lu MB: %.1f write_time: %.5f "
+         "MB/s: %.1f\n", path, rows, writer.Count(), mb, secs,
+         secs > 0 ? mb / secs : 0.0);
+  fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+  hazy::util::Clock wall_clock;
+  wall_clock.Start();
+
+  SynthParams p;
+  p.rows = 100000;
+  p.dim = 100000;
+  p.nnz = 50;
+  p.skew = 1.0;
+  p.rank = 0;
+  p.noise = -1;
+  p.seed = 0;
+  p.block = 4096;
+  bool seeded = false;
+  long test_rows = -1;
+  unsigned nthreads = 1;
+  static struct extended_option long_options[] = {
+    {"rows", required_argument, NULL, 'n', "examples, or rows of the matrix (default 100000)"},
+    {"dim", required_argument, NULL, 'd', "features, or columns of the matrix (default 100000)"},
+    {"nnz", required_argument, NULL, 'z', "mean nonzeros of a row, drawn in [nnz/2, 3nnz/2] (default 50)"},
+    {"skew", required_argument, NULL, 'w', "exponent of the power law of the feature frequencies, 0 is uniform (default 1)"},
+    {"rank", required_argument, NULL, 'R', "writes a matrix of this rank for tracenorm instead of examples (default 0)"},
+    {"noise", required_argument, NULL, 'e', "label flip probability (default 0.05), or rating noise amplitude (default 0.1)"},
+    {"test_rows", required_argument, NULL, 't', "rows of the test file (default rows/10)"},
+    {"seed", required_argument, NULL, 's', "seed of the data, the same for any splits (default from the time)"},
+    {"splits", required_argument, NULL, 'r', "number of threads (default is 1)"},
+    {"block", required_argument, NULL, 'k', "rows a thread generates at once (default 4096)"},
+    {NULL,0,NULL,0,0}
+  };
+
+  char usage_str[] = "<train file> [<test file>]";
+  int c = 0, option_index = 0;
+  option* opt_struct = convert_extended_options(long_options);
+  while( (c = getopt_long(argc, argv, "", opt_struct, &option_index)) != -1)
+  {
+    switch (c) {
+      case 'n':
+        p.rows = strtoull(optarg, NULL, 10);
+        break;
+      case 'd':
+        p.dim = atoi(optarg);
+        break;
+      case 'z':
+        p.nnz = atoi(optarg);
+        break;
+      case 'w':
+        p.skew = atof(optarg);
+        break;
+      case 'R':
+        p.rank = atoi(optarg);
+        break;
+      case 'e':
+        p.noise = atof(optarg);
+        break;
+      case 't':
+        test_rows = atol(optarg);
+        break;
+      case 's':
+        p.seed = strtoul(optarg, NULL, 10);
+        seeded = true;
+        break;
+      case 'r':
+        nthreads = atoi(optarg);
+        break;
+      case 'k':
+        p.block = atol(optarg);
+        break;
+      case ':':
+      case '?':
+        print_usage(long_options, argv[0], usage_str);
+        exit(-1);
+        break;
+    }
+  }
+
+  char *szTrainFile, *szTestFile = NULL;
+  if (optind == argc - 1 || optind == argc - 2) {
+    szTrainFile = argv[optind];
+    if (optind == argc - 2) {
+      szTestFile = argv[optind+1];
+    }
+  } else {
+    print_usage(long_options, argv[0], usage_str);
+    exit(-1);
+  }
+  if (test_rows < 0) {
+    test_rows = p.rows / 10;
+  }
+  // rows and features are the ints of types::Entry
+  if (p.rows == 0 || p.rows > INT_MAX || (uint64_t) test_rows > INT_MAX ||
+      p.dim <= 0 || p.nnz <= 0 || p.skew < 0 || p.rank < 0 || p.block == 0) {
+    printf("rows and test_rows must be in [1, %d], dim, nnz and block "
+           "positive, skew and rank not negative\n", INT_MAX);
+    exit(-1);
+  }
+  if (p.noise < 0) {
+    p.noise = p.rank > 0 ? 0.1 : 0.05;
+  }
+  if (!seeded) {
+    hazy::util::SimpleRandom::SeedByTime();
+    p.seed = hazy::util::SimpleRandom::Seed();
+  }
+  printf("seed: %u\n", p.seed);
+  printf("%s rows: %lu dim: %d nnz: %d skew: %g rank: %d noise: %g\n",
+         p.rank > 0 ? "matrix" : "examples", p.rows, p.dim, p.nnz, p.skew,
+         p.rank, p.noise);
+
+  hazy::thread::ThreadPool tpool(nthreads);
+  tpool.Init();
+  Writer writer(tpool);
+  WriteFile(writer, p, 0, p.rows, szTrainFile);
+  if (szTestFile != NULL) {
+    WriteFile(writer, p, 1, test_rows, szTestFile);
+  }
+  tpool.Join();
+  printf("threads: %u wall_clock: %.5f\n", nthreads, wall_clock.Read());
+  return 0;
+}
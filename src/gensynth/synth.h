@@ -0,0 +1,303 @@
+// Copyright 2012 Victor Bittorf, Chris Re
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Hogwild!, part of the Hazy Project
+// Author : Victor Bittorf (bittorf [at] cs.wisc.edu)
+// Original Hogwild! Author: Chris Re (chrisre [at] cs.wisc.edu)
+
+#ifndef HAZY_HOGWILD_INSTANCES_GENSYNTH_SYNTH_H
+#define HAZY_HOGWILD_INSTANCES_GENSYNTH_SYNTH_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "hazy/types/tuple.h"
+#include "hazy/thread/thread_pool-inl.h"
+#include "hazy/util/simple_random-inl.h"
+
+namespace hazy {
+namespace hogwild {
+//! Synthetic datasets written as binary files of bin/convert
+namespace synth {
+
+//! What to generate, see bin/gensynth
+struct SynthParams {
+  uint64_t rows; //!< examples, or rows of the matrix
+  int dim; //!< features, or columns of the matrix
+  int nnz; //!< mean nonzeros of a row
+  double skew; //!< exponent of the power law of the feature frequencies
+  int rank; //!< rank of the matrix, 0 for classification examples
+  double noise; //!< label flip probability, or rating noise amplitude
+  unsigned seed;
+  size_t block; //!< rows of a block, the unit of work of a thread
+};
+
+/*! \brief Draws features with a frequency of 1/(rank + 1)^skew
+ * The rank of a feature is drawn from the continuous power law by inverting
+ * its CDF, skew 0 being uniform. Ranks are then scattered over the features
+ * by a multiplication modulo the dimension, so that the frequent features
+ * are not the first ones.
+ */
+class PowerLaw {
+ public:
+  PowerLaw(int dim, double skew) : dim_(dim), skew_(skew) {
+    double n = dim + 1.0;
+    log_n_ = log(n);
+    span_ = pow(n, 1 - skew) - 1;
+    // primes, one of which does not divide the dimension
+    static uint64_t const kPrimes[] = {2654435761UL, 2246822519UL, 3266489917UL};
+    mul_ = kPrimes[0];
+    for (int i = 0; i < 3 && dim % kPrimes[i] == 0; ++i) {
+      mul_ = kPrimes[(i + 1) % 3];
+    }
+  }
+
+  //! A feature in [0, dim) for u uniform in [0, 1)
+  int Sample(double u) const {
+    double x;
+    if (fabs(skew_ - 1) < 1e-9) {
+      x = exp(u * log_n_) - 1;
+    } else {
+      x = pow(1 + u * span_, 1 / (1 - skew_)) - 1;
+    }
+    uint64_t rank = std::min((uint64_t) std::max(x, 0.0), (uint64_t) dim_ - 1);
+    return (int) (rank * mul_ % dim_);
+  }
+
+ private:
+  int dim_;
+  double skew_;
+  double log_n_, span_;
+  uint64_t mul_;
+};
+
+/*! \brief Generates the rows of a dataset, block by block
+ * A row only depends on the seed, the stream and its index: the data is
+ * the same for any number of threads and any block. The hidden model, i.e. the weights the
+ * labels are the signs of or the factors of the matrix, only depends on
+ * the seed, so a train and a test file of different streams share it.
+ *
+ * An example is a label entry of col -2 and rating 1 or -1 (as written
+ * by convert2hogwild.py), then its features by increasing col with
+ * values of a unit L2 norm. A matrix row is its entries by increasing col,
+ * rated L_row . R_col plus uniform noise. The first row of a stream also
+ * gets the last feature, so that the loaders find the whole dimension.
+ */
+class Generator {
+ public:
+  Generator(SynthParams const &p, unsigned stream) : p_(p),
+      law_(p.dim, p.skew),
+      stream_seed_(util::SimpleRandom::StreamSeed(p.seed, stream)),
+      model_seed_(util::SimpleRandom::StreamSeed(p.seed, 0x6d6f646cu)) {
+    nnz_lo_ = std::max(1, p.nnz - p.nnz / 2);
+    nnz_hi_ = std::min(p.dim, std::max(nnz_lo_, p.nnz + p.nnz / 2));
+    nnz_lo_ = std::min(nnz_lo_, nnz_hi_);
+  }
+
+  //! Rows of a block
+  uint64_t BlockRows() const { return p_.block; }
+
+  //! Rows of [b * block, (b + 1) * block) of rows, appended to out
+  void Block(uint64_t b, uint64_t rows, std::vector<types::Entry> &out,
+             std::vector<int> &cols) const {
+    uint64_t end = std::min(rows, (b + 1) * p_.block);
+    for (uint64_t row = b * p_.block; row < end; ++row) {
+      unsigned state = util::SimpleRandom::StreamSeed(stream_seed_, (unsigned) row);
+      Row((int) row, state, out, cols);
+    }
+  }
+
+ private:
+  static types::Entry MakeEntry(int row, int col, double rating) {
+    types::Entry e;
+    e.row = row;
+    e.col = col;
+    e.rating = rating;
+    return e;
+  }
+
+  //! Uniform in [-1, 1), a function of the seed and (i, j) only
+  double Hidden(unsigned i, unsigned j) const {
+    unsigned h = util::SimpleRandom::StreamSeed(
+        util::SimpleRandom::StreamSeed(model_seed_, i), j);
+    return h / 2147483648.0 - 1;
+  }
+
+  //! Weight of a feature for the labels
+  double Weight(int col) const { return Hidden((unsigned) col, 0xffffffffu); }
+
+  //! L_row . R_col scaled to a unit variance
+  double Rating(int row, int col) const {
+    double dot = 0;
+    for (int k = 0; k < p_.rank; ++k) {
+      dot += Hidden(2 * (unsigned) row, k) * Hidden(2 * (unsigned) col + 1, k);
+    }
+    return dot * 3 / sqrt((double) p_.rank);
+  }
+
+  //! Draws distinct features, all of them may not be when the law is steep
+  void DrawCols(int row, unsigned &state, std::vector<int> &cols) const {
+    size_t n = nnz_lo_ + util::SimpleRandom::RandInt(state, nnz_hi_ - nnz_lo_ + 1);
+    cols.clear();
+    for (int tries = 0; tries < 8 && cols.size() < n; ++tries) {
+      for (size_t i = cols.size(); i < n; ++i) {
+        cols.push_back(law_.Sample(util::SimpleRandom::RandDouble(state)));
+      }
+      std::sort(cols.begin(), cols.end());
+      cols.erase(std::unique(cols.begin(), cols.end()), cols.end());
+    }
+    if (row == 0 && cols.back() != p_.dim - 1) {
+      cols.push_back(p_.dim - 1);
+    }
+  }
+
+  void Row(int row, unsigned &state, std::vector<types::Entry> &out,
+           std::vector<int> &cols) const {
+    DrawCols(row, state, cols);
+    if (p_.rank > 0) {
+      for (size_t i = 0; i < cols.size(); ++i) {
+        double noise = p_.noise * (2 * util::SimpleRandom::RandDouble(state) - 1);
+        out.push_back(MakeEntry(row, cols[i], Rating(row, cols[i]) + noise));
+      }
+      return;
+    }
+    size_t label = out.size();
+    out.push_back(MakeEntry(row, -2, 1.0));
+    double norm = 0, margin = 0;
+    for (size_t i = 0; i < cols.size(); ++i) {
+      double v = 1 - util::SimpleRandom::RandDouble(state);
+      out.push_back(MakeEntry(row, cols[i], v));
+      norm += v * v;
+      margin += v * Weight(cols[i]);
+    }
+    norm = 1 / sqrt(norm);
+    for (size_t i = label + 1; i < out.size(); ++i) {
+      out[i].rating *= norm;
+    }
+    bool flip = util::SimpleRandom::RandDouble(state) < p_.noise;
+    out[label].rating = (margin >= 0) != flip ? 1.0 : -1.0;
+  }
+
+  SynthParams p_;
+  PowerLaw law_;
+  unsigned stream_seed_, model_seed_;
+  int nnz_lo_, nnz_hi_;
+};
+
+/*! \brief Writes the blocks of a generator to a binary file in parallel
+ * The blocks are cut in rounds of one block per thread. Every thread
+ * generates its block, then the offsets of the blocks in the file are
+ * known and every thread writes its own with pwrite(). The count of the
+ * header is written last.
+ */
+class Writer {
+ public:
+  //! \param tpool an initialized pool
+  explicit Writer(thread::ThreadPool &tpool) : tpool_(tpool),
+      buffers_(tpool.ThreadCount()), cols_(tpool.ThreadCount()),
+      offsets_(tpool.ThreadCount()), failed_(tpool.ThreadCount()) { }
+
+  //! Writes rows of a generator to path, prints why and returns false if it cannot
+  bool Write(Generator const &gen, uint64_t rows, char const *path) {
+    fd_ = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) {
+      perror(path);
+      return false;
+    }
+    gen_ = &gen;
+    rows_ = rows;
+    count_ = 0;
+    bool ok = true;
+    size_t const nthreads = tpool_.ThreadCount();
+    uint64_t nblocks = (rows + gen.BlockRows() - 1) / gen.BlockRows();
+    for (round_ = 0; ok && round_ < nblocks; round_ += nthreads) {
+      tpool_.Execute(*this, Generate);
+      tpool_.Wait();
+      for (size_t t = 0; t < nthreads; ++t) {
+        offsets_[t] = sizeof(uint64_t) + count_ * sizeof(types::Entry);
+        count_ += buffers_[t].size();
+      }
+      tpool_.Execute(*this, Put);
+      tpool_.Wait();
+      for (size_t t = 0; t < nthreads; ++t) {
+        ok = ok && !failed_[t];
+      }
+    }
+    ok = ok && PutAll(&count_, sizeof(count_), 0);
+    if (!ok) {
+      perror(path);
+    }
+    if (close(fd_) != 0 && ok) {
+      perror(path);
+      ok = false;
+    }
+    return ok;
+  }
+
+  //! Entries written by the last Write()
+  uint64_t Count() const { return count_; }
+
+ private:
+  static void Generate(Writer &w, unsigned tid, unsigned /* total */) {
+    w.buffers_[tid].clear();
+    if (w.round_ + tid < (w.rows_ + w.gen_->BlockRows() - 1) /
+        w.gen_->BlockRows()) {
+      w.gen_->Block(w.round_ + tid, w.rows_, w.buffers_[tid], w.cols_[tid]);
+    }
+  }
+
+  static void Put(Writer &w, unsigned tid, unsigned /* total */) {
+    std::vector<types::Entry> const &buf = w.buffers_[tid];
+    w.failed_[tid] = !buf.empty() &&
+        !w.PutAll(&buf[0], buf.size() * sizeof(types::Entry), w.offsets_[tid]);
+  }
+
+  //! pwrite() until all is written
+  bool PutAll(void const *data, size_t bytes, uint64_t offset) {
+    char const *p = static_cast<char const*>(data);
+    while (bytes > 0) {
+      ssize_t n = pwrite(fd_, p, bytes, offset);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+      p += n;
+      bytes -= n;
+      offset += n;
+    }
+    return true;
+  }
+
+  thread::ThreadPool &tpool_;
+  Generator const *gen_;
+  uint64_t rows_, round_, count_;
+  int fd_;
+  std::vector<std::vector<types::Entry> > buffers_;
+  std::vector<std::vector<int> > cols_;
+  std::vector<uint64_t> offsets_;
+  std::vector<char> failed_;
+};
+
+} // namespace synth
+} // namespace hogwild
+} // namespace hazy
+#endif
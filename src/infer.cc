@@ -0,0 +1,160 @@
+// Copyright 2012 Victor Bittorf, Chris Re
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Hogwild!, part of the Hazy Project
+// Author : Victor Bittorf (bittorf [at] cs.wisc.edu)
+// Original Hogwild! Author: Chris Re (chrisre [at] cs.wisc.edu)
+
+#include <cstdlib>
+#include <cstring>
+
+#include "hazy/scan/tsvfscan.h"
+#include "hazy/util/clock.h"
+#include "hazy/util/checkpoint.h"
+
+#include "frontend_util.h"
+
+#include "infer/infer.h"
+
+// Hazy imports
+using namespace hazy;
+using namespace hazy::hogwild;
+using scan::TSVFileScanner;
+using scan::MatlabTSVFileScanner;
+
+using namespace hazy::hogwild::infer;
+
+int main(int argc, char** argv) {
+  hazy::util::Clock wall_clock;
+  wall_clock.Start();
+
+  bool matlab_tsv = false;
+  bool loadBinary = false;
+  bool out_binary = false;
+  unsigned nthreads = 1;
+  size_t block = 1 << 16;
+  static struct extended_option long_options[] = {
+    {"splits", required_argument, NULL, 'r', "number of threads (default is 1)"},
+    {"binary", required_argument, NULL, 'v', "map the input as a binary file of bin/convert"},
+    {"matlab-tsv", required_argument, NULL, 'm', "load TSVs indexing from 1 instead of 0"},
+    {"out_binary", required_argument, NULL, 'o', "write the scores as a binary file of bin/convert instead of TSV (default 0)"},
+    {"block", required_argument, NULL, 'k', "input entries a thread scores at once (default 65536)"},
+    {NULL,0,NULL,0,0}
+  };
+
+  char usage_str[] = "<model checkpoint> <input file> <output file>";
+  int c = 0, option_index = 0;
+  option* opt_struct = convert_extended_options(long_options);
+  while( (c = getopt_long(argc, argv, "", opt_struct, &option_index)) != -1)
+  {
+    switch (c) {
+      case 'r':
+        nthreads = atoi(optarg);
+        break;
+      case 'v':
+        loadBinary = (atoi(optarg) != 0);
+        break;
+      case 'm':
+        matlab_tsv = (atoi(optarg) != 0);
+        break;
+      case 'o':
+        out_binary = (atoi(optarg) != 0);
+        break;
+      case 'k':
+        block = atol(optarg);
+        break;
+      case ':':
+      case '?':
+        print_usage(long_options, argv[0], usage_str);
+        exit(-1);
+        break;
+    }
+  }
+
+  char *szModelFile, *szInputFile, *szOutputFile;
+  if (optind == argc - 3) {
+    szModelFile = argv[optind];
+    szInputFile = argv[optind+1];
+    szOutputFile = argv[optind+2];
+  } else {
+    print_usage(long_options, argv[0], usage_str);
+    exit(-1);
+  }
+
+  util::Checkpoint ckpt;
+  if (!ckpt.Open(szModelFile)) {
+    exit(-1);
+  }
+  util::CheckpointHeader const &h = ckpt.Header();
+  bool mf = strcmp(h.model, "mf") == 0;
+  if (!mf && strcmp(h.model, "svm") != 0) {
+    printf("%s is a model of %s, expected svm or mf\n", szModelFile, h.model);
+    exit(-1);
+  }
+  if (mf && (h.replicas != 1 || h.rows + h.cols == 0)) {
+    printf("%s is not a matrix factorization\n", szModelFile);
+    exit(-1);
+  }
+  printf("Loaded %s model of %lu values at epoch %d\n", h.model, ckpt.Dim(),
+         ckpt.Epoch());
+
+  EntryFile in;
+  if (loadBinary) {
+    if (!in.Map(szInputFile)) {
+      exit(-1);
+    }
+  } else if (matlab_tsv) {
+    MatlabTSVFileScanner scan(szInputFile);
+    in.Load(scan);
+  } else {
+    TSVFileScanner scan(szInputFile);
+    in.Load(scan);
+  }
+  printf("Loaded %lu entries, wall_clock: %.5f\n", in.Count(), wall_clock.Read());
+  FILE *out = fopen(szOutputFile, "w");
+  if (out == NULL) {
+    perror(szOutputFile);
+    exit(-1);
+  }
+  // the blocks of the threads are written at once
+  std::vector<char> outbuf(1 << 22);
+  setvbuf(out, &outbuf[0], _IOFBF, outbuf.size());
+
+  hazy::thread::ThreadPool tpool(nthreads);
+  tpool.Init();
+  Predictor predictor(tpool, block);
+  hazy::util::Clock clock;
+  clock.Start();
+  if (mf) {
+    MFScorer scorer(ckpt);
+    predictor.PredictMF(scorer, in, out, out_binary ? kOutputBinary : kOutputTSV);
+  } else {
+    SVMScorer scorer(ckpt);
+    predictor.PredictSVM(scorer, in, out, out_binary ? kOutputBinary : kOutputTSV);
+  }
+  if (fclose(out) != 0) {
+    perror(szOutputFile);
+    exit(-1);
+  }
+  double secs = clock.Stop();
+  printf("threads: %u predicted: %lu predict_time: %.5f per_sec: %.5g\n",
+         nthreads, predictor.Count(), secs,
+         secs > 0 ? predictor.Count() / secs : 0.0);
+  if (predictor.Labeled() > 0) {
+    printf("labeled: %lu accuracy: %.5g\n", predictor.Labeled(),
+           (double) predictor.Correct() / predictor.Labeled());
+  }
+  tpool.Join();
+  return 0;
+}
@@ -0,0 +1,333 @@
+// Copyright 2012 Victor Bittorf, Chris Re
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Hogwild!, part of the Hazy Project
+// Author : Victor Bittorf (bittorf [at] cs.wisc.edu)
+// Original Hogwild! Author: Chris Re (chrisre [at] cs.wisc.edu)
+
+#ifndef HAZY_HOGWILD_INSTANCES_INFER_INFER_H
+#define HAZY_HOGWILD_INSTANCES_INFER_INFER_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "hazy/types/tuple.h"
+#include "hazy/vector/fvector.h"
+#include "hazy/vector/svector.h"
+#include "hazy/vector/dot-inl.h"
+#include "hazy/thread/thread_pool-inl.h"
+#include "hazy/util/checkpoint.h"
+
+namespace hazy {
+namespace hogwild {
+//! Batched predictions of trained models
+namespace infer {
+
+/*! \brief The entries to predict, mapped from a binary file or loaded
+ * A binary file is the format of bin/convert (see scan::BinaryFileScanner),
+ * mapped as is. The entries of an example are consecutive.
+ */
+class EntryFile {
+ public:
+  EntryFile() : entries_(NULL), count_(0), base_(NULL), bytes_(0) { }
+
+  ~EntryFile() {
+    if (base_ != NULL) {
+      munmap(base_, bytes_);
+    }
+  }
+
+  //! Maps a binary file, prints why and returns false if it cannot
+  bool Map(char const *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      perror(path);
+      return false;
+    }
+    struct stat st;
+    void *base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(uint64_t)) {
+      base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) {
+      printf("Cannot map %s\n", path);
+      return false;
+    }
+    base_ = static_cast<char*>(base);
+    bytes_ = st.st_size;
+    count_ = *reinterpret_cast<uint64_t const*>(base_);
+    if (sizeof(uint64_t) + count_ * sizeof(types::Entry) > bytes_) {
+      printf("%s is truncated\n", path);
+      return false;
+    }
+    entries_ = reinterpret_cast<types::Entry const*>(base_ + sizeof(uint64_t));
+    madvise(base_, bytes_, MADV_SEQUENTIAL);
+    return true;
+  }
+
+  //! Reads all the entries of a scanner, e.g. a TSVFileScanner
+  template <class Scan>
+  void Load(Scan &scan) {
+    while (scan.HasNext()) {
+      loaded_.push_back(scan.Next());
+    }
+    count_ = loaded_.size();
+    entries_ = loaded_.empty() ? NULL : &loaded_[0];
+  }
+
+  types::Entry const * Entries() const { return entries_; }
+  size_t Count() const { return count_; }
+
+ private:
+  EntryFile(EntryFile const &);
+  void operator=(EntryFile const &);
+
+  types::Entry const *entries_;
+  size_t count_;
+  std::vector<types::Entry> loaded_; //!< of Load()
+  char *base_; //!< of Map()
+  size_t bytes_;
+};
+
+/*! \brief The weights of an SVM checkpoint
+ * Its single replica is used in place, several are averaged once.
+ */
+class SVMScorer {
+ public:
+  explicit SVMScorer(util::Checkpoint const &ckpt) {
+    w_.size = ckpt.Dim();
+    if (ckpt.Replicas() == 1) {
+      w_.values = const_cast<double*>(ckpt.Replica(0));
+    } else {
+      avg_.resize(ckpt.Dim());
+      // as many replicas as none, so their average
+      ckpt.Restore(0, 0, &avg_[0]);
+      w_.values = &avg_[0];
+    }
+  }
+
+  /*! \brief Margin of the entries of an example, as vector::Dot() of an
+   * SVector but read from the entries in place. The label (col < 0) and the
+   * features beyond the model count 0.
+   */
+  double Score(types::Entry const *feats, size_t n) const {
+    double p = 0;
+    double const * const w = w_.values;
+    size_t const dim = w_.size;
+    for (size_t i = 0; i < n; ++i) {
+      if ((size_t) feats[i].col < dim) {
+        p += w[feats[i].col] * feats[i].rating;
+      }
+    }
+    return p;
+  }
+
+ private:
+  vector::FVector<double> w_;
+  std::vector<double> avg_;
+};
+
+/*! \brief The factors of a matrix factorization checkpoint ("mf")
+ * Entries whose row or column is not in the model are predicted the mean.
+ */
+class MFScorer {
+ public:
+  explicit MFScorer(util::Checkpoint const &ckpt) :
+      rows_(ckpt.Header().rows), cols_(ckpt.Header().cols),
+      rank_(ckpt.Dim() / (rows_ + cols_)), mean_(ckpt.Header().mean),
+      L_(ckpt.Replica(0)), R_(L_ + rows_ * rank_) { }
+
+  double Score(int row, int col) const {
+    if (row < 0 || col < 0 || (size_t) row >= rows_ || (size_t) col >= cols_) {
+      return mean_;
+    }
+    vector::FVector<double> l(const_cast<double*>(L_ + row * rank_), rank_);
+    vector::FVector<double> r(const_cast<double*>(R_ + col * rank_), rank_);
+    return vector::Dot(l, r) + mean_;
+  }
+
+ private:
+  size_t rows_, cols_, rank_;
+  double mean_;
+  double const *L_, *R_;
+};
+
+//! What Predictor writes
+enum OutputFormat {
+  kOutputTSV, //!< row and score (SVM) or row, column and score (MF)
+  kOutputBinary //!< Entry tuples as written by bin/convert, col -1 for SVM
+};
+
+/*! \brief Scores entries in parallel blocks on a thread pool
+ * The entries are cut in rounds of one block per thread. Every thread
+ * scores its block and formats the results in its own buffer, which are
+ * then written in order, so that the output follows the input.
+ */
+class Predictor {
+ public:
+  /*! \param tpool an initialized pool
+   * \param block entries a thread scores at once
+   */
+  Predictor(thread::ThreadPool &tpool, size_t block) : tpool_(tpool),
+      block_(std::max(block, (size_t) 1)), buffers_(tpool.ThreadCount()),
+      counts_(tpool.ThreadCount()), correct_(tpool.ThreadCount()),
+      labeled_(tpool.ThreadCount()), svm_(NULL), mf_(NULL) { }
+
+  //! One score per example, an example is the entries of a row
+  void PredictSVM(SVMScorer const &svm, EntryFile const &in, FILE *out,
+                  int format) {
+    svm_ = &svm;
+    mf_ = NULL;
+    Run(in, out, format);
+  }
+
+  //! One score per entry
+  void PredictMF(MFScorer const &mf, EntryFile const &in, FILE *out,
+                 int format) {
+    svm_ = NULL;
+    mf_ = &mf;
+    Run(in, out, format);
+  }
+
+  //! Scores written by the last prediction
+  uint64_t Count() const { return count_; }
+
+  //! Examples of the last PredictSVM() with a label (col < 0), and those
+  //! with the sign of the label
+  uint64_t Labeled() const { return labeled_total_; }
+  uint64_t Correct() const { return correct_total_; }
+
+ private:
+  void Run(EntryFile const &in, FILE *out, int format) {
+    entries_ = in.Entries();
+    nentries_ = in.Count();
+    format_ = format;
+    count_ = labeled_total_ = correct_total_ = 0;
+    long header = -1;
+    if (format_ == kOutputBinary) {
+      // the count is known at the end
+      header = ftell(out);
+      fwrite(&count_, sizeof(count_), 1, out);
+    }
+    size_t const nthreads = tpool_.ThreadCount();
+    for (round_ = 0; round_ < nentries_; round_ += nthreads * block_) {
+      tpool_.Execute(*this, Block);
+      tpool_.Wait();
+      for (size_t t = 0; t < nthreads; ++t) {
+        if (!buffers_[t].empty()) {
+          fwrite(&buffers_[t][0], 1, buffers_[t].size(), out);
+        }
+        count_ += counts_[t];
+        labeled_total_ += labeled_[t];
+        correct_total_ += correct_[t];
+      }
+    }
+    if (header >= 0 && fseek(out, header, SEEK_SET) == 0) {
+      fwrite(&count_, sizeof(count_), 1, out);
+      fseek(out, 0, SEEK_END);
+    }
+  }
+
+  //! First entry of the example of entry i, or i for MF
+  size_t Start(size_t i) const {
+    if (svm_ == NULL) {
+      return i;
+    }
+    while (i > 0 && i < nentries_ && entries_[i - 1].row == entries_[i].row) {
+      i++;
+    }
+    return std::min(i, nentries_);
+  }
+
+  /*! Scores the examples starting in block tid of the round, the last one
+   * may end in the next block
+   */
+  static void Block(Predictor &p, unsigned tid, unsigned /* total */) {
+    std::vector<char> &buf = p.buffers_[tid];
+    buf.clear();
+    p.counts_[tid] = p.labeled_[tid] = p.correct_[tid] = 0;
+    size_t begin = p.Start(std::min(p.round_ + tid * p.block_, p.nentries_));
+    size_t end = p.Start(std::min(p.round_ + (tid + 1) * p.block_, p.nentries_));
+    types::Entry const *e = p.entries_;
+    if (p.mf_ != NULL) {
+      for (size_t i = begin; i < end; ++i) {
+        p.Write(buf, e[i].row, e[i].col, p.mf_->Score(e[i].row, e[i].col));
+      }
+      p.counts_[tid] = end - begin;
+      return;
+    }
+    for (size_t i = begin; i < end; ) {
+      size_t j = i;
+      double label = 0;
+      while (j < end && e[j].row == e[i].row) {
+        if (e[j].col < 0) {
+          label = e[j].rating == 1.0 ? 1.0 : -1.0;
+        }
+        j++;
+      }
+      double score = p.svm_->Score(&e[i], j - i);
+      if (label != 0) {
+        p.labeled_[tid]++;
+        p.correct_[tid] += score * label > 0;
+      }
+      p.Write(buf, e[i].row, -1, score);
+      p.counts_[tid]++;
+      i = j;
+    }
+  }
+
+  //! Appends a score to a buffer in the output format
+  void Write(std::vector<char> &buf, int row, int col, double score) const {
+    if (format_ == kOutputBinary) {
+      types::Entry t;
+      t.row = row;
+      t.col = col;
+      t.rating = score;
+      char const *b = reinterpret_cast<char const*>(&t);
+      buf.insert(buf.end(), b, b + sizeof(t));
+      return;
+    }
+    char line[64];
+    int n = svm_ != NULL ? snprintf(line, sizeof(line), "%d\t%.6g\n", row, score)
+                         : snprintf(line, sizeof(line), "%d\t%d\t%.6g\n", row, col, score);
+    buf.insert(buf.end(), line, line + n);
+  }
+
+  thread::ThreadPool &tpool_;
+  size_t block_;
+  std::vector<std::vector<char> > buffers_; //!< output of each thread
+  std::vector<uint64_t> counts_; //!< scores of each thread in the round
+  std::vector<uint64_t> correct_;
+  std::vector<uint64_t> labeled_;
+  SVMScorer const *svm_; //!< the model being scored, one is NULL
+  MFScorer const *mf_;
+  types::Entry const *entries_;
+  size_t nentries_;
+  size_t round_; //!< first entry of the round
+  int format_;
+  uint64_t count_, labeled_total_, correct_total_;
+};
+
+} // namespace infer
+} // namespace hogwild
+} // namespace hazy
+#endif
@@ -18,6 +18,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <set>
+#include <string>
 #include <numa.h>
 
 #include "hazy/hogwild/hogwild-inl.h"
@@ -90,10 +91,29 @@ size_t NumaLoadSVMExamples(Scan &scan, vector::FVector<SVMExample> * nodeex, uns
 }
 
 
+/* faults in the models of the clusters in parallel, each on the threads of its
+   own cluster (a view of tpool), all the clusters at once */
+void TouchClusterModels(std::vector<util::FirstTouch> &touches, hazy::thread::ThreadPool &tpool, unsigned nthreads, unsigned cluster_size) {
+  unsigned phycpu_count = tpool.PhyCPUCount();
+  std::vector<std::vector<unsigned> > cluster_threads(touches.size());
+  for (unsigned i = 0; i < nthreads; ++i) {
+    cluster_threads[(i % phycpu_count) / cluster_size].push_back(i);
+  }
+  std::vector<hazy::thread::ThreadPool*> views;
+  for (size_t k = 0; k < touches.size(); ++k) {
+    views.push_back(new hazy::thread::ThreadPool(tpool, cluster_threads[k]));
+    touches[k].Start(*views[k]);
+  }
+  for (size_t k = 0; k < touches.size(); ++k) {
+    touches[k].Wait();
+    delete views[k];
+  }
+}
+
 /* this function creates models in a ring manner and groups cluster_size threads into a cluster, which shares a single model.
    the cluster_size variable is the "c" in HogWild++ paper.
 */
-int CreateNumaClusterRoundRobinRingSVMModel(MyNumaSVMModel * &node_m, size_t nfeats, hazy::thread::ThreadPool &tpool, unsigned nthreads, unsigned cluster_size, int update_delay) {
+int CreateNumaClusterRoundRobinRingSVMModel(MyNumaSVMModel * &node_m, size_t nfeats, hazy::thread::ThreadPool &tpool, unsigned nthreads, unsigned cluster_size, int update_delay, int huge_pages) {
   /* determine which w to access for each thread */
   int * thread_to_weights_mapping = new int[nthreads];
   unsigned phycpu_count = tpool.PhyCPUCount();
@@ -115,6 +135,7 @@ int CreateNumaClusterRoundRobinRingSVMModel(MyNumaSVMModel * &node_m, size_t nfe
   numa_run_on_node(0);
   numa_set_preferred(0);
   node_m = new MyNumaSVMModel[weights_count]; // some of them are just pointers to other weights
+  std::vector<util::FirstTouch> touches(cluster_count);
 //  printf("Model array allocated at %p\n", node_m);
 //  PrintNumaMemStats();
   for (int i = 0; i < weights_count; ++i) {
@@ -123,7 +144,7 @@ int CreateNumaClusterRoundRobinRingSVMModel(MyNumaSVMModel * &node_m, size_t nfe
     numa_run_on_node(node);
     numa_set_preferred(node);
     if (i / cluster_count == 0) {
-      node_m[i].AllocateModel(nfeats);
+      node_m[i].AllocateModel(nfeats, node, huge_pages, &touches[i]);
       *node_m[i].owner = i;
       node_m[i].peers.size = cluster_count - 1;
       node_m[i].peers.values = new int[cluster_count - 1];
@@ -152,9 +173,29 @@ int CreateNumaClusterRoundRobinRingSVMModel(MyNumaSVMModel * &node_m, size_t nfe
   }
   numa_run_on_node(-1);
   numa_set_localalloc();
+  TouchClusterModels(touches, tpool, nthreads, cluster_size);
   return weights_count;
 }
 
+/* frees the models of CreateNumaClusterRoundRobinRingSVMModel(), the first
+   nowners own their buffers and the others mirror them */
+void FreeRingSVMModel(MyNumaSVMModel * node_m, int nowners) {
+  for (int i = 0; i < nowners; ++i) {
+    node_m[i].FreeModel();
+  }
+  delete [] node_m[0].thread_to_weights_mapping;
+  delete [] node_m;
+}
+
+/* initializes the nowners models of CreateNumaClusterRoundRobinRingSVMModel()
+   from a checkpoint, with the average of its replicas when it does not have
+   as many */
+void RestoreRingSVMModel(MyNumaSVMModel * node_m, int nowners, util::Checkpoint const &ckpt) {
+  for (int i = 0; i < nowners; ++i) {
+    ckpt.Restore(i, nowners, node_m[i].weights.values);
+  }
+}
+
 int main(int argc, char** argv) {
   hazy::util::Clock wall_clock;
   wall_clock.Start();
@@ -169,6 +210,25 @@ int main(int argc, char** argv) {
   int update_delay = 256;
   double tolerance = 1e-2;
   double target_accuracy = 1.0;
+  unsigned seed = 0;
+  bool average = false;
+  double ema = 1.0;
+  int huge_pages = util::kHugePagesNone;
+  unsigned eval_threads = 0;
+  double train_sample = 0;
+  int eval_policy = kEvalEvery;
+  int eval_every = 1;
+  size_t eval_sample = 2000;
+  double converge_obj = 0;
+  double converge_grad = 0;
+  int patience = 3;
+  size_t converge_sample = 1000;
+  bool perf = false;
+  bool steal = true;
+  std::string metrics_path;
+  std::string checkpoint_path;
+  int checkpoint_every = 1;
+  std::string restore_path;
   static struct extended_option long_options[] = {
     {"mu", required_argument, NULL, 'u', "the maxnorm"},
     {"epochs"    ,required_argument, NULL, 'e', "number of epochs (default is 20)"},
@@ -183,6 +243,24 @@ int main(int argc, char** argv) {
     {"cluster_size", required_argument, NULL, 'c', "Cluster size (c). Threads in a cluster share the same weights (default: #CPU in one socket)"},
     {"tolerance", required_argument, NULL, 'o', "error tolerance when doing gradient update (default 1e-2)"},
     {"target_accuracy", required_argument,NULL, 'a', "target accuracy to converge"},
+    {"average", required_argument, NULL, 'g', "evaluate the average of all the cluster replicas (default 0)"},
+    {"ema", required_argument, NULL, 'w', "weight of the newest --average in an exponential moving average over epochs (default 1, no history)"},
+    {"eval_threads", required_argument, NULL, 'E', "evaluate each epoch on this many extra threads while the next epoch trains (default 0)"},
+    {"eval", required_argument, NULL, 'V', "epochs scored: every (--eval_every), sample (--eval_sample, all of the test set near the target) or adaptive (default every)"},
+    {"eval_every", required_argument, NULL, 'K', "score every k epochs, with --eval adaptive at most every 8k (default 1)"},
+    {"eval_sample", required_argument, NULL, 'Q', "test examples scored by --eval sample (default 2000)"},
+    {"converge_obj", required_argument, NULL, 'O', "stop when the training objective decreases by less than this fraction for --patience epochs (default 0, off)"},
+    {"converge_grad", required_argument, NULL, 'G', "stop when the gradient norm of a training sample is below this for --patience epochs (default 0, off)"},
+    {"patience", required_argument, NULL, 'T', "flat epochs in a row before --converge_obj or --converge_grad stop (default 3)"},
+    {"converge_sample", required_argument, NULL, 'D', "training examples of the --converge_grad estimate (default 1000)"},
+    {"train_sample", required_argument, NULL, 'S', "fraction of the training examples also scored after each epoch (default 0, train_acc repeats test_acc)"},
+    {"perf", required_argument, NULL, 'P', "print the hardware performance counters of every training thread after each epoch (default 0)"},
+    {"metrics", required_argument, NULL, 'M', "write one JSON line per run and per epoch to this file, - for stdout"},
+    {"checkpoint", required_argument, NULL, 'B', "write the replicas, step size, epoch and random state to this binary file while training"},
+    {"checkpoint_every", required_argument, NULL, 'F', "epochs between two --checkpoint, the last epoch is always saved (default 1)"},
+    {"restore", required_argument, NULL, 'I', "resume from a --checkpoint file, averaging its replicas if there are not as many"},
+    {"hugepages", required_argument, NULL, 'H', "pages of the models: none, thp (transparent), 2m or 1g (reserved hugetlbfs pages) (default none)"},
+    {"steal", required_argument, NULL, 'f', "balance the examples between the threads by work stealing (default 1)"},
     {NULL,0,NULL,0,0} 
   };
 
@@ -225,6 +303,71 @@ int main(int argc, char** argv) {
       case 'a':
         target_accuracy = atof(optarg);
         break;
+      case 's':
+        seed = strtoul(optarg, NULL, 10);
+        break;
+      case 'g':
+        average = (atoi(optarg) != 0);
+        break;
+      case 'w':
+        ema = atof(optarg);
+        break;
+      case 'E':
+        eval_threads = atoi(optarg);
+        break;
+      case 'V':
+        eval_policy = ParseEvalPolicy(optarg);
+        if (eval_policy < 0) {
+          printf("Unknown evaluation policy %s\n", optarg);
+          exit(-1);
+        }
+        break;
+      case 'K':
+        eval_every = atoi(optarg);
+        break;
+      case 'Q':
+        eval_sample = atol(optarg);
+        break;
+      case 'O':
+        converge_obj = atof(optarg);
+        break;
+      case 'G':
+        converge_grad = atof(optarg);
+        break;
+      case 'T':
+        patience = atoi(optarg);
+        break;
+      case 'D':
+        converge_sample = atol(optarg);
+        break;
+      case 'S':
+        train_sample = atof(optarg);
+        break;
+      case 'P':
+        perf = atoi(optarg);
+        break;
+      case 'M':
+        metrics_path = optarg;
+        break;
+      case 'B':
+        checkpoint_path = optarg;
+        break;
+      case 'F':
+        checkpoint_every = atoi(optarg);
+        break;
+      case 'I':
+        restore_path = optarg;
+        break;
+      case 'f':
+        steal = (atoi(optarg) != 0);
+        break;
+      case 'H':
+        huge_pages = util::ParseHugePages(optarg);
+        if (huge_pages < 0) {
+          printf("Unknown huge page policy %s\n", optarg);
+          exit(-1);
+        }
+        break;
       case ':':
       case '?':
         print_usage(long_options, argv[0], usage_str);
@@ -242,12 +385,39 @@ int main(int argc, char** argv) {
     print_usage(long_options, argv[0], usage_str);
     exit(-1);
   }
+  if (seed == 0) {
+    util::SimpleRandom::SeedByTime();
+    seed = util::SimpleRandom::Seed();
+  }
+  // each run is seeded from a stream of its own
+  printf("seed: %u\n", seed);
   //fp_type buf[50];
 
   // we initialize thread pool here because we need CPU topology information
   // in HogWild++, the ThreadPool has been improved to assign CPU affinity
   hazy::thread::ThreadPool tpool(nthreads);
   tpool.Init();
+  hazy::thread::ThreadPool *eval_pool = NULL;
+  if (eval_threads > 0) {
+    // on the CPUs the training leaves, or behind the training threads
+    eval_pool = new hazy::thread::ThreadPool(eval_threads);
+    std::vector<int> spare = tpool.UnusedCPUs();
+    if (!spare.empty()) {
+      eval_pool->SetCPUList(spare);
+    }
+    else {
+      eval_pool->SetNice(19);
+    }
+    eval_pool->Init();
+  }
+  util::PerfCounters *perf_counters = NULL;
+  if (perf) {
+    perf_counters = new util::PerfCounters(tpool);
+  }
+  util::MetricsSink *metrics = NULL;
+  if (!metrics_path.empty()) {
+    metrics = new util::MetricsSink(metrics_path);
+  }
   
   unsigned nnodes = tpool.UsedNodeCount();
   printf("%d threads will be running on %d nodes\n", nthreads, nnodes);
@@ -287,28 +457,105 @@ int main(int argc, char** argv) {
     degs[i] = 0;
   }
   CountDegrees(node_train_examps[0], degs);
+  if (huge_pages != util::kHugePagesNone) {
+    PackNodeSVMExamples(node_train_examps, nnodes, -1, huge_pages);
+    PackNodeSVMExamples(node_test_examps, nnodes, -1, huge_pages);
+  }
+  util::Checkpoint restore;
+  if (!restore_path.empty()) {
+    if (!restore.Open(restore_path)) {
+      exit(-1);
+    }
+    if (restore.Dim() != nfeats) {
+      printf("%s has %lu features, the data %lu\n", restore_path.c_str(),
+             restore.Dim(), nfeats);
+      exit(-1);
+    }
+    printf("Restoring %lu replicas at epoch %d from %s\n", restore.Replicas(),
+           restore.Epoch(), restore_path.c_str());
+  }
+  util::CheckpointWriter *checkpoint = NULL;
+  if (!checkpoint_path.empty()) {
+    checkpoint = new util::CheckpointWriter(checkpoint_path);
+  }
 
   for (int iteration = 0; iteration < ITERATIONS; ++iteration) {
+    util::SimpleRandom::SetSeed(util::SimpleRandom::StreamSeed(seed, iteration));
     MyNumaSVMModel* node_m;
     int weights_count;
     fp_type beta = 0.0, lambda = 0.5;
     if (cluster_size <= 0) {
         cluster_size = tpool.PhyCPUCount() / tpool.NodeCount();
     }
-    weights_count = CreateNumaClusterRoundRobinRingSVMModel(node_m, nfeats, tpool, nthreads, cluster_size,update_delay);
+    weights_count = CreateNumaClusterRoundRobinRingSVMModel(node_m, nfeats, tpool, nthreads, cluster_size,update_delay, huge_pages);
 //    PrintWeights(node_m, weights_count, nthreads, tpool);
     SVMParams tp(step_size, step_decay, mu, beta, lambda, weights_count, true, update_delay, tolerance, &tpool);
     tp.degrees = degs;
     tp.ndim = nfeats;
+    tp.steal = steal;
+    if (!restore_path.empty()) {
+      RestoreRingSVMModel(node_m, weights_count / cluster_size, restore);
+      tp.step_size = restore.StepSize();
+      restore.RestoreRandom();
+    }
 
 //  hogwild::freeforall::FeedTrainTest(memfeed.GetTrough(), nepochs, nthreads);
-    NumaMemoryScan<SVMExample> mscan(node_train_examps, nnodes);
+    NumaMemoryScan<SVMExample> mscan(node_train_examps, nnodes, huge_pages);
+    ModelSnapshot<fp_type> *snapshot = NULL;
+    if (average) {
+      snapshot = new ModelSnapshot<fp_type>(nfeats, ema);
+      for (int i = 0; i < weights_count; ++i) {
+        snapshot->AddReplica(node_m[i].weights.values);
+      }
+      node_m[0].snapshot = snapshot;
+      printf("Evaluating the average of %lu replicas, ema=%g\n", snapshot->ReplicaCount(), ema);
+    }
+    else if (eval_pool != NULL) {
+      // the evaluation runs during the next epoch, on a copy of the model
+      // the synchronous accuracy reads, see EvalWeights()
+      snapshot = new ModelSnapshot<fp_type>(nfeats, 1.0);
+      snapshot->AddReplica(node_m[0].weights.values);
+      node_m[0].snapshot = snapshot;
+    }
     Hogwild<MyNumaSVMModel, SVMParams, MyNumaSVMExec> hw(node_m[0], tp, tpool);
-    NumaMemoryScan<SVMExample> tscan(node_test_examps, nnodes);
+    hw.SetEvalPool(eval_pool);
+    hw.SetPerfCounters(perf_counters);
+    hw.SetMetrics(metrics);
+    hw.SetTrainSample(train_sample);
+    hw.SetEvalPolicy(eval_policy, eval_every, eval_sample);
+    hw.SetConvergence(converge_obj, converge_grad, patience, converge_sample);
+    hw.SetCheckpoint(checkpoint, checkpoint_every);
+    if (!restore_path.empty()) {
+      hw.SetStartEpoch(restore.Epoch());
+    }
+    NumaMemoryScan<SVMExample> tscan(node_test_examps, nnodes, huge_pages, false);
     printf("Run experiment: threads=%d c=%d\n", nthreads, cluster_size);
     fflush(stdout);
+    if (metrics != NULL) {
+      util::MetricsRecord rec("run");
+      rec.Add("program", "mysvm");
+      rec.Add("iteration", iteration);
+      rec.Add("seed", util::SimpleRandom::Seed());
+      rec.Add("threads", nthreads);
+      rec.Add("nodes", nnodes);
+      rec.Add("clusters", weights_count);
+      rec.Add("cluster_size", cluster_size);
+      rec.Add("update_delay", update_delay);
+      rec.Add("tolerance", tolerance);
+      rec.Add("step_size", (double) step_size);
+      rec.Add("step_decay", (double) step_decay);
+      rec.Add("examples", node_train_examps[0].size);
+      rec.Add("features", nfeats);
+      metrics->Write(rec);
+    }
     hw.RunExperiment(nepochs, wall_clock, mscan, tscan, target_accuracy);
+    delete snapshot;
+    FreeRingSVMModel(node_m, weights_count / cluster_size);
   }
+  delete checkpoint;
+  delete eval_pool;
+  delete perf_counters;
+  delete metrics;
   return 0;
 }
 
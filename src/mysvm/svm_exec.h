@@ -19,13 +19,19 @@
 #ifndef HAZY_HOGWILD_INSTANCES_SVM_SVM_EXEC_H
 #define HAZY_HOGWILD_INSTANCES_SVM_SVM_EXEC_H
 
+#include <algorithm>
 #include <cmath>
+#include <vector>
 
 #include "hazy/hogwild/hogwild_task.h"
 #include "hazy/vector/dot-inl.h"
 #include "hazy/vector/scale_add-inl.h"
 #include "hazy/hogwild/tools-inl.h"
+#include "hazy/hogwild/freeforall-inl.h"
 #include "hazy/util/clock.h"
+#include "hazy/util/checkpoint.h"
+#include "hazy/util/metrics.h"
+#include "../svm/gradient_norm.h"
 
 #include <numa.h>
 #include <sched.h>
@@ -72,11 +78,34 @@ public:
   //! Invoked after each training epoch, causes the stepsize to decay
   static void PostUpdate(MyNumaSVMModel& model, SVMParams& params);
 
+  //! Invoked after each training epoch, before the evaluation
   static void PostEpoch(MyNumaSVMModel& model, SVMParams& params) {
+    if (model.snapshot != NULL) {
+      model.snapshot->Update(*params.tpool);
+    }
+  }
+
+  //! Adds the counters of the last epoch to its metrics, before PostEpoch
+  static void EpochMetrics(MyNumaSVMModel &model, SVMParams &params,
+                           util::MetricsRecord &epoch,
+                           std::vector<util::MetricsRecord> &threads) {
   }
 
   static double ModelObj(MySVMTask& task, unsigned tid, unsigned total);
 
+  /*! \brief Norm of the average stochastic gradient of the examples
+   * The gradients of the hinge loss and of the share of the regularization
+   * ModelUpdate() applies, at the model that is evaluated.
+   */
+  static double GradientNorm(const MyNumaSVMModel &model, const SVMParams &params,
+                             std::vector<SVMExample const *> const &sample);
+
+  /*! \brief Saves the replicas of the model, each once, see
+   * Hogwild::SetCheckpoint()
+   */
+  static void SaveCheckpoint(MyNumaSVMModel &model, SVMParams &params,
+                             int epoch, util::CheckpointWriter &writer);
+
   static double ModelAccuracy(MySVMTask& task, unsigned tid, unsigned total);
 
 private:
@@ -95,16 +124,21 @@ namespace hazy {
 namespace hogwild {
 namespace svm {
 
+//! The weights evaluated for model, its replica average if it has one
+inline vector::FVector <fp_type> const& EvalWeights(const MyNumaSVMModel& model) {
+  return model.snapshot != NULL ? model.snapshot->weights : model.weights;
+}
+
 fp_type inline ComputeLoss(const SVMExample& e, const MyNumaSVMModel& model) {
   // determine how far off our model is for this example
-  vector::FVector <fp_type> const& w = model.weights;
+  vector::FVector <fp_type> const& w = EvalWeights(model);
   fp_type dot = vector::Dot(w, e.vector);
   return std::max(1 - dot * e.value, static_cast<fp_type>(0.0));
 }
 
 int inline MyNumaSVMExec::ComputeAccuracy(const SVMExample& e, const MyNumaSVMModel& model) {
   // determine how far off our model is for this example
-  vector::FVector <fp_type> const& w = model.weights;
+  vector::FVector <fp_type> const& w = EvalWeights(model);
   fp_type dot = vector::Dot(w, e.vector);
   return !!std::max(dot * e.value, static_cast<fp_type>(0.0));
 }
@@ -146,7 +180,7 @@ bool CheckSync(MyNumaSVMModel* model, MyNumaSVMModel* next_model) {
 /* this is the core function, for updating the model */
 int inline ModelUpdate(const SVMExample& examp, const SVMParams& params,
                        MyNumaSVMModel* model, MyNumaSVMModel* models, int tid, int weights_index, int iter, int& update_atomic_counter,
-                       bool can_sync) {
+                       bool can_sync, unsigned &rng) {
   int sync_counter = 0;
   vector::FVector <fp_type>& w = model->weights;
 
@@ -172,7 +206,7 @@ int inline ModelUpdate(const SVMExample& examp, const SVMParams& params,
 
   if (can_sync) {
       if (update_atomic_counter < 0 && model->IsOwner()) {
-          int peer = model->RandomPeer();
+          int peer = model->RandomPeer(rng);
           MyNumaSVMModel* next_model = &models[peer];
           CheckSync(model, next_model);
           model->SetNextOwner();
@@ -206,22 +240,27 @@ double MyNumaSVMExec::UpdateModel(MySVMTask& task, unsigned tid, unsigned total)
   SVMParams const& params = *task.params;
   // Select the example vector array based on current node
   vector::FVector <SVMExample> const& exampsvec = task.block[node].ex;
-  // calculate which chunk of examples we work on
-  size_t start = hogwild::GetStartIndex(exampsvec.size, tid, total);
-  size_t end = hogwild::GetEndIndex(exampsvec.size, tid, total);
+  // the chunks of examples we work on, see ChunkScheduler
+  ExampleRanges ranges(task.params->steal ? task.sched : NULL, exampsvec.size, tid, total);
   // optimize for const pointers
   // Seclect the pointers based on current node
-  size_t* perm = task.block[node].perm.values;
+  perm_type const *perm = task.block[node].perm.values;
   SVMExample const* const examps = exampsvec.values;
   // individually update the model for each example
   int weights_index = model.thread_to_weights_mapping[tid];
   MyNumaSVMModel* const m = &task.model[weights_index];
   int update_atomic_counter = m->update_atomic_counter;
   int sync_counter = 0;
-  bool canSync = m->RandomPeer() != -1;
-  for (unsigned i = start; i < end; i++) {
-    size_t indirect = perm[i];
-    sync_counter += ModelUpdate(examps[indirect], params, m, task.model, tid, weights_index, i - start, update_atomic_counter, canSync);
+  bool canSync = m->peers.size != 0;
+  // the peers of each thread are drawn from a stream of its own, advanced
+  // with the epochs by the shuffles of the main thread
+  unsigned rng = util::SimpleRandom::StreamSeed(util::SimpleRandom::Seed(), tid);
+  size_t start, end, count = 0;
+  while (ranges.Next(start, end)) {
+    for (size_t i = start; i < end; i++) {
+      size_t indirect = perm[i];
+      sync_counter += ModelUpdate(examps[indirect], params, m, task.model, tid, weights_index, count++, update_atomic_counter, canSync, rng);
+    }
   }
   // Save states
   m->update_atomic_counter = update_atomic_counter;
@@ -234,6 +273,8 @@ double MyNumaSVMExec::UpdateModel(MySVMTask& task, unsigned tid, unsigned total)
 int MyNumaSVMExec::GetLatestModel(MySVMTask& task, unsigned tid, unsigned total) {
     MyNumaSVMModel* models = task.model;
     SVMParams* params = task.params;
+    // the head model evaluates its snapshot, see PostEpoch()
+    if (models[0].snapshot != NULL) return 0;
     int max_value = 0;
     int max_index = 0;
     for (int i = 0; i < params->weights_count; ++i) {
@@ -255,17 +296,19 @@ double MyNumaSVMExec::TestModel(MySVMTask& task, unsigned tid, unsigned total) {
   // Select the example vector array based on current node
   vector::FVector <SVMExample> const& exampsvec = task.block[node].ex;
 
-  // calculate which chunk of examples we work on
-  size_t start = hogwild::GetStartIndex(exampsvec.size, tid, total);
-  size_t end = hogwild::GetEndIndex(exampsvec.size, tid, total);
+  // the chunks of examples we work on, see ChunkScheduler
+  ExampleRanges ranges(task.params->steal ? task.sched : NULL, exampsvec.size, tid, total);
 
   // keep const correctness
   SVMExample const* const examps = exampsvec.values;
   fp_type loss = 0.0;
   // compute the loss for each example
-  for (unsigned i = start; i < end; i++) {
-    fp_type l = ComputeLoss(examps[i], model);
-    loss += l;
+  size_t start, end;
+  while (ranges.Next(start, end)) {
+    for (size_t i = start; i < end; i++) {
+      fp_type l = ComputeLoss(examps[i], model);
+      loss += l;
+    }
   }
   // return the number of examples we used and the sum of the loss
   //counted = end-start;
@@ -280,18 +323,20 @@ double MyNumaSVMExec::ModelAccuracy(MySVMTask& task, unsigned tid, unsigned tota
   // Select the example vector array based on current node
   vector::FVector <SVMExample> const& exampsvec = task.block[node].ex;
 
-  // calculate which chunk of examples we work on
-  size_t start = hogwild::GetStartIndex(exampsvec.size, tid, total);
-  size_t end = hogwild::GetEndIndex(exampsvec.size, tid, total);
+  // the chunks of examples we work on, see ChunkScheduler
+  ExampleRanges ranges(task.params->steal ? task.sched : NULL, exampsvec.size, tid, total);
 
   // keep const correctness
   SVMExample const* const examps = exampsvec.values;
   // return the number of examples we used and the sum of the loss
   int correct = 0;
   // compute the loss for each example
-  for (unsigned i = start; i < end; i++) {
-    int l = ComputeAccuracy(examps[i], model);
-    correct += l;
+  size_t start, end;
+  while (ranges.Next(start, end)) {
+    for (size_t i = start; i < end; i++) {
+      int l = ComputeAccuracy(examps[i], model);
+      correct += l;
+    }
   }
   //counted = end-start;
   return correct;
@@ -305,21 +350,24 @@ double MyNumaSVMExec::ModelObj(MySVMTask& task, unsigned tid, unsigned total) {
   // Select the example vector array based on current node
   vector::FVector <SVMExample> const& exampsvec = task.block[node].ex;
 
-  // calculate which chunk of examples we work on
-  size_t start = hogwild::GetStartIndex(exampsvec.size, tid, total);
-  size_t end = hogwild::GetEndIndex(exampsvec.size, tid, total);
+  // the chunks of examples we work on, see ChunkScheduler
+  ExampleRanges ranges(task.params->steal ? task.sched : NULL, exampsvec.size, tid, total);
 
   // keep const correctness
   SVMExample const* const examps = exampsvec.values;
   fp_type loss = 0.0;
   // compute the loss for each example
-  for (unsigned i = start; i < end; i++) {
-    fp_type l = ComputeLoss(examps[i], model);
-    loss += l;
+  size_t start, end;
+  while (ranges.Next(start, end)) {
+    for (size_t i = start; i < end; i++) {
+      fp_type l = ComputeLoss(examps[i], model);
+      loss += l;
+    }
   }
-  start = hogwild::GetStartIndex(model.weights.size, tid, total);
-  end = hogwild::GetEndIndex(model.weights.size, tid, total);
-  double const* const weights = model.weights.values;
+  vector::FVector <fp_type> const& w = EvalWeights(model);
+  start = hogwild::GetStartIndex(w.size, tid, total);
+  end = hogwild::GetEndIndex(w.size, tid, total);
+  double const* const weights = w.values;
   fp_type reg = 0.0;
   // compute the regularization term
   for (unsigned i = start; i < end; ++i) {
@@ -330,6 +378,24 @@ double MyNumaSVMExec::ModelObj(MySVMTask& task, unsigned tid, unsigned total) {
   return loss + 0.5 * reg;
 }
 
+double MyNumaSVMExec::GradientNorm(const MyNumaSVMModel &model, const SVMParams &params,
+                           std::vector<SVMExample const *> const &sample) {
+  return SampledGradientNorm(model.weights, params.mu, params.degrees, sample);
+}
+
+void MyNumaSVMExec::SaveCheckpoint(MyNumaSVMModel &model, SVMParams &params,
+                                   int epoch, util::CheckpointWriter &writer) {
+  // the mirrors share the buffer of their owner
+  std::vector<fp_type const *> replicas;
+  for (int i = 0; i < params.weights_count; ++i) {
+    fp_type const *w = (&model)[i].weights.values;
+    if (std::find(replicas.begin(), replicas.end(), w) == replicas.end()) {
+      replicas.push_back(w);
+    }
+  }
+  writer.Save("svm", epoch, params.step_size, replicas, model.weights.size);
+}
+
 
 } // namespace svm
 } // namespace hogwild
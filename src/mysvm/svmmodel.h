@@ -49,19 +49,43 @@ struct MyNumaSVMModel {
   int update_atomic_counter;
   int * thread_to_weights_mapping;
   int cluster_size;
+  //! Average of the replicas evaluated instead of this model, may be NULL
+  ModelSnapshot<fp_type> * snapshot;
+  //! Pages of the weights allocated by AllocateModel(), see util::HugePages
+  int huge_pages;
 
-  explicit MyNumaSVMModel() {
+  explicit MyNumaSVMModel() : snapshot(NULL), huge_pages(util::kHugePagesNone) {
   }
 
-  void AllocateModel(unsigned dim) {
+  /*! Allocates the zeroed model, see NumaSVMModel::AllocateModel()
+   */
+  void AllocateModel(unsigned dim, int node = -1,
+                     int huge_pages = util::kHugePagesNone,
+                     util::FirstTouch *touch = NULL) {
     has_synced = new int(0);
     lock = new int(0);
     owner = new int();
+    size_t bytes = sizeof(fp_type) * dim;
+    this->huge_pages = huge_pages;
     weights.size = dim;
-    weights.values = new fp_type[dim];
-    for (unsigned i = dim; i-- > 0; ) {
-      weights.values[i] = 0;
+    weights.values = static_cast<fp_type*>(util::NumaAlloc(bytes, node, huge_pages));
+    if (touch != NULL) {
+      touch->Add(weights.values, bytes);
     }
+    else {
+      memset(weights.values, 0, bytes);
+    }
+  }
+
+  //! Frees the buffers of AllocateModel(), not to be called on a mirror
+  void FreeModel() {
+    util::NumaFree(weights.values, sizeof(fp_type) * weights.size, huge_pages);
+    weights.values = NULL;
+    delete has_synced;
+    delete lock;
+    delete owner;
+    delete [] peers.values;
+    peers.values = NULL;
   }
 
   void MirrorModel(MyNumaSVMModel const &m) {
@@ -102,9 +126,10 @@ struct MyNumaSVMModel {
     return *lock == 1;
   }
 
-  inline int RandomPeer() const {
+  //! A peer drawn with rng, a state of util::SimpleRandom::RandInt()
+  inline int RandomPeer(unsigned &rng) const {
     if (peers.size == 0) return -1;
-    return peers.values[util::SimpleRandom::GetInstance().RandInt(peers.size)];
+    return peers.values[util::SimpleRandom::RandInt(rng, peers.size)];
   }
 };
 
@@ -0,0 +1,243 @@
+// Copyright 2012 Victor Bittorf, Chris Re
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Hogwild!, part of the Hazy Project
+// Author : Victor Bittorf (bittorf [at] cs.wisc.edu)
+// Original Hogwild! Author: Chris Re (chrisre [at] cs.wisc.edu)
+
+#ifndef HAZY_HOGWILD_INSTANCES_NUMASVM_DELTA_CODEC_H
+#define HAZY_HOGWILD_INSTANCES_NUMASVM_DELTA_CODEC_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+
+namespace hazy {
+namespace hogwild {
+namespace svm {
+
+//! How the model delta is encoded when it is sent to the next cluster
+enum DeltaCompression {
+  kCompressNone = 0, //!< write full precision deltas into the next model
+  kCompressQ8 = 1, //!< 8-bit stochastic quantization, one scale per block
+  kCompressTopK = 2 //!< only the k largest deltas, as (index, float) pairs
+};
+
+//! Number of coordinates sharing one scale in kCompressQ8
+static const unsigned kQ8BlockSize = 256;
+
+/*! \brief Parses the value of the --compress option, exits on error */
+inline int ParseDeltaCompression(const char *s) {
+  if (strcmp(s, "none") == 0 || strcmp(s, "0") == 0) return kCompressNone;
+  if (strcmp(s, "q8") == 0) return kCompressQ8;
+  if (strcmp(s, "topk") == 0) return kCompressTopK;
+  printf("Unknown compression `%s', expected none, q8 or topk\n", s);
+  exit(-1);
+}
+
+/*! \brief Mailbox holding one compressed delta, plus the sender scratch.
+ * Every cluster owns one exchange. The payload part is written by the
+ * previous cluster in the ring while it holds the token, and is drained by
+ * the owner when the token reaches it, so the two never overlap. The
+ * exchange is allocated on the owner's node, so only the compressed payload
+ * crosses the interconnect. The scratch part is only used by the owner when
+ * it sends to the next cluster.
+ */
+struct DeltaExchange {
+  int mode; //!< one of DeltaCompression
+  unsigned dim; //!< model dimension
+  unsigned nblocks; //!< number of q8 blocks
+  unsigned capacity; //!< max number of top-k pairs
+  volatile int pending; //!< a payload is waiting to be drained
+  size_t count; //!< number of top-k pairs in the payload
+  // payload
+  float *scales; //!< q8: per-block scale, 0 if the block was skipped
+  int8_t *codes; //!< q8: quantized deltas
+  uint32_t *index; //!< top-k: coordinates
+  float *values; //!< top-k: deltas
+  // sender scratch
+  double *delta; //!< the sender's delta, including the unsent residual
+  double *decoded; //!< the delta as the receiver will decode it
+  float *mag; //!< top-k: magnitudes for the selection
+  uint64_t rng; //!< state for stochastic rounding
+
+  DeltaExchange() : mode(kCompressNone), dim(0), nblocks(0), capacity(0),
+      pending(0), count(0), scales(NULL), codes(NULL), index(NULL),
+      values(NULL), delta(NULL), decoded(NULL), mag(NULL), rng(0) { }
+
+  ~DeltaExchange() {
+    delete [] scales;
+    delete [] codes;
+    delete [] index;
+    delete [] values;
+    delete [] delta;
+    delete [] decoded;
+    delete [] mag;
+  }
+
+  /*! \brief Allocates the buffers, touching them from the calling thread.
+   * \param dim_ the model dimension
+   * \param mode_ one of DeltaCompression
+   * \param topk_ratio fraction of coordinates sent by kCompressTopK
+   * \param seed seed of the stochastic rounding
+   */
+  void Allocate(unsigned dim_, int mode_, double topk_ratio, uint64_t seed) {
+    mode = mode_;
+    dim = dim_;
+    rng = seed * 2654435761u + 1;
+    delta = new double[dim];
+    decoded = new double[dim];
+    memset(delta, 0, sizeof(double) * dim);
+    memset(decoded, 0, sizeof(double) * dim);
+    if (mode == kCompressQ8) {
+      nblocks = (dim + kQ8BlockSize - 1) / kQ8BlockSize;
+      scales = new float[nblocks];
+      codes = new int8_t[dim];
+      memset(scales, 0, sizeof(float) * nblocks);
+      memset(codes, 0, sizeof(int8_t) * dim);
+    } else if (mode == kCompressTopK) {
+      capacity = std::max(1u, (unsigned) ceil(topk_ratio * dim));
+      capacity = std::min(capacity, dim);
+      index = new uint32_t[capacity];
+      values = new float[capacity];
+      mag = new float[dim];
+      memset(index, 0, sizeof(uint32_t) * capacity);
+      memset(values, 0, sizeof(float) * capacity);
+      memset(mag, 0, sizeof(float) * dim);
+    }
+  }
+
+  inline double Uniform() {
+    // xorshift64*, only used to dither the quantization
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return ((rng * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+ private:
+  // owns its buffers
+  DeltaExchange(DeltaExchange const &);
+  void operator=(DeltaExchange const &);
+};
+
+/*! \brief Encodes the sender's delta into the receiver's mailbox.
+ * src.delta must hold the raw delta (including the previously unsent
+ * residual) of every coordinate. On return src.decoded holds the delta d^
+ * that the receiver will see, and src.delta the residual delta - d^, which
+ * the caller keeps as error feedback. Coordinates whose delta is within
+ * tolerance are never sent.
+ * \param src the sender's exchange (scratch)
+ * \param dst the receiver's exchange (payload)
+ * \param tolerance deltas at most this large are not sent
+ * \param sent number of coordinates sent
+ * \return bytes written into dst
+ */
+inline size_t EncodeDelta(DeltaExchange &src, DeltaExchange &dst,
+                          double tolerance, size_t &sent) {
+  unsigned const dim = src.dim;
+  double * const d = src.delta;
+  double * const dhat = src.decoded;
+  sent = 0;
+  size_t bytes = 0;
+  if (src.mode == kCompressQ8) {
+    for (unsigned b = 0; b < src.nblocks; ++b) {
+      unsigned const start = b * kQ8BlockSize;
+      unsigned const end = std::min(start + kQ8BlockSize, dim);
+      double amax = 0;
+      for (unsigned i = start; i < end; ++i) {
+        amax = std::max(amax, fabs(d[i]));
+      }
+      if (amax <= tolerance) {
+        // nothing worth sending, the whole block stays in the residual
+        dst.scales[b] = 0;
+        for (unsigned i = start; i < end; ++i) dhat[i] = 0;
+        continue;
+      }
+      float const scale = (float) (amax / 127);
+      dst.scales[b] = scale;
+      for (unsigned i = start; i < end; ++i) {
+        double q = floor(d[i] / scale + src.Uniform());
+        q = std::min(std::max(q, -127.0), 127.0);
+        dst.codes[i] = (int8_t) q;
+        dhat[i] = q * scale;
+        d[i] -= dhat[i];
+      }
+      sent += end - start;
+      bytes += end - start;
+    }
+    bytes += sizeof(float) * src.nblocks;
+  } else {
+    // pick the threshold of the k-th largest magnitude
+    unsigned const k = dst.capacity;
+    float * const mag = src.mag;
+    for (unsigned i = 0; i < dim; ++i) {
+      mag[i] = (float) fabs(d[i]);
+    }
+    std::nth_element(mag, mag + (dim - k), mag + dim);
+    float const thresh = mag[dim - k];
+    size_t n = 0;
+    for (unsigned i = 0; i < dim; ++i) {
+      dhat[i] = 0;
+      if (n < k && (float) fabs(d[i]) >= thresh && fabs(d[i]) > tolerance) {
+        float const v = (float) d[i];
+        dst.index[n] = i;
+        dst.values[n] = v;
+        dhat[i] = v;
+        d[i] -= v;
+        n++;
+      }
+    }
+    dst.count = n;
+    sent = n;
+    bytes = n * (sizeof(uint32_t) + sizeof(float));
+  }
+  dst.pending = 1;
+  return bytes;
+}
+
+/*! \brief Applies a pending payload to the owner's weights: w += scale * d^
+ * \param ex the owner's exchange
+ * \param w the owner's weights, length ex.dim
+ * \param scale the ring's beta
+ */
+inline void DrainDelta(DeltaExchange &ex, double *w, double scale) {
+  if (!ex.pending) {
+    return;
+  }
+  if (ex.mode == kCompressQ8) {
+    for (unsigned b = 0; b < ex.nblocks; ++b) {
+      double const s = ex.scales[b] * scale;
+      if (s == 0) continue;
+      unsigned const start = b * kQ8BlockSize;
+      unsigned const end = std::min(start + kQ8BlockSize, ex.dim);
+      for (unsigned i = start; i < end; ++i) {
+        w[i] += s * ex.codes[i];
+      }
+    }
+  } else {
+    for (size_t n = 0; n < ex.count; ++n) {
+      w[ex.index[n]] += scale * ex.values[n];
+    }
+  }
+  ex.pending = 0;
+}
+
+} // namespace svm
+} // namespace hogwild
+} // namespace hazy
+#endif
@@ -0,0 +1,113 @@
+// Copyright 2012 Victor Bittorf, Chris Re
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Hogwild!, part of the Hazy Project
+// Author : Victor Bittorf (bittorf [at] cs.wisc.edu)
+// Original Hogwild! Author: Chris Re (chrisre [at] cs.wisc.edu)
+
+#ifndef HAZY_HOGWILD_INSTANCES_NUMASVM_MODEL_SNAPSHOT_H
+#define HAZY_HOGWILD_INSTANCES_NUMASVM_MODEL_SNAPSHOT_H
+
+#include <numa.h>
+#include <vector>
+#include <algorithm>
+
+#include "hazy/vector/fvector.h"
+#include "hazy/hogwild/tools-inl.h"
+#include "hazy/thread/thread_pool.h"
+
+namespace hazy {
+namespace hogwild {
+namespace svm {
+
+/*! \brief Average of all the cluster replicas, used to evaluate the model.
+ * Every replica of the ring sees only part of the updates until the token
+ * carried them around, so their average is a better estimate of the model
+ * than any single replica. With ema < 1 the snapshot also keeps an
+ * exponential moving average over the calls to Update() (Polyak averaging):
+ *   snapshot = ema * mean(replicas) + (1 - ema) * snapshot
+ * The buffer is interleaved over the nodes, so that the threads averaging
+ * it and the threads evaluating it all read at the same speed.
+ */
+template <class T>
+class ModelSnapshot {
+ public:
+  //! The averaged model, valid after the first Update()
+  vector::FVector<T> weights;
+
+  /*! \param dim length of the replicas
+   * \param ema weight of the newest average, 1 keeps no history
+   */
+  ModelSnapshot(unsigned dim, double ema) : ema_(ema), updates_(0) {
+    weights.size = dim;
+    weights.values = static_cast<T*>(numa_alloc_interleaved(sizeof(T) * dim));
+    std::fill(weights.values, weights.values + dim, static_cast<T>(0));
+  }
+
+  ~ModelSnapshot() {
+    numa_free(weights.values, sizeof(T) * weights.size);
+  }
+
+  /*! Adds a replica to the average. Mirrored models share their buffer,
+   * so a buffer that was already added is ignored.
+   */
+  void AddReplica(T const *values) {
+    if (std::find(replicas_.begin(), replicas_.end(), values) == replicas_.end()) {
+      replicas_.push_back(values);
+    }
+  }
+
+  //! Number of distinct replicas in the average
+  size_t ReplicaCount() const { return replicas_.size(); }
+
+  /*! Averages the replicas into the snapshot, on all the threads of tpool.
+   * Training keeps writing the replicas racily, as in Hogwild!.
+   */
+  void Update(thread::ThreadPool &tpool) {
+    tpool.Execute(*this, Average);
+    tpool.Wait();
+    updates_++;
+  }
+
+  //! Forgets the history, the next Update() only holds the current average
+  void Reset() { updates_ = 0; }
+
+ private:
+  //! Averages the chunk of coordinates of thread tid
+  static void Average(ModelSnapshot &s, unsigned tid, unsigned total) {
+    size_t start = hogwild::GetStartIndex(s.weights.size, tid, total);
+    size_t end = hogwild::GetEndIndex(s.weights.size, tid, total);
+    size_t const n = s.replicas_.size();
+    T const * const * const reps = &s.replicas_[0];
+    T * const snap = s.weights.values;
+    double const scale = 1.0 / n;
+    double const alpha = s.updates_ == 0 ? 1.0 : s.ema_;
+    for (size_t i = start; i < end; ++i) {
+      double sum = 0;
+      for (size_t r = 0; r < n; ++r) {
+        sum += reps[r][i];
+      }
+      snap[i] = alpha * sum * scale + (1 - alpha) * snap[i];
+    }
+  }
+
+  std::vector<T const *> replicas_;
+  double ema_;
+  unsigned updates_;
+};
+
+} // namespace svm
+} // namespace hogwild
+} // namespace hazy
+#endif
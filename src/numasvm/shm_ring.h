@@ -0,0 +1,173 @@
+// Copyright 2012 Victor Bittorf, Chris Re
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Hogwild!, part of the Hazy Project
+// Author : Victor Bittorf (bittorf [at] cs.wisc.edu)
+// Original Hogwild! Author: Chris Re (chrisre [at] cs.wisc.edu)
+
+#ifndef HAZY_HOGWILD_INSTANCES_NUMASVM_SHM_RING_H
+#define HAZY_HOGWILD_INSTANCES_NUMASVM_SHM_RING_H
+
+#include <sched.h>
+#include <cstdio>
+#include <cstring>
+
+#include "hazy/util/shared_memory.h"
+
+namespace hazy {
+namespace hogwild {
+namespace svm {
+
+/*! \brief Control block at the head of the ring segment, one cache line */
+struct __attribute__((aligned(64))) ShmRingHeader {
+  volatile int attached; //!< number of processes that attached
+  volatile int dim; //!< model dimension, set by the first process
+  volatile int token; //!< the HogWild++ token, see NumaSVMModel::GetAtomic
+  volatile int barrier_count; //!< processes waiting in Barrier()
+  volatile int barrier_sense; //!< flipped by the last process to arrive
+  volatile int slots_id; //!< shmid of the slots plus one, set by rank 0
+};
+
+/*! \brief The HogWild++ ring between processes, over SysV shared segments.
+ * Each process (rank) owns one cluster whose replica stays in private memory.
+ * The segment only holds the token and, for each rank, an inbox where the
+ * previous rank adds its scaled delta, and a snapshot of the rank's replica
+ * taken at its last sync, which the previous rank uses for the lambda mix.
+ * Inbox r is written by rank r-1 while it holds the token and drained by rank
+ * r when the token reaches it, so the existing token protocol is also what
+ * serializes access to the slots.
+ *
+ * Rank 0 creates the header with Create() before it forks the other ranks,
+ * which inherit the attachment. The slots depend on the model dimension, only
+ * known once the data is loaded: rank 0 creates them in Attach() and passes
+ * their id through the header. Both segments are private (no key can name
+ * them), zero filled, which is the initial state of the ring, and marked for
+ * removal on creation, so they never outlive the processes.
+ */
+class ShmRing {
+ public:
+  ShmRing(int nprocs, int rank) :
+      nprocs_(nprocs), rank_(rank), dim_(0), sense_(0),
+      hdr_(NULL), slots_(NULL) { }
+
+  /*! \brief Creates the header, called by rank 0 before the fork
+   * \return false on error
+   */
+  bool Create() {
+    int shmid;
+    char *base = util::CreatePrivateSegment(sizeof(ShmRingHeader), &shmid);
+    hdr_ = reinterpret_cast<ShmRingHeader*>(base);
+    return hdr_ != NULL;
+  }
+
+  /*! \brief Attaches to the slots and waits for all the ranks
+   * \param dim model dimension, must be the same in every rank
+   * \return false on error
+   */
+  bool Attach(unsigned dim) {
+    dim_ = dim;
+    char *base;
+    if (rank_ == 0) {
+      int shmid;
+      base = util::CreatePrivateSegment(2 * sizeof(double) * nprocs_ * dim, &shmid);
+      if (base == NULL) {
+        return false;
+      }
+      hdr_->dim = (int) dim;
+      __sync_synchronize();
+      hdr_->slots_id = shmid + 1;
+    } else {
+      while (hdr_->slots_id == 0) {
+        sched_yield();
+      }
+      if (hdr_->dim != (int) dim) {
+        printf("rank %d: model dimension %u does not match %d of rank 0\n",
+               rank_, dim, hdr_->dim);
+        return false;
+      }
+      base = util::AttachSegmentById(hdr_->slots_id - 1);
+      if (base == NULL) {
+        return false;
+      }
+    }
+    slots_ = reinterpret_cast<double*>(base);
+    __sync_fetch_and_add(&hdr_->attached, 1);
+    while (hdr_->attached < nprocs_) {
+      sched_yield();
+    }
+    return true;
+  }
+
+  void Detach() {
+    if (slots_ != NULL) {
+      util::DetachSharedSegment(reinterpret_cast<char*>(slots_));
+      slots_ = NULL;
+    }
+    if (hdr_ != NULL) {
+      util::DetachSharedSegment(reinterpret_cast<char*>(hdr_));
+      hdr_ = NULL;
+    }
+  }
+
+  /*! \brief Blocks until every rank called Barrier() */
+  void Barrier() {
+    sense_ = !sense_;
+    if (__sync_add_and_fetch(&hdr_->barrier_count, 1) == nprocs_) {
+      hdr_->barrier_count = 0;
+      __sync_synchronize();
+      hdr_->barrier_sense = sense_;
+    } else {
+      while (hdr_->barrier_sense != sense_) {
+        sched_yield();
+      }
+    }
+  }
+
+  /*! \brief Returns the ring to its initial state, called by every rank
+   * before training a new model.
+   */
+  void Reset() {
+    Barrier();
+    memset(Inbox(rank_), 0, sizeof(double) * dim_);
+    memset(Snapshot(rank_), 0, sizeof(double) * dim_);
+    if (rank_ == 0) {
+      hdr_->token = 0;
+    }
+    Barrier();
+  }
+
+  int * Token() { return const_cast<int*>(&hdr_->token); }
+  double * Inbox(int rank) { return slots_ + (size_t) rank * dim_; }
+  double * Snapshot(int rank) {
+    return slots_ + (size_t) (nprocs_ + rank) * dim_;
+  }
+  int Rank() const { return rank_; }
+  //! Called by the forked ranks, the header was created by rank 0
+  void SetRank(int rank) { rank_ = rank; }
+  int Next() const { return (rank_ + 1) % nprocs_; }
+  int Count() const { return nprocs_; }
+
+ private:
+  int nprocs_;
+  int rank_;
+  unsigned dim_;
+  int sense_; //!< local sense of the barrier
+  ShmRingHeader *hdr_;
+  double *slots_; //!< nprocs inboxes followed by nprocs snapshots
+};
+
+} // namespace svm
+} // namespace hogwild
+} // namespace hazy
+#endif
@@ -19,11 +19,16 @@
 #ifndef HAZY_HOGWILD_INSTANCES_SVM_SVM_EXEC_H
 #define HAZY_HOGWILD_INSTANCES_SVM_SVM_EXEC_H
 
+#include <algorithm>
 #include <cmath>
+#include <vector>
 
 #include "hazy/hogwild/hogwild_task.h"
+#include "hazy/util/checkpoint.h"
+#include "hazy/util/metrics.h"
 
 #include "svmmodel.h"
+#include "transport.h"
 
 namespace hazy {
 namespace hogwild {
@@ -64,9 +69,27 @@ class NumaSVMExec {
   //! Invoked after each training epoch, causes the stepsize to decay
   static void PostUpdate(NumaSVMModel &model, SVMParams &params);
 
-  static void PostEpoch(NumaSVMModel &model, SVMParams &params) {
-  }
+  //! Invoked after each training epoch, adapts the sync parameters
+  static void PostEpoch(NumaSVMModel &model, SVMParams &params);
+
+  //! Adds the sync counters of the last epoch to its metrics
+  static void EpochMetrics(NumaSVMModel &model, SVMParams &params,
+                           util::MetricsRecord &epoch,
+                           std::vector<util::MetricsRecord> &threads);
   static double ModelObj(SVMTask &task, unsigned tid, unsigned total);
+
+  /*! \brief Norm of the average stochastic gradient of the examples
+   * The gradients of the hinge loss and of the share of the regularization
+   * ModelUpdate() applies, at the model that is evaluated.
+   */
+  static double GradientNorm(const NumaSVMModel &model, const SVMParams &params,
+                             std::vector<SVMExample const *> const &sample);
+
+  /*! \brief Saves the replicas of the model, each once, see
+   * Hogwild::SetCheckpoint()
+   */
+  static void SaveCheckpoint(NumaSVMModel &model, SVMParams &params,
+                             int epoch, util::CheckpointWriter &writer);
   static double ModelAccuracy(SVMTask &task, unsigned tid, unsigned total);
  private:
   static int GetNumaNode();
@@ -19,7 +19,9 @@
 #include "hazy/vector/dot-inl.h"
 #include "hazy/vector/scale_add-inl.h"
 #include "hazy/hogwild/tools-inl.h"
+#include "hazy/hogwild/freeforall-inl.h"
 #include "hazy/util/clock.h"
+#include "../svm/gradient_norm.h"
 
 #include <numa.h>
 #include <sched.h>
@@ -29,16 +31,21 @@ namespace hazy {
 namespace hogwild {
 namespace svm {
 
+//! The weights evaluated for model, its replica average if it has one
+inline vector::FVector<fp_type> const & EvalWeights(const NumaSVMModel &model) {
+  return model.snapshot != NULL ? model.snapshot->weights : model.weights;
+}
+
 fp_type inline ComputeLoss(const SVMExample &e, const NumaSVMModel& model) {
   // determine how far off our model is for this example
-  vector::FVector<fp_type> const &w = model.weights;
+  vector::FVector<fp_type> const &w = EvalWeights(model);
   fp_type dot = vector::Dot(w, e.vector);
   return std::max(1 - dot * e.value, static_cast<fp_type>(0.0));
 }
 
 int inline NumaSVMExec::ComputeAccuracy(const SVMExample &e, const NumaSVMModel& model) {
   // determine how far off our model is for this example
-  vector::FVector<fp_type> const &w = model.weights;
+  vector::FVector<fp_type> const &w = EvalWeights(model);
   fp_type dot = vector::Dot(w, e.vector);
   return !!std::max(dot * e.value, static_cast<fp_type>(0.0));
 }
@@ -46,7 +53,8 @@ int inline NumaSVMExec::ComputeAccuracy(const SVMExample &e, const NumaSVMModel&
 /* this is the core function, for updating the model */
 int inline ModelUpdate(const SVMExample &examp, const SVMParams &params, 
                  NumaSVMModel *model, NumaSVMModel *next_model, int tid, int weights_index, 
-		 bool &allow_update_w, int iter, int &update_atomic_counter) {
+		 bool &allow_update_w, int iter, int &update_atomic_counter,
+                 SyncStats *stats) {
   int sync_counter = 0;
   vector::FVector<fp_type> &w = model->weights;
 
@@ -78,40 +86,22 @@ int inline ModelUpdate(const SVMExample &examp, const SVMParams &params,
   //   but have not passed it to the next cluster yet due to the token delay \tau_0
   // When allow_update_w is true, update_atomic_counter is to avoid reading the counter to frequently
   bool precond = next_model && allow_update_w && update_atomic_counter < 0;
-  if (precond && model->GetAtomic() == weights_index) {
+  if (precond && model->transport->TryAcquire(model)) {
     // we got the token, start to synchronize w
+    unsigned long long sync_start = stats ? util::CurrentNSec() : 0;
     allow_update_w = false;
     // when allow_update_w is false, update_atomic_counter is the token passing delay \tau_0 
     update_atomic_counter = params.update_delay;
-    fp_type * const old_vals = model->old_weights.values;
-    fp_type * const next_vals = next_model->weights.values;
-    // fp_type * const next_old_vals = next_model->old_weights.values;
-    fp_type beta = params.beta;
-    fp_type lambda = params.lambda;
-    // if the delta of a model parameter is smaller than tolerance, we will not update it
-    fp_type tolerance = params.tolerance;
-    for (unsigned i = 0; i < w.size; ++i) {
-      fp_type wi = vals[i];
-      fp_type delta = (wi - old_vals[i]) * params.step_size;
-      fp_type next = next_vals[i];
-      fp_type new_wi;
-      if (fabs(delta) > tolerance) {
-        fp_type new_wi = next * lambda + wi * (1 - lambda) + (beta + lambda - 1) * delta;
-        next_vals[i] = next + beta * delta;
-        vals[i] = new_wi;
-        old_vals[i] = new_wi;
-        // count how many times we write dw (for debuging only)
-        sync_counter++;
-      }
-      else {
-        // if the delta is very small, will not update the model of next cluster
-        // this delta will be accumulated
-        new_wi = next * lambda + wi * (1 - lambda) + lambda * delta;
-        vals[i] = new_wi;
-        old_vals[i] = new_wi - delta;
-      }
-    }
+    size_t bytes = 0;
+    sync_counter = model->transport->Sync(model, next_model, params, bytes);
     // printf("%d/%d(@%d):%d/%ld\n", tid, weights_index, iter, sync_counter, w.size);
+    if (stats) {
+      stats->sync_nsec += util::CurrentNSec() - sync_start;
+      stats->syncs++;
+      stats->scanned += w.size;
+      stats->elements += sync_counter;
+      stats->bytes += bytes;
+    }
   }
   // if (update_atomic_counter != -1) {
     update_atomic_counter--;
@@ -119,7 +109,7 @@ int inline ModelUpdate(const SVMExample &examp, const SVMParams &params,
     // In this case, when update_atomic_counter becomes 0, we will pass the token to the next cluster
     if (!update_atomic_counter && !allow_update_w) {
       // printf("%d(@%d):inc\n", tid, iter);
-      model->IncAtomic();
+      model->transport->Release(model);
       // now we have passed the token the the next cluster, allowing updates again
       allow_update_w = true;
       // Add some delay before we read the atomic next time, to avoid reading the counter too frequently.
@@ -136,6 +126,51 @@ void NumaSVMExec::PostUpdate(NumaSVMModel &model, SVMParams &params) {
   // printf("Step size = %f\n", params.step_size);
 }
 
+void NumaSVMExec::PostEpoch(NumaSVMModel &model, SVMParams &params) {
+  // Retune the token delay and the tolerance from the last epoch's syncs
+  if (params.sync_ctrl != NULL && params.sync_stats != NULL) {
+    params.sync_ctrl->Adjust(params.sync_stats, params.tpool->ThreadCount(),
+                             params.update_delay, params.tolerance);
+  }
+  else if (params.sync_stats != NULL) {
+    // the counters are per epoch, see EpochMetrics
+    for (unsigned i = 0; i < params.tpool->ThreadCount(); ++i) {
+      params.sync_stats[i].Reset();
+    }
+  }
+  // Average the replicas for the evaluation that follows
+  if (model.snapshot != NULL) {
+    model.snapshot->Update(*params.tpool);
+  }
+}
+
+void NumaSVMExec::EpochMetrics(NumaSVMModel &model, SVMParams &params,
+                               util::MetricsRecord &epoch,
+                               std::vector<util::MetricsRecord> &threads) {
+  if (params.sync_stats == NULL) {
+    return;
+  }
+  SyncStats total;
+  for (size_t i = 0; i < threads.size(); ++i) {
+    SyncStats const &stats = params.sync_stats[i];
+    threads[i].Add("examples", stats.examples);
+    threads[i].Add("examples_per_sec", stats.train_nsec > 0 ?
+                   stats.examples * 1e9 / stats.train_nsec : 0.0);
+    threads[i].Add("syncs", stats.syncs);
+    threads[i].Add("elements", stats.elements);
+    threads[i].Add("bytes", stats.bytes);
+    threads[i].Add("sync_time", stats.sync_nsec * 1e-9);
+    total.Add(stats);
+  }
+  epoch.Add("syncs", total.syncs);
+  epoch.Add("scanned", total.scanned);
+  epoch.Add("elements", total.elements);
+  epoch.Add("bytes", total.bytes);
+  epoch.Add("sync_time", total.sync_nsec * 1e-9);
+  epoch.Add("update_delay", params.update_delay);
+  epoch.Add("tolerance", params.tolerance);
+}
+
 int NumaSVMExec::GetNumaNode() {
   int cpu = sched_getcpu();
   return numa_node_of_cpu(cpu);
@@ -151,12 +186,11 @@ double NumaSVMExec::UpdateModel(SVMTask &task, unsigned tid, unsigned total) {
   SVMParams const &params = *task.params;
   // Select the example vector array based on current node
   vector::FVector<SVMExample> const & exampsvec = task.block[node].ex;
-  // calculate which chunk of examples we work on
-  size_t start = hogwild::GetStartIndex(exampsvec.size, tid, total);
-  size_t end = hogwild::GetEndIndex(exampsvec.size, tid, total);
+  // the chunks of examples we work on, see ChunkScheduler
+  ExampleRanges ranges(task.params->steal ? task.sched : NULL, exampsvec.size, tid, total);
   // optimize for const pointers 
   // Seclect the pointers based on current node
-  size_t *perm = task.block[node].perm.values;
+  perm_type const *perm = task.block[node].perm.values;
   SVMExample const * const examps = exampsvec.values;
   // individually update the model for each example
   int weights_index = model.thread_to_weights_mapping[tid];
@@ -166,32 +200,50 @@ double NumaSVMExec::UpdateModel(SVMTask &task, unsigned tid, unsigned total) {
   int atomic_inc_value = m->atomic_inc_value;
   int atomic_mask = m->atomic_mask;
   int update_atomic_counter = m->update_atomic_counter;
-  if (0) printf("UpdateModel: thread %d on node %d using %p perm %p from %lu to %lu, "
+  if (0) printf("UpdateModel: thread %d on node %d using %p perm %p, "
          "model %d->%d at %p->%p, (atomic+%d) & %x, delay %d\n", 
-         tid, node, exampsvec.values[0].vector.values, perm, start, end, weights_index, next_weights,
+         tid, node, exampsvec.values[0].vector.values, perm, weights_index, next_weights,
          m->weights.values, next_weights >= 0 ? next_m->weights.values: NULL, 
          atomic_inc_value, atomic_mask, update_atomic_counter);
   int sync_counter = 0;
   bool allow_update_w = m->allow_update_w;
-  for (unsigned i = start; i < end; i++) {
-    size_t indirect = perm[i];
-    sync_counter += ModelUpdate(examps[indirect], params, m, next_m, tid, weights_index,
-                                allow_update_w, i - start, update_atomic_counter);
+  SyncStats *stats = params.sync_stats != NULL ? &params.sync_stats[tid] : NULL;
+  size_t start, end, count = 0;
+  while (ranges.Next(start, end)) {
+    for (size_t i = start; i < end; i++) {
+      size_t indirect = perm[i];
+      sync_counter += ModelUpdate(examps[indirect], params, m, next_m, tid, weights_index,
+                                  allow_update_w, count++, update_atomic_counter, stats);
+    }
   }
   // Save states
   m->update_atomic_counter = update_atomic_counter;
   m->allow_update_w = allow_update_w;
   // printf("%d: %d\n", tid, update_atomic_counter);
   // printf("UpdateModel: thread %d, %d/%lu elements copied.\n", tid, sync_counter, model.weights.size);
-  
-  return clock.Stop();
+
+  double elapsed = clock.Stop();
+  if (stats) {
+    stats->train_nsec += (unsigned long long) (elapsed * 1e9);
+    stats->examples += count;
+  }
+  return elapsed;
 }
 
-int NumaSVMExec::GetLatestModel(SVMTask &task, unsigned tid, unsigned total) {
+int NumaSVMExec::GetLatestModel(SVMTask &task, unsigned /* tid */,
+                                unsigned /* total */) {
   NumaSVMModel const &model_head = *task.model;
   bool use_ring = task.params->use_ring;
   int latest_index;
-  if (use_ring) {
+  if (model_head.snapshot != NULL) {
+    // the head model evaluates its snapshot, see PostEpoch()
+    latest_index = 0;
+  }
+  else if (model_head.transport->Remote()) {
+    // the other replicas live in other processes
+    latest_index = 0;
+  }
+  else if (use_ring) {
     // TODO: Assume that we only do +1 each time
     latest_index = model_head.GetAtomic() - 1;
     if (latest_index == -1) {
@@ -213,17 +265,19 @@ double NumaSVMExec::TestModel(SVMTask &task, unsigned tid, unsigned total) {
   // Select the example vector array based on current node
   vector::FVector<SVMExample> const & exampsvec = task.block[node].ex;
 
-  // calculate which chunk of examples we work on
-  size_t start = hogwild::GetStartIndex(exampsvec.size, tid, total); 
-  size_t end = hogwild::GetEndIndex(exampsvec.size, tid, total);
+  // the chunks of examples we work on, see ChunkScheduler
+  ExampleRanges ranges(task.params->steal ? task.sched : NULL, exampsvec.size, tid, total);
 
   // keep const correctness
   SVMExample const * const examps = exampsvec.values;
   fp_type loss = 0.0;
   // compute the loss for each example
-  for (unsigned i = start; i < end; i++) {
-    fp_type l = ComputeLoss(examps[i], model);
-    loss += l;
+  size_t start, end;
+  while (ranges.Next(start, end)) {
+    for (size_t i = start; i < end; i++) {
+      fp_type l = ComputeLoss(examps[i], model);
+      loss += l;
+    }
   }
   // return the number of examples we used and the sum of the loss
   //counted = end-start;
@@ -238,18 +292,20 @@ double NumaSVMExec::ModelAccuracy(SVMTask &task, unsigned tid, unsigned total) {
   // Select the example vector array based on current node
   vector::FVector<SVMExample> const & exampsvec = task.block[node].ex;
 
-  // calculate which chunk of examples we work on
-  size_t start = hogwild::GetStartIndex(exampsvec.size, tid, total); 
-  size_t end = hogwild::GetEndIndex(exampsvec.size, tid, total);
+  // the chunks of examples we work on, see ChunkScheduler
+  ExampleRanges ranges(task.params->steal ? task.sched : NULL, exampsvec.size, tid, total);
 
   // keep const correctness
   SVMExample const * const examps = exampsvec.values;
   // return the number of examples we used and the sum of the loss
   int correct = 0;
   // compute the loss for each example
-  for (unsigned i = start; i < end; i++) {
-    int l = ComputeAccuracy(examps[i], model);
-    correct += l;
+  size_t start, end;
+  while (ranges.Next(start, end)) {
+    for (size_t i = start; i < end; i++) {
+      int l = ComputeAccuracy(examps[i], model);
+      correct += l;
+    }
   }
   //counted = end-start;
   return correct;
@@ -263,21 +319,24 @@ double NumaSVMExec::ModelObj(SVMTask &task, unsigned tid, unsigned total) {
   // Select the example vector array based on current node
   vector::FVector<SVMExample> const & exampsvec = task.block[node].ex;
 
-  // calculate which chunk of examples we work on
-  size_t start = hogwild::GetStartIndex(exampsvec.size, tid, total); 
-  size_t end = hogwild::GetEndIndex(exampsvec.size, tid, total);
+  // the chunks of examples we work on, see ChunkScheduler
+  ExampleRanges ranges(task.params->steal ? task.sched : NULL, exampsvec.size, tid, total);
 
   // keep const correctness
   SVMExample const * const examps = exampsvec.values;
   fp_type loss = 0.0;
   // compute the loss for each example
-  for (unsigned i = start; i < end; i++) {
-    fp_type l = ComputeLoss(examps[i], model);
-    loss += l;
+  size_t start, end;
+  while (ranges.Next(start, end)) {
+    for (size_t i = start; i < end; i++) {
+      fp_type l = ComputeLoss(examps[i], model);
+      loss += l;
+    }
   }
-  start = hogwild::GetStartIndex(model.weights.size, tid, total);
-  end = hogwild::GetEndIndex(model.weights.size, tid, total);
-  double const * const weights = model.weights.values;
+  vector::FVector<fp_type> const &w = EvalWeights(model);
+  start = hogwild::GetStartIndex(w.size, tid, total);
+  end = hogwild::GetEndIndex(w.size, tid, total);
+  double const * const weights = w.values;
   fp_type reg = 0.0;
   // compute the regularization term
   for (unsigned i = start; i < end; ++i) {
@@ -288,6 +347,27 @@ double NumaSVMExec::ModelObj(SVMTask &task, unsigned tid, unsigned total) {
   return loss + 0.5 * reg;
 }
 
+double NumaSVMExec::GradientNorm(const NumaSVMModel &model, const SVMParams &params,
+                           std::vector<SVMExample const *> const &sample) {
+  return SampledGradientNorm(model.weights, params.mu, params.degrees, sample);
+}
+
+void NumaSVMExec::SaveCheckpoint(NumaSVMModel &model, SVMParams &params,
+                                 int epoch, util::CheckpointWriter &writer) {
+  // the mirrors share the buffer of their owner, with --processes the other
+  // replicas are saved by the other processes
+  int count = model.transport != NULL && model.transport->Remote() ?
+              1 : params.weights_count;
+  std::vector<fp_type const *> replicas;
+  for (int i = 0; i < count; ++i) {
+    fp_type const *w = (&model)[i].weights.values;
+    if (std::find(replicas.begin(), replicas.end(), w) == replicas.end()) {
+      replicas.push_back(w);
+    }
+  }
+  writer.Save("svm", epoch, params.step_size, replicas, model.weights.size);
+}
+
 
 } // namespace svm
 } // namespace hogwild
@@ -25,6 +25,11 @@
 
 #include "hazy/hogwild/hogwild_task.h"
 #include "hazy/thread/thread_pool.h"
+#include "hazy/util/numa_alloc.h"
+
+#include "sync_controller.h"
+#include "delta_codec.h"
+#include "model_snapshot.h"
 
 #include <cstdio>
 
@@ -37,6 +42,8 @@ namespace svm {
 //! The precision of the values, either float or double
 typedef double fp_type;
 
+class Transport;
+
 //! The mutable model for a sparse SVM.
 struct NumaSVMModel {
   //! The weight vector that is trained
@@ -49,6 +56,16 @@ struct NumaSVMModel {
   bool allow_update_w;
   int * thread_to_weights_mapping;
   int * next_weights;
+  //! Mailbox for compressed deltas from the previous cluster, may be NULL
+  DeltaExchange * exchange;
+  //! Value of the token when this model may sync with the next one
+  int token_index;
+  //! Moves the token and the deltas to the next cluster, see Transport
+  Transport * transport;
+  //! Average of the replicas evaluated instead of this model, may be NULL
+  ModelSnapshot<fp_type> * snapshot;
+  //! Pages of the buffers allocated by AllocateModel(), see util::HugePages
+  int huge_pages;
 
   //! Construct a weight vector of length dim backed by the buffer
   /*! A new model backed by the buffer.
@@ -58,25 +75,67 @@ struct NumaSVMModel {
   explicit NumaSVMModel() {
     update_atomic_counter = -1;
     allow_update_w = true;
+    exchange = NULL;
+    token_index = -1;
+    transport = NULL;
+    snapshot = NULL;
+    huge_pages = util::kHugePagesNone;
   }
 
-  void AllocateModel(unsigned dim) {
+  /*! Allocates the zeroed model, see util::NumaAlloc()
+   * \param dim number of features
+   * \param node node the pages are bound to, -1 for the memory policy of the
+   *  thread touching them
+   * \param huge_pages one of util::HugePages
+   * \param touch if not NULL the pages are left for it to fault in on the
+   *  threads of the cluster, otherwise the calling thread touches them
+   */
+  void AllocateModel(unsigned dim, int node = -1,
+                     int huge_pages = util::kHugePagesNone,
+                     util::FirstTouch *touch = NULL) {
+    size_t bytes = sizeof(fp_type) * dim;
+    this->huge_pages = huge_pages;
     weights.size = dim;
-    weights.values = new fp_type[dim];
+    weights.values = static_cast<fp_type*>(util::NumaAlloc(bytes, node, huge_pages));
     old_weights.size = dim;
-    old_weights.values = new fp_type[dim];
+    old_weights.values = static_cast<fp_type*>(util::NumaAlloc(bytes, node, huge_pages));
 //    printf("Allocated w at %p\n", weights.values);
-    for (unsigned i = dim; i-- > 0; ) {
-      weights.values[i] = 0;
-      old_weights.values[i] = 0;
+    if (touch != NULL) {
+      touch->Add(weights.values, bytes);
+      touch->Add(old_weights.values, bytes);
+    }
+    else {
+      memset(weights.values, 0, bytes);
+      memset(old_weights.values, 0, bytes);
     }
   }
 
+  //! Frees the buffers of AllocateModel(), not to be called on a mirror
+  void FreeModel() {
+    util::NumaFree(weights.values, sizeof(fp_type) * weights.size, huge_pages);
+    util::NumaFree(old_weights.values, sizeof(fp_type) * old_weights.size, huge_pages);
+    weights.values = NULL;
+    old_weights.values = NULL;
+    delete exchange;
+    exchange = NULL;
+  }
+
   void MirrorModel(NumaSVMModel const &m) {
     weights.size = m.weights.size;
     weights.values = m.weights.values;
     old_weights.size = m.old_weights.size;
     old_weights.values = m.old_weights.values;
+    exchange = m.exchange;
+  }
+
+  /*! Allocates the delta mailbox of this cluster, on the calling node.
+   * \param mode one of DeltaCompression
+   * \param topk_ratio fraction of coordinates sent by kCompressTopK
+   * \param seed seed of the stochastic rounding
+   */
+  void AllocateExchange(int mode, double topk_ratio, unsigned seed) {
+    exchange = new DeltaExchange;
+    exchange->Allocate(weights.size, mode, topk_ratio, seed);
   }
 
   inline void IncAtomic() {
@@ -121,9 +180,13 @@ struct SVMParams {
   int update_delay;
   double tolerance;
   hazy::thread::ThreadPool * tpool;
+  SyncStats * sync_stats; //!< per-thread sync counters, NULL to disable
+  SyncController * sync_ctrl; //!< adapts update_delay/tolerance, may be NULL
+  int compress; //!< DeltaCompression used by the ring sync
+  bool steal; //!< balance the examples with the task's ChunkScheduler
   //! Constructs a enw set of params
   SVMParams(fp_type stepsize, fp_type stepdecay, fp_type _mu, fp_type beta, fp_type lambda, int weights_count, bool use_ring, int update_delay, double tolerance, hazy::thread::ThreadPool * tpool) :
-      mu(_mu), step_size(stepsize), step_decay(stepdecay) , beta(beta), lambda(lambda), weights_count(weights_count), use_ring(use_ring), update_delay(update_delay), tolerance(tolerance), tpool(tpool) { }
+      mu(_mu), step_size(stepsize), step_decay(stepdecay) , beta(beta), lambda(lambda), weights_count(weights_count), use_ring(use_ring), update_delay(update_delay), tolerance(tolerance), tpool(tpool), sync_stats(NULL), sync_ctrl(NULL), compress(kCompressNone), steal(true) { }
 };
 
 //! A single example which is a value/rating and a vector
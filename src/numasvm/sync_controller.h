@@ -0,0 +1,147 @@
+// Copyright 2012 Victor Bittorf, Chris Re
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Hogwild!, part of the Hazy Project
+// Author : Victor Bittorf (bittorf [at] cs.wisc.edu)
+// Original Hogwild! Author: Chris Re (chrisre [at] cs.wisc.edu)
+
+#ifndef HAZY_HOGWILD_INSTANCES_NUMASVM_SYNC_CONTROLLER_H
+#define HAZY_HOGWILD_INSTANCES_NUMASVM_SYNC_CONTROLLER_H
+
+#include <cstdio>
+#include <algorithm>
+
+namespace hazy {
+namespace hogwild {
+namespace svm {
+
+//! Per-thread counters of the HogWild++ ring synchronization.
+/*! Each worker only writes its own entry; entries are cache line aligned
+ * so that neighbouring workers do not false share while training.
+ */
+struct __attribute__((aligned(64))) SyncStats {
+  unsigned long long sync_nsec; //!< time spent exchanging deltas
+  unsigned long long train_nsec; //!< time spent in UpdateModel
+  size_t examples; //!< examples processed
+  size_t syncs; //!< number of times the token was used to sync
+  size_t scanned; //!< model elements scanned while syncing
+  size_t elements; //!< model elements written to the next cluster
+  size_t bytes; //!< bytes written to the next cluster
+
+  SyncStats() { Reset(); }
+
+  void Reset() {
+    sync_nsec = 0;
+    train_nsec = 0;
+    examples = 0;
+    syncs = 0;
+    scanned = 0;
+    elements = 0;
+    bytes = 0;
+  }
+
+  void Add(SyncStats const &o) {
+    sync_nsec += o.sync_nsec;
+    train_nsec += o.train_nsec;
+    examples += o.examples;
+    syncs += o.syncs;
+    scanned += o.scanned;
+    elements += o.elements;
+    bytes += o.bytes;
+  }
+};
+
+/*! \brief Online controller for the token delay and the delta tolerance.
+ * At the end of every epoch the controller looks at the summed SyncStats of
+ * all workers and adjusts the two HogWild++ knobs within fixed bounds:
+ *  - update_delay (tau_0) is doubled when the fraction of worker time spent
+ *    synchronizing exceeds the budget, and halved when it is well below it,
+ *    so that cheap syncs are used more often.
+ *  - tolerance tracks replica divergence, measured as the fraction of
+ *    scanned coordinates whose delta was large enough to be sent. As the step
+ *    size decays deltas shrink, so a fixed tolerance would silently stop all
+ *    exchange; the controller keeps the fraction inside [min_exchange,
+ *    max_exchange]. If replicas still diverge with the tolerance at its upper
+ *    bound, the delay is lowered instead (unless over budget).
+ * Bounds are relative to the initial values: delay in [1, 64 * tau_0] and
+ * tolerance in [1e-4, 1e2] times the initial tolerance.
+ */
+class SyncController {
+ public:
+  SyncController(int update_delay, double tolerance, double sync_budget) :
+      min_delay_(1), max_delay_(std::max(update_delay, 1) * 64),
+      min_tol_(tolerance * 1e-4), max_tol_(tolerance * 1e2),
+      budget_(sync_budget), min_exchange_(0.05), max_exchange_(0.5) { }
+
+  /*! \brief Adjust the delay and tolerance from the stats of the last epoch.
+   * The stats are consumed: they are reset before returning.
+   * \param stats per-thread stats, nthreads entries
+   * \param nthreads number of entries in stats
+   * \param update_delay the token delay to adjust
+   * \param tolerance the delta tolerance to adjust
+   */
+  void Adjust(SyncStats *stats, unsigned nthreads, int &update_delay,
+              double &tolerance) {
+    SyncStats total;
+    for (unsigned i = 0; i < nthreads; ++i) {
+      total.Add(stats[i]);
+      stats[i].Reset();
+    }
+    if (total.syncs == 0 || total.train_nsec == 0) {
+      // no token reached a syncing thread, nothing to measure yet
+      return;
+    }
+    double overhead = (double) total.sync_nsec / total.train_nsec;
+    double exchange = (double) total.elements / total.scanned;
+
+    int delay = update_delay;
+    double tol = tolerance;
+    if (exchange < min_exchange_) {
+      tol *= 0.5;
+    } else if (exchange > max_exchange_) {
+      tol *= 2;
+    }
+    tol = std::min(std::max(tol, min_tol_), max_tol_);
+
+    if (overhead > budget_) {
+      delay *= 2;
+    } else if (overhead < budget_ * 0.5) {
+      delay /= 2;
+    } else if (exchange > max_exchange_ && tol >= max_tol_) {
+      delay /= 2;
+    }
+    delay = std::min(std::max(delay, min_delay_), max_delay_);
+
+    printf("sync_ctrl: syncs: %lu overhead: %.4f exchanged: %.4f "
+           "bytes/sync: %lu update_delay: %d->%d tolerance: %.3g->%.3g\n",
+           total.syncs, overhead, exchange, total.bytes / total.syncs,
+           update_delay, delay, tolerance, tol);
+    update_delay = delay;
+    tolerance = tol;
+  }
+
+ private:
+  int min_delay_;
+  int max_delay_;
+  double min_tol_;
+  double max_tol_;
+  double budget_; //!< target fraction of worker time spent syncing
+  double min_exchange_; //!< lower bound on the fraction of elements sent
+  double max_exchange_; //!< upper bound on the fraction of elements sent
+};
+
+} // namespace svm
+} // namespace hogwild
+} // namespace hazy
+#endif
@@ -0,0 +1,604 @@
+// Copyright 2012 Victor Bittorf, Chris Re
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Hogwild!, part of the Hazy Project
+// Author : Victor Bittorf (bittorf [at] cs.wisc.edu)
+// Original Hogwild! Author: Chris Re (chrisre [at] cs.wisc.edu)
+
+#ifndef HAZY_HOGWILD_INSTANCES_NUMASVM_TRANSPORT_H
+#define HAZY_HOGWILD_INSTANCES_NUMASVM_TRANSPORT_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "svmmodel.h"
+#include "shm_ring.h"
+
+namespace hazy {
+namespace hogwild {
+namespace svm {
+
+/*! \brief Moves the token and the model deltas between clusters of the ring.
+ * The syncing thread of a cluster calls TryAcquire() when it may take the
+ * token; when it succeeds Sync() is called once, and Release() passes the
+ * token on after update_delay more updates. By default the token is the
+ * atomic counter shared by the models (see NumaSVMModel::GetAtomic).
+ */
+class Transport {
+ public:
+  virtual ~Transport() { }
+
+  /*! \brief Returns true if the token reached the given cluster */
+  virtual bool TryAcquire(NumaSVMModel *model) {
+    return model->GetAtomic() == model->token_index;
+  }
+
+  /*! \brief Exchanges deltas with the next cluster while holding the token
+   * \param model the model of the syncing cluster
+   * \param next_model the model of the next cluster, if it is in this process
+   * \param params the training parameters
+   * \param bytes set to the number of bytes sent to the next cluster
+   * \return the number of coordinates sent
+   */
+  virtual int Sync(NumaSVMModel *model, NumaSVMModel *next_model,
+                   const SVMParams &params, size_t &bytes) = 0;
+
+  /*! \brief Passes the token to the next cluster */
+  virtual void Release(NumaSVMModel *model) {
+    model->IncAtomic();
+  }
+
+  /*! \brief Called by every process before a new model is trained */
+  virtual void Reset() { }
+
+  /*! \brief True if the other clusters live in other processes */
+  virtual bool Remote() const { return false; }
+};
+
+/* sync with compressed deltas: only the encoded payload is written to the next
+   cluster, and the part of the delta that was not sent (the quantization error
+   or the coordinates outside of the top-k) is kept in old_weights, so that it is
+   sent later (error feedback). The mixing term lambda * next is skipped since
+   it would read the whole remote model; the update is the lambda = 0 form. */
+int inline CompressedSync(NumaSVMModel *model, DeltaExchange &ex,
+                          DeltaExchange &next_ex, const SVMParams &params,
+                          size_t &bytes) {
+  fp_type * const vals = model->weights.values;
+  fp_type * const old_vals = model->old_weights.values;
+  unsigned const dim = model->weights.size;
+  fp_type const beta = params.beta;
+  // first apply what the previous cluster sent us, so it is forwarded as well
+  DrainDelta(ex, vals, beta);
+  for (unsigned i = 0; i < dim; ++i) {
+    ex.delta[i] = (vals[i] - old_vals[i]) * params.step_size;
+  }
+  size_t sent;
+  bytes = EncodeDelta(ex, next_ex, params.tolerance, sent);
+  fp_type const * const dhat = ex.decoded;
+  fp_type const * const residual = ex.delta;
+  for (unsigned i = 0; i < dim; ++i) {
+    fp_type new_wi = vals[i] + (beta - 1) * dhat[i];
+    vals[i] = new_wi;
+    old_vals[i] = new_wi - residual[i];
+  }
+  return sent;
+}
+
+/*! \brief The in-process ring: the next model is directly addressable. */
+class LocalTransport : public Transport {
+ public:
+  int Sync(NumaSVMModel *model, NumaSVMModel *next_model,
+           const SVMParams &params, size_t &bytes) {
+    if (params.compress != kCompressNone) {
+      return CompressedSync(model, *model->exchange, *next_model->exchange,
+                            params, bytes);
+    }
+    int sync_counter = 0;
+    fp_type * const vals = model->weights.values;
+    fp_type * const old_vals = model->old_weights.values;
+    fp_type * const next_vals = next_model->weights.values;
+    // fp_type * const next_old_vals = next_model->old_weights.values;
+    fp_type beta = params.beta;
+    fp_type lambda = params.lambda;
+    // if the delta of a model parameter is smaller than tolerance, we will not update it
+    fp_type tolerance = params.tolerance;
+    for (unsigned i = 0; i < model->weights.size; ++i) {
+      fp_type wi = vals[i];
+      fp_type delta = (wi - old_vals[i]) * params.step_size;
+      fp_type next = next_vals[i];
+      fp_type new_wi;
+      if (fabs(delta) > tolerance) {
+        fp_type new_wi = next * lambda + wi * (1 - lambda) + (beta + lambda - 1) * delta;
+        next_vals[i] = next + beta * delta;
+        vals[i] = new_wi;
+        old_vals[i] = new_wi;
+        // count how many times we write dw (for debuging only)
+        sync_counter++;
+      }
+      else {
+        // if the delta is very small, will not update the model of next cluster
+        // this delta will be accumulated
+        new_wi = next * lambda + wi * (1 - lambda) + lambda * delta;
+        vals[i] = new_wi;
+        old_vals[i] = new_wi - delta;
+      }
+    }
+    bytes = sync_counter * sizeof(fp_type);
+    return sync_counter;
+  }
+};
+
+/*! \brief The ring between processes on one machine, see ShmRing.
+ * The token is the counter in the shared segment; the next replica is only
+ * known through the snapshot it published at its last sync, and our share of
+ * the delta is added to its inbox instead of its weights. What the previous
+ * rank left in our inbox is applied first.
+ */
+class ShmTransport : public Transport {
+ public:
+  explicit ShmTransport(ShmRing &ring) : ring_(ring) { }
+
+  int Sync(NumaSVMModel *model, NumaSVMModel * /* next_model */,
+           const SVMParams &params, size_t &bytes) {
+    fp_type * const vals = model->weights.values;
+    fp_type * const old_vals = model->old_weights.values;
+    fp_type * const inbox = ring_.Inbox(ring_.Rank());
+    fp_type * const snapshot = ring_.Snapshot(ring_.Rank());
+    fp_type const * const next_vals = ring_.Snapshot(ring_.Next());
+    fp_type * const next_inbox = ring_.Inbox(ring_.Next());
+    fp_type const beta = params.beta;
+    fp_type const lambda = params.lambda;
+    fp_type const tolerance = params.tolerance;
+    unsigned const dim = model->weights.size;
+    int sync_counter = 0;
+    for (unsigned i = 0; i < dim; ++i) {
+      fp_type wi = vals[i] + inbox[i];
+      inbox[i] = 0;
+      fp_type delta = (wi - old_vals[i]) * params.step_size;
+      fp_type next = next_vals[i];
+      fp_type new_wi;
+      if (fabs(delta) > tolerance) {
+        new_wi = next * lambda + wi * (1 - lambda) + (beta + lambda - 1) * delta;
+        next_inbox[i] += beta * delta;
+        old_vals[i] = new_wi;
+        sync_counter++;
+      }
+      else {
+        new_wi = next * lambda + wi * (1 - lambda) + lambda * delta;
+        old_vals[i] = new_wi - delta;
+      }
+      vals[i] = new_wi;
+      snapshot[i] = new_wi;
+    }
+    bytes = sync_counter * sizeof(fp_type);
+    return sync_counter;
+  }
+
+  void Reset() { ring_.Reset(); }
+  bool Remote() const { return true; }
+
+ private:
+  ShmRing &ring_;
+};
+
+//! Header of a message carrying the token and a delta between processes
+struct DeltaMessageHeader {
+  uint32_t magic; //!< kDeltaMessageMagic + compression mode
+  uint32_t generation; //!< the model the delta belongs to, see Reset()
+  uint32_t count; //!< q8: number of blocks, top-k: number of pairs
+  uint32_t bytes; //!< payload bytes following the header
+};
+
+static const uint32_t kDeltaMessageMagic = 0x48570000;
+
+/*! \brief The ring between processes over TCP or Unix sockets.
+ * Every rank listens on its own address, connects to the next rank and
+ * accepts the previous one. The token travels with the delta: holding the
+ * token means having received the last message of the previous rank. The
+ * delta is always sent sparse; without --compress it is the top-k form with
+ * k = dim, i.e. every coordinate above tolerance as an (index, float) pair.
+ * As with compressed deltas the mixing term is skipped, since the next
+ * replica is not readable from here.
+ *
+ * Addresses are "host:port" for TCP, and "unix:/path" for Unix sockets.
+ */
+class SocketTransport : public Transport {
+ public:
+  SocketTransport(std::vector<std::string> const &addrs, int rank) :
+      addrs_(addrs), rank_(rank), prev_fd_(-1), next_fd_(-1),
+      has_token_(rank == 0), generation_(0), closed_(false) { }
+
+  ~SocketTransport() {
+    if (prev_fd_ >= 0) close(prev_fd_);
+    if (next_fd_ >= 0) close(next_fd_);
+  }
+
+  /*! \brief Connects the ring, blocks until both neighbours are connected.
+   * \param dim model dimension
+   * \param mode one of DeltaCompression
+   * \param topk_ratio fraction of coordinates sent by kCompressTopK
+   * \return false on error
+   */
+  bool Connect(unsigned dim, int mode, double topk_ratio) {
+    if (mode == kCompressNone) {
+      mode = kCompressTopK;
+      topk_ratio = 1.0;
+    }
+    inbox_.Allocate(dim, mode, topk_ratio, rank_ + 1);
+    outbox_.Allocate(dim, mode, topk_ratio, rank_ + 1);
+    // a rank that went away must not kill us when we write to it
+    signal(SIGPIPE, SIG_IGN);
+    int nprocs = addrs_.size();
+    int listen_fd = Listen(addrs_[rank_]);
+    if (listen_fd < 0) {
+      return false;
+    }
+    next_fd_ = ConnectTo(addrs_[(rank_ + 1) % nprocs]);
+    if (next_fd_ < 0) {
+      close(listen_fd);
+      return false;
+    }
+    prev_fd_ = accept(listen_fd, NULL, NULL);
+    close(listen_fd);
+    if (addrs_[rank_].compare(0, 5, "unix:") == 0) {
+      // connected, the path is not needed anymore
+      unlink(addrs_[rank_].c_str() + 5);
+    }
+    if (prev_fd_ < 0) {
+      perror("accept failed");
+      return false;
+    }
+    SetNoDelay(prev_fd_);
+    SetNoDelay(next_fd_);
+    // all ranks must train models of the same dimension
+    uint32_t mine = dim, theirs = 0;
+    if (!WriteAll(next_fd_, (const char*) &mine, sizeof(mine)) ||
+        !ReadAll(prev_fd_, (char*) &theirs, sizeof(theirs))) {
+      printf("rank %d: lost the ring while connecting\n", rank_);
+      return false;
+    }
+    if (theirs != mine) {
+      printf("rank %d: model dimension %u does not match %u of rank %d\n",
+             rank_, mine, theirs, (rank_ + nprocs - 1) % nprocs);
+      return false;
+    }
+    return true;
+  }
+
+  bool TryAcquire(NumaSVMModel * /* model */) {
+    if (has_token_) {
+      return true;
+    }
+    if (closed_) {
+      return false;
+    }
+    struct pollfd p;
+    p.fd = prev_fd_;
+    p.events = POLLIN;
+    p.revents = 0;
+    if (poll(&p, 1, 0) <= 0) {
+      return false;
+    }
+    has_token_ = ReadMessage();
+    return has_token_;
+  }
+
+  int Sync(NumaSVMModel *model, NumaSVMModel * /* next_model */,
+           const SVMParams &params, size_t &bytes) {
+    int sent = CompressedSync(model, inbox_, outbox_, params, bytes);
+    bytes += sizeof(DeltaMessageHeader);
+    return sent;
+  }
+
+  void Release(NumaSVMModel * /* model */) {
+    if (!closed_ && !WriteMessage()) {
+      // the next rank is gone, keep training without syncing
+      closed_ = true;
+    }
+    has_token_ = false;
+  }
+
+  /*! \brief Starts a new model: deltas of the previous one are dropped.
+   * The token keeps going around, whoever holds it keeps it.
+   */
+  void Reset() {
+    generation_++;
+    inbox_.pending = 0;
+  }
+
+  bool Remote() const { return true; }
+
+ private:
+  std::vector<std::string> addrs_;
+  int rank_;
+  int prev_fd_; //!< receives from the previous rank
+  int next_fd_; //!< sends to the next rank
+  bool has_token_;
+  uint32_t generation_;
+  bool closed_; //!< a neighbour went away
+  DeltaExchange inbox_; //!< last delta of the previous rank, and our scratch
+  DeltaExchange outbox_; //!< our delta for the next rank
+  std::vector<char> buf_;
+
+  static bool WriteAll(int fd, const char *p, size_t len) {
+    while (len > 0) {
+      ssize_t n = write(fd, p, len);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      p += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  static bool ReadAll(int fd, char *p, size_t len) {
+    while (len > 0) {
+      ssize_t n = read(fd, p, len);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      p += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  static void SetNoDelay(int fd) {
+    int one = 1;
+    // fails harmlessly on Unix sockets
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+
+  /*! \brief Resolves addr, returns false on error */
+  static bool Resolve(std::string const &addr, struct sockaddr_storage &sa,
+                      socklen_t &len, int &family) {
+    memset(&sa, 0, sizeof(sa));
+    if (addr.compare(0, 5, "unix:") == 0) {
+      struct sockaddr_un *un = reinterpret_cast<struct sockaddr_un*>(&sa);
+      std::string path = addr.substr(5);
+      if (path.size() >= sizeof(un->sun_path)) {
+        printf("Socket path `%s' is too long\n", path.c_str());
+        return false;
+      }
+      un->sun_family = AF_UNIX;
+      strcpy(un->sun_path, path.c_str());
+      len = sizeof(struct sockaddr_un);
+      family = AF_UNIX;
+      return true;
+    }
+    size_t colon = addr.rfind(':');
+    if (colon == std::string::npos) {
+      printf("Address `%s' should be host:port or unix:/path\n", addr.c_str());
+      return false;
+    }
+    std::string host = addr.substr(0, colon);
+    std::string port = addr.substr(colon + 1);
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+    if (err != 0) {
+      printf("Cannot resolve `%s': %s\n", addr.c_str(), gai_strerror(err));
+      return false;
+    }
+    memcpy(&sa, res->ai_addr, res->ai_addrlen);
+    len = res->ai_addrlen;
+    family = res->ai_family;
+    freeaddrinfo(res);
+    return true;
+  }
+
+  static int Listen(std::string const &addr) {
+    struct sockaddr_storage sa;
+    socklen_t len;
+    int family;
+    if (!Resolve(addr, sa, len, family)) {
+      return -1;
+    }
+    int fd = socket(family, SOCK_STREAM, 0);
+    if (fd < 0) {
+      perror("socket failed");
+      return -1;
+    }
+    if (family == AF_UNIX) {
+      unlink(reinterpret_cast<struct sockaddr_un*>(&sa)->sun_path);
+    } else {
+      int one = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&sa), len) < 0 ||
+        listen(fd, 1) < 0) {
+      perror(("cannot listen on " + addr).c_str());
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  /*! \brief Connects to addr, retrying for a minute while it comes up */
+  static int ConnectTo(std::string const &addr) {
+    struct sockaddr_storage sa;
+    socklen_t len;
+    int family;
+    if (!Resolve(addr, sa, len, family)) {
+      return -1;
+    }
+    for (int attempt = 0; attempt < 600; ++attempt) {
+      int fd = socket(family, SOCK_STREAM, 0);
+      if (fd < 0) {
+        perror("socket failed");
+        return -1;
+      }
+      if (connect(fd, reinterpret_cast<struct sockaddr*>(&sa), len) == 0) {
+        return fd;
+      }
+      close(fd);
+      usleep(100000);
+    }
+    printf("Cannot connect to %s\n", addr.c_str());
+    return -1;
+  }
+
+  bool WriteMessage() {
+    DeltaMessageHeader h;
+    h.magic = kDeltaMessageMagic + outbox_.mode;
+    h.generation = generation_;
+    buf_.clear();
+    if (outbox_.pending) {
+      if (outbox_.mode == kCompressQ8) {
+        // scales of all blocks, then the codes of the blocks that were sent
+        h.count = outbox_.nblocks;
+        Append((const char*) outbox_.scales, sizeof(float) * outbox_.nblocks);
+        for (unsigned b = 0; b < outbox_.nblocks; ++b) {
+          if (outbox_.scales[b] == 0) continue;
+          unsigned start = b * kQ8BlockSize;
+          unsigned end = std::min(start + kQ8BlockSize, outbox_.dim);
+          Append((const char*) outbox_.codes + start, end - start);
+        }
+      } else {
+        h.count = outbox_.count;
+        Append((const char*) outbox_.index, sizeof(uint32_t) * outbox_.count);
+        Append((const char*) outbox_.values, sizeof(float) * outbox_.count);
+      }
+      outbox_.pending = 0;
+    } else {
+      // only the token
+      h.count = 0;
+    }
+    h.bytes = buf_.size();
+    return WriteAll(next_fd_, (const char*) &h, sizeof(h)) &&
+        WriteAll(next_fd_, buf_.data(), buf_.size());
+  }
+
+  void Append(const char *p, size_t len) {
+    buf_.insert(buf_.end(), p, p + len);
+  }
+
+  /*! \brief Reads a message of the previous rank into inbox_
+   * A message that is not what this rank would send, in its mode, its size
+   * or its indices, is dropped with the connection, as if the previous rank
+   * went away, before any of it is applied.
+   * \return true if it carried the token
+   */
+  bool ReadMessage() {
+    DeltaMessageHeader h;
+    if (!ReadAll(prev_fd_, (char*) &h, sizeof(h))) {
+      closed_ = true;
+      return false;
+    }
+    if (h.magic != kDeltaMessageMagic + (uint32_t) inbox_.mode) {
+      return Malformed("unexpected message, all ranks must use the same "
+                       "--compress");
+    }
+    if (h.bytes > MaxPayload()) {
+      return Malformed("message larger than any delta");
+    }
+    buf_.resize(h.bytes);
+    if (!ReadAll(prev_fd_, buf_.data(), h.bytes)) {
+      closed_ = true;
+      return false;
+    }
+    if (h.count == 0 && h.bytes != 0) {
+      return Malformed("token with a payload");
+    }
+    if (h.generation != generation_ || h.count == 0) {
+      // the token alone, or a delta of another model
+      inbox_.pending = 0;
+      return true;
+    }
+    const char *p = buf_.data();
+    if (inbox_.mode == kCompressQ8) {
+      // the scales tell which blocks follow
+      size_t const scale_bytes = sizeof(float) * inbox_.nblocks;
+      if (h.count != inbox_.nblocks || h.bytes < scale_bytes) {
+        return Malformed("q8 delta of another dimension");
+      }
+      size_t expected = scale_bytes;
+      for (unsigned b = 0; b < inbox_.nblocks; ++b) {
+        float scale;
+        memcpy(&scale, p + sizeof(float) * b, sizeof(scale));
+        if (scale == 0) continue;
+        unsigned start = b * kQ8BlockSize;
+        expected += std::min(start + kQ8BlockSize, inbox_.dim) - start;
+      }
+      if (h.bytes != expected) {
+        return Malformed("q8 delta of the wrong size");
+      }
+      memcpy(inbox_.scales, p, scale_bytes);
+      p += scale_bytes;
+      for (unsigned b = 0; b < inbox_.nblocks; ++b) {
+        if (inbox_.scales[b] == 0) continue;
+        unsigned start = b * kQ8BlockSize;
+        unsigned end = std::min(start + kQ8BlockSize, inbox_.dim);
+        memcpy(inbox_.codes + start, p, end - start);
+        p += end - start;
+      }
+    } else {
+      if (h.count > inbox_.capacity ||
+          h.bytes != (sizeof(uint32_t) + sizeof(float)) * (size_t) h.count) {
+        return Malformed("top-k delta of the wrong size");
+      }
+      for (uint32_t n = 0; n < h.count; ++n) {
+        uint32_t i;
+        memcpy(&i, p + sizeof(uint32_t) * n, sizeof(i));
+        if (i >= inbox_.dim) {
+          return Malformed("top-k delta index out of the model");
+        }
+      }
+      inbox_.count = h.count;
+      memcpy(inbox_.index, p, sizeof(uint32_t) * inbox_.count);
+      memcpy(inbox_.values, p + sizeof(uint32_t) * inbox_.count,
+             sizeof(float) * inbox_.count);
+    }
+    inbox_.pending = 1;
+    return true;
+  }
+
+  //! Largest payload a rank of our mode and dimension sends
+  size_t MaxPayload() const {
+    if (inbox_.mode == kCompressQ8) {
+      return sizeof(float) * inbox_.nblocks + inbox_.dim;
+    }
+    return (sizeof(uint32_t) + sizeof(float)) * (size_t) inbox_.capacity;
+  }
+
+  //! Drops the ring like a rank that went away, returns false
+  bool Malformed(const char *why) {
+    printf("rank %d: %s, no longer syncing with rank %d\n", rank_, why,
+           (rank_ + (int) addrs_.size() - 1) % (int) addrs_.size());
+    inbox_.pending = 0;
+    closed_ = true;
+    return false;
+  }
+};
+
+} // namespace svm
+} // namespace hogwild
+} // namespace hazy
+#endif
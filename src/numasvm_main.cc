@@ -15,13 +15,22 @@
 // Hogwild!, part of the Hazy Project
 // Author : Victor Bittorf (bittorf [at] cs.wisc.edu)
 // Original Hogwild! Author: Chris Re (chrisre [at] cs.wisc.edu)             
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <set>
+#include <string>
+#include <sstream>
+#include <vector>
 #include <numa.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <signal.h>
 
 #include "hazy/hogwild/hogwild-inl.h"
 #include "hazy/hogwild/numa_memory_scan.h"
+#include "hazy/hogwild/scaling_report.h"
 #include "hazy/scan/tsvfscan.h"
 #include "hazy/scan/binfscan.h"
 
@@ -46,8 +55,20 @@ using namespace hazy::hogwild::svm;
 
 
 template <class Scan>
-size_t NumaLoadSVMExamples(Scan &scan, vector::FVector<SVMExample> * nodeex, unsigned nnodes) { 
+size_t NumaLoadSVMExamples(Scan &scan, vector::FVector<SVMExample> * nodeex, unsigned nnodes, int only_node = -1) { 
   size_t nfeats = 0;
+  if (only_node >= 0) {
+    // a single copy on the given node, the other nodes refer to it
+    numa_run_on_node(only_node);
+    numa_set_preferred(only_node);
+    nfeats = LoadSVMExamples<Scan>(scan, nodeex[only_node]);
+    for (unsigned n = 0; n < nnodes; ++n) {
+      nodeex[n] = nodeex[only_node];
+    }
+    numa_run_on_node(-1);
+    numa_set_localalloc();
+    return nfeats;
+  }
 #if 0
   for (unsigned i = 0; i < nnodes; ++i) {
     scan.Reset();
@@ -88,6 +109,26 @@ size_t NumaLoadSVMExamples(Scan &scan, vector::FVector<SVMExample> * nodeex, uns
   return nfeats;
 }
 
+/* keeps every nshards-th example starting at shard, and frees the others.
+   nodeex must hold a single copy shared by all nodes (see NumaLoadSVMExamples). */
+void ShardSVMExamples(vector::FVector<SVMExample> * nodeex, unsigned nnodes, int nshards, int shard) {
+  vector::FVector<SVMExample> &ex = nodeex[0];
+  size_t kept = 0;
+  for (size_t i = 0; i < ex.size; ++i) {
+    if ((int) (i % nshards) == shard) {
+      ex.values[kept++] = ex.values[i];
+    }
+    else {
+      delete [] ex.values[i].vector.values;
+      delete [] ex.values[i].vector.index;
+    }
+  }
+  ex.size = kept;
+  for (unsigned n = 1; n < nnodes; ++n) {
+    nodeex[n] = ex;
+  }
+}
+
 fp_type SolveBeta(int n) {
   fp_type start = 0.6;
   fp_type end = 1.0;
@@ -110,10 +151,29 @@ fp_type SolveBeta(int n) {
   return mid;
 }
 
+/* faults in the models of the clusters in parallel, each on the threads of its
+   own cluster (a view of tpool), all the clusters at once */
+void TouchClusterModels(std::vector<util::FirstTouch> &touches, hazy::thread::ThreadPool &tpool, unsigned nthreads, unsigned cluster_size) {
+  unsigned phycpu_count = tpool.PhyCPUCount();
+  std::vector<std::vector<unsigned> > cluster_threads(touches.size());
+  for (unsigned i = 0; i < nthreads; ++i) {
+    cluster_threads[(i % phycpu_count) / cluster_size].push_back(i);
+  }
+  std::vector<hazy::thread::ThreadPool*> views;
+  for (size_t k = 0; k < touches.size(); ++k) {
+    views.push_back(new hazy::thread::ThreadPool(tpool, cluster_threads[k]));
+    touches[k].Start(*views[k]);
+  }
+  for (size_t k = 0; k < touches.size(); ++k) {
+    touches[k].Wait();
+    delete views[k];
+  }
+}
+
 /* this function creates models in a ring manner and groups cluster_size threads into a cluster, which shares a single model.
    the cluster_size variable is the "c" in HogWild++ paper.
 */
-int CreateNumaClusterRoundRobinRingSVMModel(NumaSVMModel * &node_m, size_t nfeats, hazy::thread::ThreadPool &tpool, unsigned nthreads, unsigned cluster_size, int update_delay) {
+int CreateNumaClusterRoundRobinRingSVMModel(NumaSVMModel * &node_m, size_t nfeats, hazy::thread::ThreadPool &tpool, unsigned nthreads, unsigned cluster_size, int update_delay, int compress, double topk_ratio, Transport *transport, int huge_pages) {
   /* determine which w to access for each thread */
   int * thread_to_weights_mapping = new int[nthreads];
   int * next_weights = new int[nthreads];
@@ -155,6 +215,7 @@ int CreateNumaClusterRoundRobinRingSVMModel(NumaSVMModel * &node_m, size_t nfeat
   int * atomic_ptr = new int ();
   int atomic_mask = (1 << (sizeof(int) * 8 - (weights_count - 1 ? __builtin_clz(weights_count - 1) : 32))) - 1;
   node_m = new NumaSVMModel[weights_count]; // some of them are just pointers to other weights
+  std::vector<util::FirstTouch> touches(cluster_count);
 //  printf("Model array allocated at %p\n", node_m);
 //  PrintNumaMemStats();
   for (int i = 0; i < weights_count; ++i) {
@@ -165,7 +226,11 @@ int CreateNumaClusterRoundRobinRingSVMModel(NumaSVMModel * &node_m, size_t nfeat
     if (i / cluster_count == 0) {
       // only allocate memory for the first thread in each cluster
 //      printf("Allocating memory for weight %d (thread %d) on node %d\n", i, thread_id, node);
-      node_m[i].AllocateModel(nfeats);
+      node_m[i].AllocateModel(nfeats, node, huge_pages, &touches[i]);
+      if (compress != kCompressNone) {
+        // the mailbox lives next to the receiving model
+        node_m[i].AllocateExchange(compress, topk_ratio, i + 1);
+      }
 //      PrintNumaMemStats();
     }
     else {
@@ -174,6 +239,8 @@ int CreateNumaClusterRoundRobinRingSVMModel(NumaSVMModel * &node_m, size_t nfeat
     }
     // now initializes the token (atomic counter)
     node_m[i].atomic_ptr = atomic_ptr;
+    node_m[i].token_index = i;
+    node_m[i].transport = transport;
     node_m[i].atomic_mask = atomic_mask;
     // each thread will increase the counter by atomic_inc_value
     if (i == weights_count - 1) {
@@ -190,10 +257,99 @@ int CreateNumaClusterRoundRobinRingSVMModel(NumaSVMModel * &node_m, size_t nfeat
   }
   numa_run_on_node(-1);
   numa_set_localalloc();
+  TouchClusterModels(touches, tpool, nthreads, cluster_size);
   return weights_count;
 }
 
-void PrintWeights(NumaSVMModel * node_m, int weights_count, int nthreads, hazy::thread::ThreadPool &tpool) {
+/* cluster size giving one cluster per last level cache domain (e.g. per CCX on
+   AMD EPYC), so that the threads sharing a model also share their L3. The pool
+   puts consecutive threads in the same domain, so the clusters of consecutive
+   threads built above line up with the domains when they all hold as many threads */
+int CacheDomainClusterSize(hazy::thread::ThreadPool &tpool, unsigned nthreads) {
+  unsigned used = nthreads > tpool.PhyCPUCount() ? tpool.PhyCPUCount() : nthreads;
+  std::vector<unsigned> domain_threads(tpool.CacheDomainCount(), 0);
+  for (unsigned i = 0; i < used; ++i) {
+    domain_threads[tpool.GetThreadCacheDomain(i)]++;
+  }
+  unsigned size = 0;
+  for (unsigned d = 0; d < domain_threads.size(); ++d) {
+    if (domain_threads[d] == 0)
+      continue;
+    if (size != 0 && domain_threads[d] != size) {
+      printf("Cache domains hold %d and %d threads, cannot make one cluster per domain. "
+             "Set --splits to fill whole domains or use --cluster_size.\n", size, domain_threads[d]);
+      exit(-1);
+    }
+    size = domain_threads[d];
+  }
+  return size;
+}
+
+/* rank 0 gives up if another rank dies, it would otherwise wait for it forever.
+   Only async-signal-safe calls here: the message is formatted by hand and written
+   with write(2) */
+void OnRankExit(int /* sig */) {
+  int saved_errno = errno;
+  int status;
+  pid_t pid;
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      static char msg[64] = "process ";
+      char digits[24];
+      int n = 0;
+      for (unsigned long p = pid; p > 0 || n == 0; p /= 10) {
+        digits[n++] = '0' + p % 10;
+      }
+      size_t len = 8;
+      while (n > 0) {
+        msg[len++] = digits[--n];
+      }
+      static const char kTail[] = " failed, exiting\n";
+      memcpy(msg + len, kTail, sizeof(kTail) - 1);
+      len += sizeof(kTail) - 1;
+      ssize_t ignored = write(STDERR_FILENO, msg, len);
+      (void) ignored;
+      _exit(-1);
+    }
+  }
+  errno = saved_errno;
+}
+
+/* in multi-process mode each process is one cluster of the ring: all threads share
+   the local replica, and the first thread syncs it with the next process through
+   the transport. token is the shared counter used by the default Transport::TryAcquire */
+int CreateProcessRingSVMModel(NumaSVMModel * &node_m, size_t nfeats, hazy::thread::ThreadPool &tpool, unsigned nthreads, Transport *transport, int *token, int nprocs, int rank, int update_delay, int huge_pages) {
+  int * thread_to_weights_mapping = new int[nthreads];
+  int * next_weights = new int[nthreads];
+  for (unsigned i = 0; i < nthreads; ++i) {
+    thread_to_weights_mapping[i] = 0;
+    next_weights[i] = -1;
+  }
+  // the transport does not use the next model, it only has to be set
+  next_weights[0] = 0;
+  int atomic_mask = (1 << (sizeof(int) * 8 - (nprocs - 1 ? __builtin_clz(nprocs - 1) : 32))) - 1;
+  int node = tpool.GetThreadNodeAffinity(0);
+  numa_run_on_node(node);
+  numa_set_preferred(node);
+  node_m = new NumaSVMModel[1];
+  util::FirstTouch touch;
+  node_m[0].AllocateModel(nfeats, node, huge_pages, &touch);
+  touch.Start(tpool);
+  touch.Wait();
+  node_m[0].atomic_ptr = token;
+  node_m[0].atomic_mask = atomic_mask;
+  node_m[0].atomic_inc_value = rank == nprocs - 1 ? atomic_mask - nprocs + 2 : 1;
+  node_m[0].token_index = rank;
+  node_m[0].transport = transport;
+  node_m[0].thread_to_weights_mapping = thread_to_weights_mapping;
+  node_m[0].next_weights = next_weights;
+  node_m[0].update_atomic_counter = update_delay * 8;
+  numa_run_on_node(-1);
+  numa_set_localalloc();
+  return nprocs;
+}
+
+void PrintWeights(NumaSVMModel * node_m, int /* weights_count */, int nthreads, hazy::thread::ThreadPool &tpool) {
   printf("Thread to weights map:\n");
   NumaSVMModel &model = node_m[0];
   for (int i = 0; i < nthreads; ++i) {
@@ -203,15 +359,115 @@ void PrintWeights(NumaSVMModel * node_m, int weights_count, int nthreads, hazy::
     NumaSVMModel * const next_m = next_weights >= 0 ? &node_m[next_weights] : NULL;
     int atomic_inc_value = m->atomic_inc_value;
     int atomic_mask = m->atomic_mask;
-    printf("Thread %2d (node %2d phycore %2d core %2d): "
+    printf("Thread %2d (node %2d llc %2d phycore %2d core %2d): "
 	   "%2d->%2d at %p->%p, (atomic+%2d) & %2x\n", 
-	   i, tpool.GetThreadNodeAffinity(i), tpool.GetThreadPhyCoreAffinity(i), 
-           tpool.GetThreadCoreAffinity(i), weights_index, next_weights,
+	   i, tpool.GetThreadNodeAffinity(i), tpool.GetThreadCacheDomain(i),
+           tpool.GetThreadPhyCoreAffinity(i), tpool.GetThreadCoreAffinity(i), weights_index, next_weights,
            m->weights.values, next_weights >= 0 ? next_m->weights.values: NULL,
            atomic_inc_value, atomic_mask);
   }
 }
 
+/* frees the models of CreateNumaClusterRoundRobinRingSVMModel() or
+   CreateProcessRingSVMModel(), the first nowners own their buffers and the
+   others mirror them. own_token if the atomic counter was allocated with them */
+void FreeRingSVMModel(NumaSVMModel * node_m, int nowners, bool own_token) {
+  for (int i = 0; i < nowners; ++i) {
+    node_m[i].FreeModel();
+  }
+  if (own_token) {
+    delete node_m[0].atomic_ptr;
+  }
+  delete [] node_m[0].thread_to_weights_mapping;
+  delete [] node_m[0].next_weights;
+  delete [] node_m;
+}
+
+/* initializes the nowners models of CreateNumaClusterRoundRobinRingSVMModel()
+   or CreateProcessRingSVMModel() from a checkpoint, with the average of its
+   replicas when it does not have as many */
+void RestoreRingSVMModel(NumaSVMModel * node_m, int nowners, util::Checkpoint const &ckpt) {
+  for (int i = 0; i < nowners; ++i) {
+    ckpt.Restore(i, nowners, node_m[i].weights.values);
+    // nothing to send to the next cluster yet
+    memcpy(node_m[i].old_weights.values, node_m[i].weights.values,
+           sizeof(fp_type) * node_m[i].weights.size);
+  }
+}
+
+/* one configuration of a --sweep, the options give the parameters the grid
+   does not list */
+struct SweepConfig {
+  unsigned nthreads;
+  int cluster_size;
+  int update_delay;
+  double tolerance;
+  float step_size;
+  float step_decay;
+};
+
+/* every combination of a grid such as "splits=4,8;cluster_size=2,4", the last
+   parameter varying fastest. Exits on an unknown parameter or a bad value */
+std::vector<SweepConfig> ParseSweep(std::string const &spec, SweepConfig const &base) {
+  std::vector<SweepConfig> configs(1, base);
+  std::stringstream ss(spec);
+  std::string axis;
+  while (std::getline(ss, axis, ';')) {
+    if (axis.empty())
+      continue;
+    size_t eq = axis.find('=');
+    std::string name = axis.substr(0, eq);
+    std::vector<double> values;
+    if (eq != std::string::npos) {
+      std::stringstream vs(axis.substr(eq + 1));
+      std::string v;
+      while (std::getline(vs, v, ',')) {
+        char *end;
+        double d = strtod(v.c_str(), &end);
+        if (v.empty() || *end != '\0') {
+          printf("Invalid value `%s' of %s in --sweep\n", v.c_str(), name.c_str());
+          exit(-1);
+        }
+        values.push_back(d);
+      }
+    }
+    if (values.empty()) {
+      printf("--sweep expects name=value,value,... separated by ;, got `%s'\n", axis.c_str());
+      exit(-1);
+    }
+    std::vector<SweepConfig> product;
+    for (size_t i = 0; i < configs.size(); ++i) {
+      for (size_t j = 0; j < values.size(); ++j) {
+        SweepConfig c = configs[i];
+        if (name == "splits") {
+          c.nthreads = (unsigned) values[j];
+        } else if (name == "cluster_size") {
+          c.cluster_size = (int) values[j];
+        } else if (name == "update_delay") {
+          c.update_delay = (int) values[j];
+        } else if (name == "tolerance") {
+          c.tolerance = values[j];
+        } else if (name == "stepinitial") {
+          c.step_size = values[j];
+        } else if (name == "step_decay") {
+          c.step_decay = values[j];
+        } else {
+          printf("Unknown --sweep parameter %s, expected splits, cluster_size, "
+                 "update_delay, tolerance, stepinitial or step_decay\n", name.c_str());
+          exit(-1);
+        }
+        if (c.nthreads == 0) {
+          printf("--sweep needs at least one thread\n");
+          exit(-1);
+        }
+        product.push_back(c);
+      }
+    }
+    configs.swap(product);
+  }
+  return configs;
+}
+
 int main(int argc, char** argv) {
   hazy::util::Clock wall_clock;
   wall_clock.Start();
@@ -226,6 +482,41 @@ int main(int argc, char** argv) {
   int update_delay = 256;
   double tolerance = 1e-2;
   double target_accuracy = 1.0;
+  bool average = false;
+  double ema = 1.0;
+  int huge_pages = util::kHugePagesNone;
+  unsigned eval_threads = 0;
+  double train_sample = 0;
+  int eval_policy = kEvalEvery;
+  int eval_every = 1;
+  size_t eval_sample = 2000;
+  double converge_obj = 0;
+  double converge_grad = 0;
+  int patience = 3;
+  size_t converge_sample = 1000;
+  bool perf = false;
+  std::string metrics_path;
+  std::string sweep;
+  int repeats = ITERATIONS;
+  std::string scaling_path;
+  unsigned seed = 0;
+  std::string checkpoint_path;
+  int checkpoint_every = 1;
+  std::string restore_path;
+  bool adaptive_sync = false;
+  double sync_budget = 0.05;
+  int compress = kCompressNone;
+  double topk_ratio = 0.01;
+  int nprocs = 1;
+  std::string transport_name = "shm";
+  std::string hosts;
+  int host_rank = -1;
+  int port = 7100;
+  long barrier_spin = -1;
+  bool steal = true;
+  bool cluster_by_cache = false;
+  int affinity = hazy::thread::kAffinitySMTLast;
+  std::vector<int> cpu_list;
   static struct extended_option long_options[] = {
     {"mu", required_argument, NULL, 'u', "the maxnorm"},
     {"epochs"    ,required_argument, NULL, 'e', "number of epochs (default is 20)"},
@@ -238,8 +529,42 @@ int main(int argc, char** argv) {
     {"matlab-tsv", required_argument,NULL, 'm', "load TSVs indexing from 1 instead of 0"},
     {"update_delay", required_argument, NULL, 't', "Number of iterations before pass the token to the next thread (default: 256)"},
     {"cluster_size", required_argument, NULL, 'c', "Cluster size (c). Threads in a cluster share the same weights (default: #CPU in one socket)"},
+    {"cluster_by_cache", required_argument, NULL, 'L', "make one cluster per last level cache domain instead of --cluster_size (default 0)"},
+    {"affinity", required_argument, NULL, 'A', "thread placement on the allowed CPUs: smt_last, compact or scatter (default smt_last)"},
+    {"cpus", required_argument, NULL, 'C', "pin thread i to the i-th CPU of a list such as 0-7,16-23 (overrides --affinity)"},
     {"tolerance", required_argument, NULL, 'o', "error tolerance when doing gradient update (default 1e-2)"},
     {"target_accuracy", required_argument,NULL, 'a', "target accuracy to converge"},
+    {"average", required_argument, NULL, 'g', "evaluate the average of all the cluster replicas (default 0)"},
+    {"ema", required_argument, NULL, 'w', "weight of the newest --average in an exponential moving average over epochs (default 1, no history)"},
+    {"eval_threads", required_argument, NULL, 'E', "evaluate each epoch on this many extra threads while the next epoch trains (default 0)"},
+    {"eval", required_argument, NULL, 'V', "epochs scored: every (--eval_every), sample (--eval_sample, all of the test set near the target) or adaptive (default every)"},
+    {"eval_every", required_argument, NULL, 'K', "score every k epochs, with --eval adaptive at most every 8k (default 1)"},
+    {"eval_sample", required_argument, NULL, 'Q', "test examples scored by --eval sample (default 2000)"},
+    {"converge_obj", required_argument, NULL, 'O', "stop when the training objective decreases by less than this fraction for --patience epochs (default 0, off)"},
+    {"converge_grad", required_argument, NULL, 'G', "stop when the gradient norm of a training sample is below this for --patience epochs (default 0, off)"},
+    {"patience", required_argument, NULL, 'T', "flat epochs in a row before --converge_obj or --converge_grad stop (default 3)"},
+    {"converge_sample", required_argument, NULL, 'D', "training examples of the --converge_grad estimate (default 1000)"},
+    {"train_sample", required_argument, NULL, 'S', "fraction of the training examples also scored after each epoch (default 0, train_acc repeats test_acc)"},
+    {"perf", required_argument, NULL, 'P', "print the hardware performance counters of every training thread after each epoch (default 0)"},
+    {"metrics", required_argument, NULL, 'M', "write one JSON line per run and per epoch to this file, - for stdout"},
+    {"sweep", required_argument, NULL, 'W', "run every combination of a grid such as \"splits=4,8;cluster_size=2,4;step_decay=0.8,0.9\" (also update_delay, tolerance, stepinitial) on the data loaded once"},
+    {"repeats", required_argument, NULL, 'R', "runs of each configuration (default 30)"},
+    {"scaling", required_argument, NULL, 'X', "write the median epoch time, examples/sec, time to target and speedups of each configuration to this file, CSV if it ends in .csv, JSON lines otherwise"},
+    {"checkpoint", required_argument, NULL, 'B', "write the replicas, step size, epoch and random state to this binary file while training (.<rank> appended with --processes)"},
+    {"checkpoint_every", required_argument, NULL, 'F', "epochs between two --checkpoint, the last epoch is always saved (default 1)"},
+    {"restore", required_argument, NULL, 'I', "resume from a --checkpoint file, averaging its replicas if there are not as many (.<rank> appended with --processes)"},
+    {"hugepages", required_argument, NULL, 'H', "pages of the models: none, thp (transparent), 2m or 1g (reserved hugetlbfs pages) (default none)"},
+    {"adaptive_sync", required_argument, NULL, 'y', "adapt update_delay and tolerance online, starting from the given values (default 0)"},
+    {"sync_budget", required_argument, NULL, 'b', "fraction of worker time the adaptive sync may spend synchronizing (default 0.05)"},
+    {"compress", required_argument, NULL, 'z', "compress the deltas sent to the next cluster: none, q8 or topk (default none)"},
+    {"topk_ratio", required_argument, NULL, 'k', "fraction of the coordinates sent by --compress topk (default 0.01)"},
+    {"processes", required_argument, NULL, 'p', "number of processes, one per NUMA node, exchanging models through shared memory (default 1)"},
+    {"transport", required_argument, NULL, 'x', "how --processes exchange models: shm, tcp (loopback) or unix (default shm)"},
+    {"hosts", required_argument, NULL, 'h', "comma separated host:port (or unix:/path) of every rank, to run across machines"},
+    {"rank", required_argument, NULL, 'n', "index of this process in --hosts"},
+    {"port", required_argument, NULL, 'l', "first loopback port of --transport tcp (default 7100)"},
+    {"steal", required_argument, NULL, 'f', "balance the examples between the threads by work stealing (default 1)"},
+    {"barrier_spin", required_argument, NULL, 'j', "microseconds the threads spin in the thread pool barriers before sleeping (default 50, 0 with more threads than CPUs)"},
     {NULL,0,NULL,0,0} 
   };
 
@@ -282,6 +607,127 @@ int main(int argc, char** argv) {
       case 'a':
         target_accuracy = atof(optarg);
         break;
+      case 'g':
+        average = (atoi(optarg) != 0);
+        break;
+      case 'w':
+        ema = atof(optarg);
+        break;
+      case 'y':
+        adaptive_sync = (atoi(optarg) != 0);
+        break;
+      case 'b':
+        sync_budget = atof(optarg);
+        break;
+      case 'z':
+        compress = ParseDeltaCompression(optarg);
+        break;
+      case 'k':
+        topk_ratio = atof(optarg);
+        break;
+      case 'p':
+        nprocs = atoi(optarg);
+        break;
+      case 'x':
+        transport_name = optarg;
+        break;
+      case 'h':
+        hosts = optarg;
+        break;
+      case 'n':
+        host_rank = atoi(optarg);
+        break;
+      case 'l':
+        port = atoi(optarg);
+        break;
+      case 'j':
+        barrier_spin = atol(optarg);
+        break;
+      case 'f':
+        steal = (atoi(optarg) != 0);
+        break;
+      case 'L':
+        cluster_by_cache = (atoi(optarg) != 0);
+        break;
+      case 'A':
+        affinity = hazy::thread::ThreadPool::ParseAffinity(optarg);
+        if (affinity < 0) {
+          printf("Unknown affinity policy %s\n", optarg);
+          exit(-1);
+        }
+        break;
+      case 'C':
+        cpu_list = hazy::thread::ThreadPool::ParseCPUList(optarg);
+        if (cpu_list.empty()) {
+          printf("Invalid CPU list %s\n", optarg);
+          exit(-1);
+        }
+        break;
+      case 'E':
+        eval_threads = atoi(optarg);
+        break;
+      case 'V':
+        eval_policy = ParseEvalPolicy(optarg);
+        if (eval_policy < 0) {
+          printf("Unknown evaluation policy %s\n", optarg);
+          exit(-1);
+        }
+        break;
+      case 'K':
+        eval_every = atoi(optarg);
+        break;
+      case 'Q':
+        eval_sample = atol(optarg);
+        break;
+      case 'O':
+        converge_obj = atof(optarg);
+        break;
+      case 'G':
+        converge_grad = atof(optarg);
+        break;
+      case 'T':
+        patience = atoi(optarg);
+        break;
+      case 'D':
+        converge_sample = atol(optarg);
+        break;
+      case 'S':
+        train_sample = atof(optarg);
+        break;
+      case 'P':
+        perf = atoi(optarg);
+        break;
+      case 'M':
+        metrics_path = optarg;
+        break;
+      case 'W':
+        sweep = optarg;
+        break;
+      case 'R':
+        repeats = atoi(optarg);
+        break;
+      case 'X':
+        scaling_path = optarg;
+        break;
+      case 's':
+        seed = strtoul(optarg, NULL, 10);
+        break;
+      case 'B':
+        checkpoint_path = optarg;
+        break;
+      case 'F':
+        checkpoint_every = atoi(optarg);
+        break;
+      case 'I':
+        restore_path = optarg;
+        break;
+      case 'H':
+        huge_pages = util::ParseHugePages(optarg);
+        if (huge_pages < 0) {
+          printf("Unknown huge page policy %s\n", optarg);
+          exit(-1);
+        }
+        break;
       case ':':
       case '?':
         print_usage(long_options, argv[0], usage_str);
@@ -300,11 +746,137 @@ int main(int argc, char** argv) {
     exit(-1);
   }
   //fp_type buf[50];
+  std::vector<std::string> addrs;
+  if (!hosts.empty()) {
+    std::stringstream ss(hosts);
+    std::string addr;
+    while (std::getline(ss, addr, ',')) {
+      addrs.push_back(addr);
+    }
+    nprocs = addrs.size();
+    transport_name = "tcp";
+    if (host_rank < 0 || host_rank >= nprocs) {
+      printf("--hosts needs --rank between 0 and %d\n", nprocs - 1);
+      exit(-1);
+    }
+  }
+  if (transport_name != "shm" && transport_name != "tcp" && transport_name != "unix") {
+    printf("Unknown transport `%s', expected shm, tcp or unix\n", transport_name.c_str());
+    exit(-1);
+  }
+  bool use_sockets = transport_name != "shm";
+  if (seed == 0) {
+    util::SimpleRandom::SeedByTime();
+    seed = util::SimpleRandom::Seed();
+  }
+  // each run (and each rank) is seeded from a stream of its own, so that a
+  // run of a sweep shuffles as the same run of any other configuration
+  printf("seed: %u\n", seed);
+  SweepConfig base = {nthreads, cluster_size, update_delay, tolerance, step_size, step_decay};
+  std::vector<SweepConfig> configs(1, base);
+  if (!sweep.empty()) {
+    if (nprocs > 1) {
+      printf("--sweep is not supported with --processes or --hosts\n");
+      exit(-1);
+    }
+    configs = ParseSweep(sweep, base);
+    // one stream for the whole sweep
+    if (metrics_path.empty()) {
+      metrics_path = "-";
+    }
+  }
+  // the pool of the largest configuration, the others run on its first threads
+  for (size_t k = 0; k < configs.size(); ++k) {
+    nthreads = std::max(nthreads, configs[k].nthreads);
+  }
+  if (nprocs > 1 && !use_sockets && compress != kCompressNone) {
+    printf("--compress is not supported with --transport shm\n");
+    exit(-1);
+  }
+
+  // in multi-process mode, fork one process (rank) per node, all of them
+  // inherit the ring header of rank 0, or listen on addresses derived from
+  // its pid
+  int rank = 0;
+  pid_t rank0_pid = getpid();
+  ShmRing ring(nprocs, 0);
+  if (addrs.empty() && use_sockets) {
+    for (int r = 0; r < nprocs; ++r) {
+      char addr[128];
+      if (transport_name == "tcp") {
+        sprintf(addr, "127.0.0.1:%d", port + r);
+      } else {
+        sprintf(addr, "unix:/tmp/numasvm-%d-%d.sock", (int) rank0_pid, r);
+      }
+      addrs.push_back(addr);
+    }
+  }
+  if (!hosts.empty()) {
+    // started by hand (or by a launcher) on every host
+    rank = host_rank;
+  }
+  else if (nprocs > 1) {
+    if (!use_sockets && !ring.Create()) {
+      exit(-1);
+    }
+    fflush(stdout);
+    for (int r = 1; r < nprocs; ++r) {
+      pid_t pid = fork();
+      if (pid < 0) {
+        perror("fork failed");
+        exit(-1);
+      }
+      if (pid == 0) {
+        rank = r;
+        ring.SetRank(r);
+        // do not outlive rank 0
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        break;
+      }
+    }
+    if (rank == 0) {
+      signal(SIGCHLD, OnRankExit);
+    }
+    if (rank != 0) {
+      // only rank 0 reports
+      if (freopen("/dev/null", "w", stdout) == NULL) {
+        perror("freopen failed");
+      }
+    }
+  }
 
   // we initialize thread pool here because we need CPU topology information
   // in HogWild++, the ThreadPool has been improved to assign CPU affinity
   hazy::thread::ThreadPool tpool(nthreads);
+  if (nprocs > 1) {
+    tpool.RestrictToNode(rank);
+  }
+  if (barrier_spin >= 0) {
+    tpool.SetBarrierSpin(barrier_spin * 1000ULL);
+  }
+  tpool.SetAffinity(affinity);
+  if (!cpu_list.empty()) {
+    tpool.SetCPUList(cpu_list);
+  }
   tpool.Init();
+  hazy::thread::ThreadPool *eval_pool = NULL;
+  if (eval_threads > 0) {
+    // on the CPUs the training leaves, or behind the training threads
+    eval_pool = new hazy::thread::ThreadPool(eval_threads);
+    std::vector<int> spare = tpool.UnusedCPUs();
+    if (!spare.empty()) {
+      eval_pool->SetCPUList(spare);
+    }
+    else {
+      eval_pool->SetNice(19);
+    }
+    eval_pool->Init();
+  }
+  util::MetricsSink *metrics = NULL;
+  if (!metrics_path.empty() && (rank == 0 || !hosts.empty())) {
+    metrics = new util::MetricsSink(metrics_path);
+  }
+  int ex_node = nprocs > 1 ? tpool.GetThreadNodeAffinity(0) : -1;
   
   unsigned nnodes = tpool.UsedNodeCount();
   printf("%d threads will be running on %d nodes\n", nthreads, nnodes);
@@ -316,26 +888,26 @@ int main(int argc, char** argv) {
   if (loadBinary) {
     printf("Loading binary file...\n");
     scan::BinaryFileScanner scan(szExampleFile);
-    nfeats = NumaLoadSVMExamples(scan, node_train_examps, nnodes);
+    nfeats = NumaLoadSVMExamples(scan, node_train_examps, nnodes, ex_node);
     printf("Loaded binary file!\n");
   } else if (matlab_tsv) {
     MatlabTSVFileScanner scan(szExampleFile);
-    nfeats = NumaLoadSVMExamples(scan, node_train_examps, nnodes);
+    nfeats = NumaLoadSVMExamples(scan, node_train_examps, nnodes, ex_node);
   } else {
     TSVFileScanner scan(szExampleFile);
-    nfeats = NumaLoadSVMExamples(scan, node_train_examps, nnodes);
+    nfeats = NumaLoadSVMExamples(scan, node_train_examps, nnodes, ex_node);
   }
   if (loadBinary) {
     printf("Loading binary file...\n");
     scan::BinaryFileScanner scantest(szTestFile);
-    NumaLoadSVMExamples(scantest, node_test_examps, nnodes);
+    NumaLoadSVMExamples(scantest, node_test_examps, nnodes, ex_node);
     printf("Loaded binary file!\n");
   } else if (matlab_tsv) {
     MatlabTSVFileScanner scantest(szTestFile);
-    NumaLoadSVMExamples(scantest, node_test_examps, nnodes);
+    NumaLoadSVMExamples(scantest, node_test_examps, nnodes, ex_node);
   } else {
     TSVFileScanner scantest(szTestFile);
-    NumaLoadSVMExamples(scantest, node_test_examps, nnodes);
+    NumaLoadSVMExamples(scantest, node_test_examps, nnodes, ex_node);
   }
 
   unsigned *degs = new unsigned[nfeats];
@@ -344,30 +916,250 @@ int main(int argc, char** argv) {
     degs[i] = 0;
   }
   CountDegrees(node_train_examps[0], degs);
+  SyncStats *sync_stats = new SyncStats[nthreads];
+  LocalTransport local_transport;
+  ShmTransport shm_transport(ring);
+  SocketTransport socket_transport(addrs, rank);
+  Transport *transport = &local_transport;
+  int socket_token = 0; // unused, the token travels with the messages
+  if (nprocs > 1) {
+    // the degrees above are those of the full dataset, each rank then
+    // trains on its own share of the examples
+    ShardSVMExamples(node_train_examps, nnodes, nprocs, rank);
+    if (use_sockets) {
+      if (!socket_transport.Connect(nfeats, compress, topk_ratio)) {
+        exit(-1);
+      }
+      transport = &socket_transport;
+    }
+    else {
+      if (!ring.Attach(nfeats)) {
+        exit(-1);
+      }
+      transport = &shm_transport;
+    }
+    printf("%d processes attached, rank %d has %lu examples on node %d\n",
+           nprocs, rank, node_train_examps[0].size, ex_node);
+  }
+  if (huge_pages != util::kHugePagesNone) {
+    PackNodeSVMExamples(node_train_examps, nnodes, ex_node, huge_pages);
+    PackNodeSVMExamples(node_test_examps, nnodes, ex_node, huge_pages);
+  }
 
-  for (int iteration = 0; iteration < ITERATIONS; ++iteration) {
-    NumaSVMModel* node_m;
-    int weights_count;
-    fp_type beta, lambda;
+  util::Checkpoint restore;
+  util::CheckpointWriter *checkpoint = NULL;
+  if (nprocs > 1) {
+    // one file per process, each has its own replica
+    std::stringstream suffix;
+    suffix << "." << rank;
+    if (!restore_path.empty()) {
+      restore_path += suffix.str();
+    }
+    if (!checkpoint_path.empty()) {
+      checkpoint_path += suffix.str();
+    }
+  }
+  if (!restore_path.empty()) {
+    if (!restore.Open(restore_path)) {
+      exit(-1);
+    }
+    if (restore.Dim() != nfeats) {
+      printf("%s has %lu features, the data %lu\n", restore_path.c_str(),
+             restore.Dim(), nfeats);
+      exit(-1);
+    }
+    printf("Restoring %lu replicas at epoch %d from %s\n", restore.Replicas(),
+           restore.Epoch(), restore_path.c_str());
+  }
+  if (!checkpoint_path.empty()) {
+    checkpoint = new util::CheckpointWriter(checkpoint_path);
+  }
+
+  ScalingReport scaling;
+  if (!sweep.empty()) {
+    printf("Sweeping %lu configurations, %d runs each\n", configs.size(), repeats);
+    if (metrics != NULL) {
+      util::MetricsRecord rec("sweep");
+      rec.Add("program", "numasvm");
+      rec.Add("grid", sweep);
+      rec.Add("configs", configs.size());
+      rec.Add("repeats", repeats);
+      rec.Add("seed", seed);
+      metrics->Write(rec);
+    }
+  }
+  for (size_t k = 0; k < configs.size(); ++k) {
+    SweepConfig const &config = configs[k];
+    // the first threads of the pool are placed as those of a pool of their own
+    hazy::thread::ThreadPool view(tpool, 0, config.nthreads);
+    cluster_size = config.cluster_size;
+    if (cluster_by_cache) {
+        cluster_size = CacheDomainClusterSize(view, config.nthreads);
+    }
     if (cluster_size <= 0) {
-        cluster_size = tpool.PhyCPUCount() / tpool.NodeCount();
-    }
-    weights_count = CreateNumaClusterRoundRobinRingSVMModel(node_m, nfeats, tpool, nthreads, cluster_size,update_delay);
-    beta = SolveBeta(weights_count / cluster_size);
-    lambda = 1 - pow(beta, weights_count / cluster_size - 1);
-
-    printf("weights_count=%d, beta=%f, lambda=%f\n", weights_count, beta, lambda);
-    PrintWeights(node_m, weights_count, nthreads, tpool);
-    SVMParams tp(step_size, step_decay, mu, beta, lambda, weights_count, true, update_delay, tolerance, &tpool);
-    tp.degrees = degs;
-    tp.ndim = nfeats;
-
-//  hogwild::freeforall::FeedTrainTest(memfeed.GetTrough(), nepochs, nthreads);
-    NumaMemoryScan<SVMExample> mscan(node_train_examps, nnodes);
-    Hogwild<NumaSVMModel, SVMParams, NumaSVMExec> hw(node_m[0], tp, tpool);
-    NumaMemoryScan<SVMExample> tscan(node_test_examps, nnodes);
-    printf("Run experiment: threads=%d c=%d\n", nthreads, cluster_size);
-    hw.RunExperiment(nepochs, wall_clock, mscan, tscan, target_accuracy);
+        cluster_size = view.PhyCPUCount() / view.NodeCount();
+    }
+    unsigned phycpu_count = view.PhyCPUCount();
+    if (nprocs == 1 && (config.nthreads % cluster_size != 0 ||
+        (config.nthreads > phycpu_count && phycpu_count % cluster_size != 0))) {
+      printf("threads=%d c=%d: the threads, and the cores when there are fewer, "
+             "must be a multiple of the cluster size\n", config.nthreads, cluster_size);
+      if (sweep.empty()) {
+        exit(-1);
+      }
+      continue;
+    }
+    if (!sweep.empty()) {
+      printf("Sweep %lu/%lu: threads=%d c=%d update_delay=%d tolerance=%g stepinitial=%g step_decay=%g\n",
+             k + 1, configs.size(), config.nthreads, cluster_size, config.update_delay,
+             config.tolerance, config.step_size, config.step_decay);
+    }
+    util::PerfCounters *perf_counters = NULL;
+    if (perf) {
+      perf_counters = new util::PerfCounters(view);
+    }
+    ScalingReport::Params params;
+    params.push_back(std::make_pair(std::string("update_delay"), (double) config.update_delay));
+    params.push_back(std::make_pair(std::string("tolerance"), config.tolerance));
+    params.push_back(std::make_pair(std::string("stepinitial"), (double) config.step_size));
+    params.push_back(std::make_pair(std::string("step_decay"), (double) config.step_decay));
+    scaling.AddConfig(config.nthreads, cluster_size, params);
+    for (int iteration = 0; iteration < repeats; ++iteration) {
+      util::SimpleRandom::SetSeed(util::SimpleRandom::StreamSeed(seed, iteration * nprocs + rank));
+      NumaSVMModel* node_m;
+      int weights_count;
+      fp_type beta, lambda;
+      if (nprocs > 1) {
+        transport->Reset();
+        weights_count = CreateProcessRingSVMModel(node_m, nfeats, view, config.nthreads, transport,
+                                                  use_sockets ? &socket_token : ring.Token(),
+                                                  nprocs, rank, config.update_delay, huge_pages);
+        beta = SolveBeta(nprocs);
+        lambda = 1 - pow(beta, nprocs - 1);
+      }
+      else {
+        weights_count = CreateNumaClusterRoundRobinRingSVMModel(node_m, nfeats, view, config.nthreads, cluster_size, config.update_delay, compress, topk_ratio, transport, huge_pages);
+        beta = SolveBeta(weights_count / cluster_size);
+        lambda = 1 - pow(beta, weights_count / cluster_size - 1);
+      }
+
+      printf("weights_count=%d, beta=%f, lambda=%f\n", weights_count, beta, lambda);
+      PrintWeights(node_m, weights_count, config.nthreads, view);
+      SVMParams tp(config.step_size, config.step_decay, mu, beta, lambda, weights_count, true,
+                   config.update_delay, config.tolerance, &view);
+      tp.degrees = degs;
+      tp.ndim = nfeats;
+      tp.compress = compress;
+      tp.steal = steal;
+      if (!restore_path.empty()) {
+        RestoreRingSVMModel(node_m, nprocs > 1 ? 1 : weights_count / cluster_size, restore);
+        tp.step_size = restore.StepSize();
+        restore.RestoreRandom();
+      }
+      SyncController sync_ctrl(config.update_delay, config.tolerance, sync_budget);
+      for (unsigned i = 0; i < config.nthreads; ++i) {
+        sync_stats[i].Reset();
+      }
+      tp.sync_stats = sync_stats;
+      if (adaptive_sync) {
+        tp.sync_ctrl = &sync_ctrl;
+      }
+
+//    hogwild::freeforall::FeedTrainTest(memfeed.GetTrough(), nepochs, nthreads);
+      NumaMemoryScan<SVMExample> mscan(node_train_examps, nnodes, huge_pages);
+      ModelSnapshot<fp_type> *snapshot = NULL;
+      if (average) {
+        snapshot = new ModelSnapshot<fp_type>(nfeats, ema);
+        // with --processes the other replicas live in the other processes
+        int local_count = nprocs > 1 ? 1 : weights_count;
+        for (int i = 0; i < local_count; ++i) {
+          snapshot->AddReplica(node_m[i].weights.values);
+        }
+        node_m[0].snapshot = snapshot;
+        printf("Evaluating the average of %lu replicas, ema=%g\n", snapshot->ReplicaCount(), ema);
+      }
+      else if (eval_pool != NULL) {
+        // the evaluation runs during the next epoch, on a copy of the model
+        // the synchronous accuracy reads, see EvalWeights()
+        snapshot = new ModelSnapshot<fp_type>(nfeats, 1.0);
+        snapshot->AddReplica(node_m[0].weights.values);
+        node_m[0].snapshot = snapshot;
+      }
+      Hogwild<NumaSVMModel, SVMParams, NumaSVMExec> hw(node_m[0], tp, view);
+      hw.SetEvalPool(eval_pool);
+      hw.SetPerfCounters(perf_counters);
+      hw.SetMetrics(metrics);
+      hw.SetTrainSample(train_sample);
+      hw.SetEvalPolicy(eval_policy, eval_every, eval_sample);
+      hw.SetConvergence(converge_obj, converge_grad, patience, converge_sample);
+      hw.SetCheckpoint(checkpoint, checkpoint_every);
+      if (!restore_path.empty()) {
+        hw.SetStartEpoch(restore.Epoch());
+      }
+      NumaMemoryScan<SVMExample> tscan(node_test_examps, nnodes, huge_pages, false);
+      printf("Run experiment: threads=%d c=%d\n", config.nthreads, cluster_size);
+      if (metrics != NULL) {
+        util::MetricsRecord rec("run");
+        rec.Add("program", "numasvm");
+        rec.Add("config", k);
+        rec.Add("iteration", iteration);
+        rec.Add("seed", util::SimpleRandom::Seed());
+        rec.Add("rank", rank);
+        rec.Add("processes", nprocs);
+        rec.Add("threads", config.nthreads);
+        rec.Add("nodes", view.UsedNodeCount());
+        rec.Add("clusters", weights_count);
+        rec.Add("cluster_size", cluster_size);
+        rec.Add("update_delay", config.update_delay);
+        rec.Add("tolerance", config.tolerance);
+        rec.Add("adaptive_sync", (int) adaptive_sync);
+        rec.Add("step_size", (double) config.step_size);
+        rec.Add("step_decay", (double) config.step_decay);
+        rec.Add("examples", node_train_examps[0].size);
+        rec.Add("features", nfeats);
+        metrics->Write(rec);
+      }
+      hw.RunExperiment(nepochs, wall_clock, mscan, tscan, target_accuracy);
+      scaling.AddRun(hw.Result());
+      delete snapshot;
+      if (nprocs > 1) {
+        FreeRingSVMModel(node_m, 1, false);
+      }
+      else {
+        FreeRingSVMModel(node_m, weights_count / cluster_size, true);
+      }
+    }
+    delete perf_counters;
+  }
+  if (!sweep.empty() || !scaling_path.empty()) {
+    scaling.Print();
+    if (metrics != NULL) {
+      scaling.WriteMetrics(*metrics);
+    }
+  }
+  if (!scaling_path.empty() && (rank == 0 || !hosts.empty())) {
+    std::string const csv = ".csv";
+    if (scaling_path.size() >= csv.size() &&
+        scaling_path.compare(scaling_path.size() - csv.size(), csv.size(), csv) == 0) {
+      scaling.WriteCSV(scaling_path);
+    }
+    else {
+      util::MetricsSink sink(scaling_path);
+      scaling.WriteMetrics(sink);
+    }
+  }
+  delete [] sync_stats;
+  delete checkpoint;
+  delete eval_pool;
+  delete metrics;
+  if (nprocs > 1 && !use_sockets) {
+    ring.Detach();
+  }
+  if (nprocs > 1 && hosts.empty()) {
+    if (rank == 0) {
+      signal(SIGCHLD, SIG_DFL);
+      while (wait(NULL) > 0);
+    }
   }
   return 0;
 }
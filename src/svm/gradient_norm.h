@@ -0,0 +1,86 @@
+// Copyright 2012 Victor Bittorf, Chris Re
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Hogwild!, part of the Hazy Project
+// Author : Victor Bittorf (bittorf [at] cs.wisc.edu)
+// Original Hogwild! Author: Chris Re (chrisre [at] cs.wisc.edu)
+
+#ifndef HAZY_HOGWILD_INSTANCES_SVM_GRADIENT_NORM_H
+#define HAZY_HOGWILD_INSTANCES_SVM_GRADIENT_NORM_H
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "hazy/vector/fvector.h"
+#include "hazy/vector/svector.h"
+#include "hazy/vector/dot-inl.h"
+
+namespace hazy {
+namespace hogwild {
+namespace svm {
+
+/*! \brief Norm of the hinge loss gradient over a sample, per example
+ * Only the features of the sampled examples have a nonzero gradient, so
+ * their (feature, term) pairs are sorted and summed by feature instead of
+ * filling a vector of the model dimension.
+ * \param w the evaluated weights
+ * \param mu the regularization, spread over the degrees of the features
+ * \param degrees degree of each feature
+ * \param sample the examples, e.g. of Hogwild::SampleExamples()
+ */
+template <class T, class Example>
+double SampledGradientNorm(vector::FVector<T> const &w, double mu,
+                           unsigned const *degrees,
+                           std::vector<Example const *> const &sample) {
+  if (sample.empty()) {
+    return 0.0;
+  }
+  size_t nnz = 0;
+  for (size_t k = 0; k < sample.size(); ++k) {
+    nnz += sample[k]->vector.size;
+  }
+  std::vector<std::pair<int, double> > terms;
+  terms.reserve(nnz);
+  for (size_t k = 0; k < sample.size(); ++k) {
+    Example const &e = *sample[k];
+    bool hinge = vector::Dot(w, e.vector) * e.value < 1;
+    for (size_t i = 0; i < e.vector.size; ++i) {
+      int const j = e.vector.index[i];
+      double g = mu * w.values[j] / degrees[j];
+      if (hinge) {
+        g -= e.value * e.vector.values[i];
+      }
+      terms.push_back(std::make_pair(j, g));
+    }
+  }
+  std::sort(terms.begin(), terms.end());
+  double norm = 0;
+  for (size_t i = 0; i < terms.size(); ) {
+    double g = 0;
+    size_t n = i;
+    for (; n < terms.size() && terms[n].first == terms[i].first; ++n) {
+      g += terms[n].second;
+    }
+    norm += g * g;
+    i = n;
+  }
+  return std::sqrt(norm) / sample.size();
+}
+
+} // namespace svm
+} // namespace hogwild
+} // namespace hazy
+#endif
@@ -20,8 +20,11 @@
 #define HAZY_HOGWILD_INSTANCES_SVM_SVM_EXEC_H
 
 #include <cmath>
+#include <vector>
 
 #include "hazy/hogwild/hogwild_task.h"
+#include "hazy/util/checkpoint.h"
+#include "hazy/util/metrics.h"
 
 #include "svmmodel.h"
 
@@ -65,7 +68,24 @@ class SVMExec {
 
   static void PostEpoch(SVMModel &model, SVMParams &params) {
   }
+
+  //! Adds the counters of the last epoch to its metrics, before PostEpoch
+  static void EpochMetrics(SVMModel &model, SVMParams &params,
+                           util::MetricsRecord &epoch,
+                           std::vector<util::MetricsRecord> &threads) {
+  }
   static double ModelObj(SVMTask &task, unsigned tid, unsigned total);
+
+  /*! \brief Norm of the average stochastic gradient of the examples
+   * The gradients of the hinge loss and of the share of the regularization
+   * ModelUpdate() applies, at the model that is evaluated.
+   */
+  static double GradientNorm(const SVMModel &model, const SVMParams &params,
+                             std::vector<SVMExample const *> const &sample);
+
+  //! Saves the model, see Hogwild::SetCheckpoint()
+  static void SaveCheckpoint(SVMModel &model, SVMParams &params,
+                             int epoch, util::CheckpointWriter &writer);
   static double ModelAccuracy(SVMTask &task, unsigned tid, unsigned total);
 };
 
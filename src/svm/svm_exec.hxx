@@ -19,7 +19,9 @@
 #include "hazy/vector/dot-inl.h"
 #include "hazy/vector/scale_add-inl.h"
 #include "hazy/hogwild/tools-inl.h"
+#include "hazy/hogwild/freeforall-inl.h"
 #include "hazy/util/clock.h"
+#include "gradient_norm.h"
 
 namespace hazy {
 namespace hogwild {
@@ -77,18 +79,20 @@ double SVMExec::UpdateModel(SVMTask &task, unsigned tid, unsigned total) {
 
   SVMParams const &params = *task.params;
   vector::FVector<SVMExample> const & exampsvec = task.block->ex;
-  // calculate which chunk of examples we work on
-  size_t start = hogwild::GetStartIndex(exampsvec.size, tid, total); 
-  size_t end = hogwild::GetEndIndex(exampsvec.size, tid, total);
+  // the chunks of examples we work on, see ChunkScheduler
+  ExampleRanges ranges(task.params->steal ? task.sched : NULL, exampsvec.size, tid, total);
   // optimize for const pointers 
-  size_t *perm = task.block->perm.values;
+  perm_type const *perm = task.block->perm.values;
   SVMExample const * const examps = exampsvec.values;
   SVMModel * const m = &model;
   // individually update the model for each example
   // printf("UpdateModel: thread id %d updating model from %lu to %lu\n", tid, start, end);
-  for (unsigned i = start; i < end; i++) {
-    size_t indirect = perm[i];
-    ModelUpdate(examps[indirect], params, m);
+  size_t start, end;
+  while (ranges.Next(start, end)) {
+    for (size_t i = start; i < end; i++) {
+      size_t indirect = perm[i];
+      ModelUpdate(examps[indirect], params, m);
+    }
   }
   return clock.Stop();
 }
@@ -99,17 +103,19 @@ double SVMExec::TestModel(SVMTask &task, unsigned tid, unsigned total) {
   //SVMParams const &params = *task.params;
   vector::FVector<SVMExample> const & exampsvec = task.block->ex;
 
-  // calculate which chunk of examples we work on
-  size_t start = hogwild::GetStartIndex(exampsvec.size, tid, total); 
-  size_t end = hogwild::GetEndIndex(exampsvec.size, tid, total);
+  // the chunks of examples we work on, see ChunkScheduler
+  ExampleRanges ranges(task.params->steal ? task.sched : NULL, exampsvec.size, tid, total);
 
   // keep const correctness
   SVMExample const * const examps = exampsvec.values;
   fp_type loss = 0.0;
   // compute the loss for each example
-  for (unsigned i = start; i < end; i++) {
-    fp_type l = ComputeLoss(examps[i], model);
-    loss += l;
+  size_t start, end;
+  while (ranges.Next(start, end)) {
+    for (size_t i = start; i < end; i++) {
+      fp_type l = ComputeLoss(examps[i], model);
+      loss += l;
+    }
   }
   // return the number of examples we used and the sum of the loss
   //counted = end-start;
@@ -122,17 +128,19 @@ double SVMExec::ModelAccuracy(SVMTask &task, unsigned tid, unsigned total) {
   //SVMParams const &params = *task.params;
   vector::FVector<SVMExample> const & exampsvec = task.block->ex;
 
-  // calculate which chunk of examples we work on
-  size_t start = hogwild::GetStartIndex(exampsvec.size, tid, total); 
-  size_t end = hogwild::GetEndIndex(exampsvec.size, tid, total);
+  // the chunks of examples we work on, see ChunkScheduler
+  ExampleRanges ranges(task.params->steal ? task.sched : NULL, exampsvec.size, tid, total);
 
   // keep const correctness
   SVMExample const * const examps = exampsvec.values;
   int correct = 0;
   // compute the loss for each example
-  for (unsigned i = start; i < end; i++) {
-    int l = ComputeAccuracy(examps[i], model);
-    correct += l;
+  size_t start, end;
+  while (ranges.Next(start, end)) {
+    for (size_t i = start; i < end; i++) {
+      int l = ComputeAccuracy(examps[i], model);
+      correct += l;
+    }
   }
   // return the number of examples we used and the sum of the loss
   //counted = end-start;
@@ -145,17 +153,19 @@ double SVMExec::ModelObj(SVMTask &task, unsigned tid, unsigned total) {
   //SVMParams const &params = *task.params;
   vector::FVector<SVMExample> const & exampsvec = task.block->ex;
 
-  // calculate which chunk of examples we work on
-  size_t start = hogwild::GetStartIndex(exampsvec.size, tid, total); 
-  size_t end = hogwild::GetEndIndex(exampsvec.size, tid, total);
+  // the chunks of examples we work on, see ChunkScheduler
+  ExampleRanges ranges(task.params->steal ? task.sched : NULL, exampsvec.size, tid, total);
 
   // keep const correctness
   SVMExample const * const examps = exampsvec.values;
   fp_type loss = 0.0;
   // compute the loss for each example
-  for (unsigned i = start; i < end; i++) {
-    fp_type l = ComputeLoss(examps[i], model);
-    loss += l;
+  size_t start, end;
+  while (ranges.Next(start, end)) {
+    for (size_t i = start; i < end; i++) {
+      fp_type l = ComputeLoss(examps[i], model);
+      loss += l;
+    }
   }
   start = hogwild::GetStartIndex(model.weights.size, tid, total);
   end = hogwild::GetEndIndex(model.weights.size, tid, total);
@@ -170,6 +180,17 @@ double SVMExec::ModelObj(SVMTask &task, unsigned tid, unsigned total) {
   return loss + 0.5 * reg;
 }
 
+double SVMExec::GradientNorm(const SVMModel &model, const SVMParams &params,
+                           std::vector<SVMExample const *> const &sample) {
+  return SampledGradientNorm(model.weights, params.mu, params.degrees, sample);
+}
+
+void SVMExec::SaveCheckpoint(SVMModel &model, SVMParams &params,
+                             int epoch, util::CheckpointWriter &writer) {
+  std::vector<fp_type const *> replicas(1, model.weights.values);
+  writer.Save("svm", epoch, params.step_size, replicas, model.weights.size);
+}
+
 } // namespace svm
 } // namespace hogwild
 
@@ -2,6 +2,7 @@
 #include <vector>
 
 #include "hazy/vector/fvector.h"
+#include "hazy/util/numa_alloc.h"
 #include "svmmodel.h"
 
 namespace hazy {
@@ -74,6 +75,64 @@ size_t LoadSVMExamples(Scan &scan, vector::FVector<SVMExample> &ex) {
   return max_col+1;
 }
 
+/*! \brief Moves the examples into a single buffer bound to a node.
+ * The loader allocates the features of every example separately; with
+ * the examples, their values and their indices packed in one NumaAlloc()
+ * buffer, huge pages can back the dataset and the random accesses of the
+ * epochs miss the TLB less often. The values and the indices of an example
+ * are next to each other. The per-example arrays are freed, the buffer is
+ * kept for the lifetime of the process.
+ * \param ex the examples from LoadSVMExamples()
+ * \param node the node of the buffer, -1 for the policy of the caller
+ * \param huge_pages one of util::HugePages
+ */
+void PackSVMExamples(vector::FVector<SVMExample> &ex, int node, int huge_pages) {
+  size_t bytes = sizeof(SVMExample) * ex.size;
+  for (size_t i = 0; i < ex.size; i++) {
+    size_t n = ex.values[i].vector.size;
+    // keep the values of the next example aligned
+    bytes += sizeof(fp_type) * n + (sizeof(int) * n + sizeof(fp_type) - 1) / sizeof(fp_type) * sizeof(fp_type);
+  }
+  char *buf = static_cast<char*>(util::NumaAlloc(bytes, node, huge_pages));
+  SVMExample *packed = reinterpret_cast<SVMExample*>(buf);
+  char *next = buf + sizeof(SVMExample) * ex.size;
+  for (size_t i = 0; i < ex.size; i++) {
+    SVMExample const &e = ex.values[i];
+    size_t n = e.vector.size;
+    fp_type *d = reinterpret_cast<fp_type*>(next);
+    int *idx = reinterpret_cast<int*>(next + sizeof(fp_type) * n);
+    memcpy(d, e.vector.values, sizeof(fp_type) * n);
+    memcpy(idx, e.vector.index, sizeof(int) * n);
+    next += sizeof(fp_type) * n + (sizeof(int) * n + sizeof(fp_type) - 1) / sizeof(fp_type) * sizeof(fp_type);
+    new (&packed[i]) SVMExample(e.value, d, idx, n);
+    delete [] e.vector.values;
+    delete [] e.vector.index;
+  }
+  delete [] ex.values;
+  ex.values = packed;
+}
+
+/*! \brief PackSVMExamples() on every node's copy of the examples
+ * Nodes sharing a copy keep sharing it.
+ * \param nodeex the examples of each node
+ * \param nnodes number of nodes
+ * \param only_node the node of the copy when all the nodes share one, or -1
+ * \param huge_pages one of util::HugePages
+ */
+void PackNodeSVMExamples(vector::FVector<SVMExample> *nodeex, unsigned nnodes, int only_node, int huge_pages) {
+  std::vector<SVMExample*> unpacked(nnodes);
+  for (unsigned n = 0; n < nnodes; ++n) {
+    unpacked[n] = nodeex[n].values;
+    unsigned m = std::find(unpacked.begin(), unpacked.begin() + n, unpacked[n]) - unpacked.begin();
+    if (m < n) {
+      nodeex[n] = nodeex[m];
+    }
+    else {
+      PackSVMExamples(nodeex[n], only_node >= 0 ? only_node : n, huge_pages);
+    }
+  }
+}
+
 /*! \brief Computes the degree of each feature, assuems degs init'd to all 0
  */
 void CountDegrees(const vector::FVector<SVMExample> &ex, unsigned *degs) {
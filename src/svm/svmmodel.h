@@ -77,10 +77,11 @@ struct SVMParams {
   float step_decay; //!< factor to modify step_size by each epoch
   unsigned const *degrees; //!< degree of each feature
   unsigned ndim; //!< number of features, length of degrees
+  bool steal; //!< balance the examples with the task's ChunkScheduler
 
   //! Constructs a enw set of params
   SVMParams(fp_type stepsize, fp_type stepdecay, fp_type _mu) :
-      mu(_mu), step_size(stepsize), step_decay(stepdecay) { }
+      mu(_mu), step_size(stepsize), step_decay(stepdecay), steal(true) { }
 };
 
 //! A single example which is a value/rating and a vector
@@ -54,6 +54,8 @@ int main(int argc, char** argv) {
   unsigned nthreads = 1;
   float mu = 1.0, step_size = 5e-2, step_decay = 0.8;
   double target_accuracy = 1.0;
+  bool steal = true;
+  unsigned seed = 0;
   static struct extended_option long_options[] = {
     {"mu", required_argument, NULL, 'u', "the maxnorm"},
     {"epochs"    ,required_argument, NULL, 'e', "number of epochs (default is 20)"},
@@ -65,6 +67,7 @@ int main(int argc, char** argv) {
     {"binary", required_argument,NULL, 'v', "load the file in a binary fashion"},
     {"matlab-tsv", required_argument,NULL, 'm', "load TSVs indexing from 1 instead of 0"},
     {"target_accuracy", required_argument,NULL, 'a', "target accuracy to converge"},
+    {"steal", required_argument, NULL, 'f', "balance the examples between the threads by work stealing (default 1)"},
     {NULL,0,NULL,0,0} 
   };
 
@@ -98,6 +101,12 @@ int main(int argc, char** argv) {
       case 'a':
         target_accuracy = atof(optarg);
         break;
+      case 's':
+        seed = strtoul(optarg, NULL, 10);
+        break;
+      case 'f':
+        steal = (atoi(optarg) != 0);
+        break;
       case ':':
       case '?':
         print_usage(long_options, argv[0], usage_str);
@@ -115,6 +124,12 @@ int main(int argc, char** argv) {
     print_usage(long_options, argv[0], usage_str);
     exit(-1);
   }
+  if (seed == 0) {
+    util::SimpleRandom::SeedByTime();
+    seed = util::SimpleRandom::Seed();
+  }
+  // each run is seeded from a stream of its own
+  printf("seed: %u\n", seed);
   //fp_type buf[50];
 
   vector::FVector<SVMExample> train_examps;
@@ -158,15 +173,17 @@ int main(int argc, char** argv) {
 
 //  hogwild::freeforall::FeedTrainTest(memfeed.GetTrough(), nepochs, nthreads);
   for (int i = 0; i < ITERATIONS; ++i) {
+    util::SimpleRandom::SetSeed(util::SimpleRandom::StreamSeed(seed, i));
     SVMParams tp (step_size, step_decay, mu);
     tp.degrees = degs;
     tp.ndim = nfeats;
+    tp.steal = steal;
     SVMModel m(nfeats);
     hazy::thread::ThreadPool tpool(nthreads);
     tpool.Init();
     MemoryScan<SVMExample> mscan(train_examps);
     Hogwild<SVMModel, SVMParams, SVMExec>  hw(m, tp, tpool);
-    MemoryScan<SVMExample> tscan(test_examps);
+    MemoryScan<SVMExample> tscan(test_examps, false);
     printf("Run experiment: threads=%d\n", nthreads);
     hw.RunExperiment(nepochs, wall_clock, mscan, tscan, target_accuracy);
   }
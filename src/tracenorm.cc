@@ -58,8 +58,9 @@ int main(int argc, char* argv[]) {
 
   bool loadBinary = false;
   size_t bFileScan = 0;
-  char *testFile = NULL, *outputTestFile = NULL;
+  char *testFile = NULL, *outputTestFile = NULL, *outputBinaryFile = NULL;
   char *infile = NULL;
+  int huge_pages = util::kHugePagesNone;
   static struct extended_option long_options[] = {
     {"mu", required_argument, NULL, 'u', "the maxnorm"},
     {"maxrank", required_argument, NULL, 'm', "size of factorization of L and R"},
@@ -72,7 +73,9 @@ int main(int argc, char* argv[]) {
     {"file_scan", required_argument,NULL, 'f', "load the file in a scan (binary)"},
     {"outfile", required_argument,NULL, 'o', "write out to NAME-L.tsv and NAME-R.tsv"},
     {"infile", required_argument,NULL, 'l', "load from the given NAME-L.tsv and NAME-R.tsv"},
+    {"binary_outfile", required_argument,NULL, 'b', "write L and R to a binary checkpoint NAME, see bin/infer"},
     {"matlab-tsv", required_argument,NULL, 't', "load TSVs indexing from 1 instead of 0"},
+    {"hugepages", required_argument, NULL, 'H', "pages of L and R: none, thp (transparent), 2m or 1g (reserved hugetlbfs pages) (default none)"},
     {NULL,0,NULL,0,0} 
   };
 
@@ -94,6 +97,9 @@ int main(int argc, char* argv[]) {
   break;
       case 'l':
   infile = optarg;
+  break;
+      case 'b':
+  outputBinaryFile = optarg;
   break;
       case 'v':
   loadBinary = (atoi(optarg) != 0);
@@ -124,6 +130,13 @@ int main(int argc, char* argv[]) {
   break;
       case 'r':
   nSplits         = atoi(optarg);
+  break;
+      case 'H':
+  huge_pages = util::ParseHugePages(optarg);
+  if (huge_pages < 0) {
+    printf("Unknown huge page policy %s\n", optarg);
+    exit(-1);
+  }
   break;
       case ':':
       case '?':
@@ -184,7 +197,16 @@ int main(int argc, char* argv[]) {
     LoadExamples(scan, test_examps);
   }
 
-  Model_t model (params.mean, params.nRows, params.nCols, params.max_rank);
+  if (seed == 0) {
+    util::SimpleRandom::SeedByTime();
+    seed = util::SimpleRandom::Seed();
+  }
+  else {
+    util::SimpleRandom::SetSeed(seed);
+  }
+  // the initial factors and the shuffles follow from it
+  printf("seed: %u\n", (unsigned) seed);
+  Model_t model (params.mean, params.nRows, params.nCols, params.max_rank, huge_pages);
 
   hazy::thread::ThreadPool tpool(nSplits);
   tpool.Init();
@@ -209,6 +231,9 @@ int main(int argc, char* argv[]) {
   if (outputTestFile != NULL) {
     model.OutputToFile(outputTestFile, params);
   }
+  if (outputBinaryFile != NULL) {
+    model.OutputToCheckpoint(outputBinaryFile, params, nEpochs);
+  }
 
   fflush(stdout);
   tpool.Join();
@@ -20,8 +20,10 @@
 #define HAZY_HOGWILD_MATFACT_MAT_EXEC_H
 #include <iostream>
 #include <cstdio>
+#include <vector>
 
 #include "hazy/types/tuple.h"
+#include "hazy/util/metrics.h"
 
 namespace hazy {
 namespace hogwild {
@@ -62,6 +64,12 @@ class MFExec {
   }
   static void PostEpoch(MFModel &model, MFParams &params) {
   }
+
+  //! Adds the counters of the last epoch to its metrics, before PostEpoch
+  static void EpochMetrics(MFModel &model, MFParams &params,
+                           util::MetricsRecord &epoch,
+                           std::vector<util::MetricsRecord> &threads) {
+  }
 };
 
 } // namespace matfact
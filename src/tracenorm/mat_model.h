@@ -22,12 +22,15 @@
 #include <iostream>
 #include <cstdio>
 #include <cstdlib>
+#include <vector>
 
 #include "hazy/vector/fvector.h"
 #include "hazy/vector/svector.h"
 #include "hazy/scan/tsvfscan.h"
 
 #include "hazy/hogwild/hogwild_task.h"
+#include "hazy/util/checkpoint.h"
+#include "hazy/util/numa_alloc.h"
 
 namespace hazy {
 namespace hogwild {
@@ -83,21 +86,23 @@ struct MFModel {
   double mean;
   size_t rows, cols;
   size_t max_rank;
+  int huge_pages; //!< pages of the matrices, see util::HugePages
 
   explicit MFModel() { }
-  //! Allocates the left and right matrix
-  explicit MFModel(double mean, size_t rows, size_t cols, size_t max_rank) {
+  /*! Allocates the left and right matrix
+   * Each matrix is one buffer of rows of max_rank values, so that huge
+   * pages can back it, see util::NumaAlloc().
+   */
+  explicit MFModel(double mean, size_t rows, size_t cols, size_t max_rank,
+                   int huge_pages = util::kHugePagesNone) {
     // Allocate and init the matrix
-    L = new vector::FVector<double>[rows];
     this->rows = rows;
     this->cols = cols;
     this->max_rank = max_rank;
     this->mean = mean;
+    this->huge_pages = huge_pages;
+    L = AllocateMatrix(rows);
     for (size_t i = 0; i < rows; i++) { //p.nRows; i++) {
-      double *arr = new double[max_rank];
-      vector::FVector<double> &v = L[i];
-      v.size = max_rank;
-      v.values = arr;
       for(size_t j = 0; j < max_rank; j++) {
         // the magic initial values....
         L[i].values[j] = (drand48()-0.5)*1e-3;
@@ -105,10 +110,8 @@ struct MFModel {
     }
 
     // Allocate the matrix
-    R = new vector::FVector<double>[cols];
+    R = AllocateMatrix(cols);
     for (size_t i = 0; i < cols; i++) {
-      R[i].size = max_rank;
-      R[i].values = new double[max_rank];
       for(size_t j = 0; j < max_rank; j++) {
         // chosen by magic
         R[i].values[j] = (drand48()-0.5)*1e-3;
@@ -123,22 +126,25 @@ struct MFModel {
     p->cols = cols;
     p->mean = mean;
     p->max_rank = max_rank;
-    p->L = new vector::FVector<double>[rows];
-    for (size_t i = 0; i < rows; i++) { //p.nRows; i++) {
-      vector::FVector<double> &v = p->L[i];
-      v.values = new double[max_rank];
-      v.size = L[0].size;
-    }
-    p->R = new vector::FVector<double>[cols];
-    for (size_t i = 0; i < cols; i++) { //p.nRows; i++) {
-      vector::FVector<double> &v = p->R[i];
-      v.values = new double[max_rank];
-      v.size = R[0].size;
-    }
+    p->huge_pages = huge_pages;
+    p->L = p->AllocateMatrix(rows);
+    p->R = p->AllocateMatrix(cols);
     p->CopyFrom(*this);
     return p;
   }
 
+  //! Allocates n rows of max_rank values, in a single buffer
+  vector::FVector<double>* AllocateMatrix(size_t n) {
+    vector::FVector<double> *m = new vector::FVector<double>[n];
+    double *buf = static_cast<double*>(util::NumaAlloc(
+        sizeof(double) * max_rank * n, -1, huge_pages));
+    for (size_t i = 0; i < n; i++) {
+      m[i].size = max_rank;
+      m[i].values = buf + i * max_rank;
+    }
+    return m;
+  }
+
   void CopyFrom(MFModel &m) {
     for (size_t i = 0; i < rows; i++) { //p.nRows; i++) {
       memcpy(L[i].values, m.L[i].values, 
@@ -172,6 +178,27 @@ struct MFModel {
     fclose(out);
   }
 
+  /*! Writes L then R to a binary checkpoint of model "mf", which bin/infer
+   * maps to predict entries.
+   * \param epoch the epochs trained
+   */
+  void OutputToCheckpoint(char const *name, const MFParams &p, int epoch) {
+    std::vector<double> buf;
+    buf.reserve((p.nRows + p.nCols) * max_rank);
+    for (size_t i = 0; i < p.nRows; i++) {
+      buf.insert(buf.end(), L[i].values, L[i].values + max_rank);
+    }
+    for (size_t i = 0; i < p.nCols; i++) {
+      buf.insert(buf.end(), R[i].values, R[i].values + max_rank);
+    }
+    printf("Writing to %s\n", name);
+    util::CheckpointWriter writer(name);
+    writer.SetShape(p.nRows, p.nCols, mean);
+    writer.Save("mf", epoch, p.step_size, std::vector<double const *>(1, &buf[0]),
+                buf.size());
+    writer.Wait();
+  }
+
   void LoadFromFile(char const *name) {
     char buf[1024];
     sprintf(buf, "%s-L.tsv", name);